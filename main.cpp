@@ -5,259 +5,7742 @@
 #include <string>
 #include <unordered_map>
 #include <set>
+#include <map>
 #include <memory>
+#include <memory_resource>
 #include <algorithm>
+#include <array>
 #include <unordered_set>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <queue>
+#include <random>
+#include <filesystem>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HAVE_SSE2
+#endif
+// El código AVX2 se compila siempre en x86-64 y se usa solo si el procesador lo tiene
+#if (defined(__x86_64__) && defined(__GNUC__)) || defined(_M_X64)
+#include <immintrin.h>
+#define HAVE_AVX2
+#endif
+#ifdef __GNUC__
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 using namespace std;
 
-struct Movie {
-    string imdb_id;
-    string title;
-    string plot_synopsis;
-    string tags;
-    mutable int relevance_score = 0;
-    string split;
-    string synopsis_source;
-    bool liked = false;           // Marca si la película recibió un "Like"
-    bool watch_later = false;     // Marca si la película fue añadida a "Ver más tarde"
-};
+// Archivo de solo lectura mapeado en memoria
+class MappedFile {
+public:
+    explicit MappedFile(const string &filename) {
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize)) return;
+        length = (size_t)fileSize.QuadPart;
+        opened = true;
+        if (length == 0) return;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) {
+            bytes = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+        opened = bytes != nullptr;
+#else
+        fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) != 0) return;
+        length = (size_t)st.st_size;
+        opened = true;
+        if (length == 0) return;
+        int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        flags |= MAP_POPULATE;
+#endif
+        void *addr = mmap(nullptr, length, PROT_READ, flags, fd, 0);
+        if (addr == MAP_FAILED) {
+            opened = false;
+            return;
+        }
+        bytes = (const char *)addr;
+        madvise(addr, length, MADV_SEQUENTIAL);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (bytes) munmap((void *)bytes, length);
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool is_open() const { return opened; }
+    const char *data() const { return bytes; }
+    size_t size() const { return bytes ? length : 0; }
+
+private:
+    const char *bytes = nullptr;
+    size_t length = 0;
+    bool opened = false;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// Vista de solo lectura sobre un arreglo contiguo: la memoria de un vector o de un archivo mapeado
+template <typename T>
+class ArrayView {
+public:
+    ArrayView() = default;
+    ArrayView(const T *data, size_t size) : ptr(data), count(size) {}
+    template <typename Alloc>
+    ArrayView(const vector<T, Alloc> &values) : ptr(values.data()), count(values.size()) {}
+
+    const T &operator[](size_t i) const { return ptr[i]; }
+    const T *data() const { return ptr; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T *begin() const { return ptr; }
+    const T *end() const { return ptr + count; }
+
+private:
+    const T *ptr = nullptr;
+    size_t count = 0;
+};
+
+class MovieStore;
+class SnapshotWriter;
+class SnapshotReader;
+
+// Película del catálogo: una referencia a su fila en MovieStore. Copiarla no copia
+// texto; los campos se leen de las columnas, así que el catálogo debe seguir vivo.
+class Movie {
+public:
+    Movie() = default;
+    Movie(const MovieStore *store, uint32_t doc) : store(store), doc(doc) {}
+
+    string_view imdb_id() const;
+    string_view title() const;
+    string_view plot_synopsis() const;
+    string_view tags() const;
+    string_view split() const;
+    string_view synopsis_source() const;
+    uint32_t id() const { return doc; }
+
+private:
+    const MovieStore *store = nullptr;
+    uint32_t doc = 0;
+};
+
+// Catálogo de películas por columnas. El texto de un campo de todas las películas va
+// seguido en un solo bloque, con el inicio de cada película (uno más al final), así
+// recorrer los títulos lee memoria contigua. split y synopsis_source tienen pocos
+// valores distintos: se guarda un código por película y el diccionario de valores.
+class MovieStore {
+public:
+    enum TextColumn { IMDB_ID, TITLE, PLOT_SYNOPSIS, TAGS, TEXT_COLUMNS };
+    enum CodedColumn { SPLIT, SYNOPSIS_SOURCE, CODED_COLUMNS };
+
+    MovieStore() {
+        for (auto &column : textStorage) column.offsets.push_back(0);
+        for (auto &column : codedStorage) column.valueOffsets.push_back(0);
+        refresh();
+    }
+
+    // Las vistas apuntan a los vectores propios, que al moverse conservan su memoria
+    MovieStore(MovieStore &&) = default;
+    MovieStore &operator=(MovieStore &&) = default;
+    MovieStore(const MovieStore &) = delete;
+    MovieStore &operator=(const MovieStore &) = delete;
+
+    uint32_t add(string_view imdbId, string_view title, string_view synopsis, string_view tags, string_view split,
+                 string_view source) {
+        if (attached) {
+            cerr << "No se puede agregar a un catálogo cargado de un snapshot" << endl;
+            return UINT32_MAX;
+        }
+        uint32_t doc = (uint32_t)size();
+        string_view fields[TEXT_COLUMNS] = {imdbId, title, synopsis, tags};
+        for (size_t c = 0; c < TEXT_COLUMNS; ++c) {
+            textStorage[c].text.insert(textStorage[c].text.end(), fields[c].begin(), fields[c].end());
+            textStorage[c].offsets.push_back(textStorage[c].text.size());
+        }
+        codedStorage[SPLIT].codes.push_back(encode(SPLIT, split));
+        codedStorage[SYNOPSIS_SOURCE].codes.push_back(encode(SYNOPSIS_SOURCE, source));
+        refresh();
+        return doc;
+    }
+
+    // Agrega todas las películas de otro catálogo, en orden
+    void append(const MovieStore &other) {
+        if (attached) {
+            cerr << "No se puede agregar a un catálogo cargado de un snapshot" << endl;
+            return;
+        }
+        for (size_t c = 0; c < TEXT_COLUMNS; ++c) {
+            TextStorage &column = textStorage[c];
+            uint64_t base = column.text.size();
+            column.text.insert(column.text.end(), other.text[c].begin(), other.text[c].end());
+            for (size_t i = 1; i < other.offsets[c].size(); ++i) column.offsets.push_back(base + other.offsets[c][i]);
+        }
+        for (size_t c = 0; c < CODED_COLUMNS; ++c) {
+            CodedColumn column = (CodedColumn)c;
+            vector<uint16_t> remap(other.numValues(column));
+            for (size_t code = 0; code < remap.size(); ++code) remap[code] = encode(column, other.value(column, code));
+            for (uint16_t code : other.codes[c]) codedStorage[c].codes.push_back(remap[code]);
+        }
+        refresh();
+    }
+
+    // Devuelve la capacidad sobrante de los vectores; se llama al terminar de agregar
+    void shrinkToFit() {
+        if (attached) return;
+        for (auto &column : textStorage) {
+            column.text.shrink_to_fit();
+            column.offsets.shrink_to_fit();
+        }
+        for (auto &column : codedStorage) {
+            column.valueNames.shrink_to_fit();
+            column.valueOffsets.shrink_to_fit();
+            column.codes.shrink_to_fit();
+        }
+        refresh();
+    }
+
+    size_t size() const { return offsets[TITLE].size() - 1; }
+    bool empty() const { return size() == 0; }
+
+    string_view field(TextColumn column, uint32_t doc) const {
+        uint64_t begin = offsets[column][doc];
+        return string_view(text[column].data() + begin, offsets[column][doc + 1] - begin);
+    }
+
+    string_view field(CodedColumn column, uint32_t doc) const { return value(column, codes[column][doc]); }
+
+    // Diccionario de una columna codificada
+    size_t numValues(CodedColumn column) const { return valueOffsets[column].size() - 1; }
+
+    string_view value(CodedColumn column, size_t code) const {
+        uint32_t begin = valueOffsets[column][code];
+        return string_view(valueNames[column].data() + begin, valueOffsets[column][code + 1] - begin);
+    }
+
+    Movie operator[](uint32_t doc) const { return Movie(this, doc); }
+
+    class iterator {
+    public:
+        iterator(const MovieStore *store, uint32_t doc) : store(store), doc(doc) {}
+        Movie operator*() const { return Movie(store, doc); }
+        iterator &operator++() {
+            ++doc;
+            return *this;
+        }
+        bool operator!=(const iterator &other) const { return doc != other.doc; }
+
+    private:
+        const MovieStore *store;
+        uint32_t doc;
+    };
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, (uint32_t)size()); }
+
+    size_t memoryBytes() const {
+        size_t bytes = 0;
+        for (size_t c = 0; c < TEXT_COLUMNS; ++c) bytes += text[c].size() + offsets[c].size() * sizeof(uint64_t);
+        for (size_t c = 0; c < CODED_COLUMNS; ++c) {
+            bytes += valueNames[c].size() + valueOffsets[c].size() * sizeof(uint32_t) + codes[c].size() * sizeof(uint16_t);
+        }
+        return bytes;
+    }
+
+    // Secciones del snapshot (definidas junto a SnapshotWriter y SnapshotReader)
+    void addSections(SnapshotWriter &writer) const;
+    bool attach(const SnapshotReader &reader);
+
+    ArrayView<char> text[TEXT_COLUMNS];
+    ArrayView<uint64_t> offsets[TEXT_COLUMNS];        // Inicio de cada película en text (uno más al final)
+    ArrayView<char> valueNames[CODED_COLUMNS];
+    ArrayView<uint32_t> valueOffsets[CODED_COLUMNS];  // Inicio de cada valor en valueNames (uno más al final)
+    ArrayView<uint16_t> codes[CODED_COLUMNS];         // Código del valor de cada película
+
+private:
+    struct TextStorage {
+        vector<char> text;
+        vector<uint64_t> offsets;
+    };
+    struct CodedStorage {
+        vector<char> valueNames;
+        vector<uint32_t> valueOffsets;
+        vector<uint16_t> codes;
+    };
+    TextStorage textStorage[TEXT_COLUMNS];
+    CodedStorage codedStorage[CODED_COLUMNS];
+    bool attached = false; // Las vistas apuntan a un snapshot y no a los vectores
+    shared_ptr<const MappedFile> mapping; // Mantiene mapeado el snapshot mientras exista el catálogo
+
+    // Código de un valor; los diccionarios son chicos y se recorren completos
+    uint16_t encode(CodedColumn column, string_view name) {
+        for (size_t code = 0; code < numValues(column); ++code) {
+            if (value(column, code) == name) return (uint16_t)code;
+        }
+        CodedStorage &storage = codedStorage[column];
+        if (storage.valueOffsets.size() > UINT16_MAX) {
+            cerr << "Demasiados valores distintos en una columna codificada" << endl;
+            return 0;
+        }
+        storage.valueNames.insert(storage.valueNames.end(), name.begin(), name.end());
+        storage.valueOffsets.push_back((uint32_t)storage.valueNames.size());
+        refresh();
+        return (uint16_t)(storage.valueOffsets.size() - 2);
+    }
+
+    void refresh() {
+        for (size_t c = 0; c < TEXT_COLUMNS; ++c) {
+            text[c] = textStorage[c].text;
+            offsets[c] = textStorage[c].offsets;
+        }
+        for (size_t c = 0; c < CODED_COLUMNS; ++c) {
+            valueNames[c] = codedStorage[c].valueNames;
+            valueOffsets[c] = codedStorage[c].valueOffsets;
+            codes[c] = codedStorage[c].codes;
+        }
+    }
+};
+
+inline string_view Movie::imdb_id() const { return store->field(MovieStore::IMDB_ID, doc); }
+inline string_view Movie::title() const { return store->field(MovieStore::TITLE, doc); }
+inline string_view Movie::plot_synopsis() const { return store->field(MovieStore::PLOT_SYNOPSIS, doc); }
+inline string_view Movie::tags() const { return store->field(MovieStore::TAGS, doc); }
+inline string_view Movie::split() const { return store->field(MovieStore::SPLIT, doc); }
+inline string_view Movie::synopsis_source() const { return store->field(MovieStore::SYNOPSIS_SOURCE, doc); }
+
+static int countTrailingZeros(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return (int)index;
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+static uint32_t popcount(uint64_t word) {
+#ifdef _MSC_VER
+    return (uint32_t)__popcnt64(word);
+#else
+    return (uint32_t)__builtin_popcountll(word);
+#endif
+}
+
+// Separa un texto UTF-8 en palabras: letras y dígitos seguidos, en minúsculas, sin
+// tildes y sin depender del locale. Cada paso clasifica y pasa a minúsculas 64 bytes
+// (con SSE2 o AVX2 según el procesador, elegido al ejecutar) y arma una máscara con un
+// bit por byte de palabra; las palabras empiezan y terminan donde cambia la máscara.
+// Cada carácter no ASCII se pliega aparte con tablas ("Acción" -> "accion", "Ñandú"
+// -> "nandu") y el bloque siguiente empieza justo después. El texto plegado nunca es
+// más largo que el original. Las palabras son vistas sobre un búfer que se reutiliza.
+class Tokenizer {
+public:
+    enum Kernel { SCALAR, SSE2, AVX2 };
+
+    // Las vistas valen hasta la siguiente llamada sobre este tokenizador
+    const vector<string_view> &split(string_view text) { return split(text, bestKernel()); }
+
+    const vector<string_view> &split(string_view text, Kernel kernel) {
+        if (buffer.size() < text.size()) buffer.resize(text.size());
+        tokens.clear();
+        Boundaries boundaries{buffer.data(), &tokens};
+        switch (kernel) {
+#ifdef HAVE_AVX2
+        case AVX2:
+            scanAVX2(text.data(), text.size(), boundaries);
+            break;
+#endif
+#ifdef HAVE_SSE2
+        case SSE2:
+            scanSSE2(text.data(), text.size(), boundaries);
+            break;
+#endif
+        default:
+            scanScalar(text.data(), text.size(), boundaries);
+        }
+        lastInWord = boundaries.inWord;
+        return tokens;
+    }
+
+    // Si el último texto separado termina dentro de una palabra (sin separador al final)
+    bool endsInWord() const { return lastInWord; }
+
+    // Reescribe en su lugar las palabras del último texto separado. fn(word, length)
+    // devuelve el largo nuevo, que no puede ser mayor; con 0 la palabra queda vacía
+    // pero conserva su lugar, así no se corren las posiciones de las siguientes.
+    template <typename Fn>
+    const vector<string_view> &rewrite(Fn &&fn) {
+        for (string_view &token : tokens) {
+            char *word = buffer.data() + (token.data() - buffer.data());
+            token = string_view(word, fn(word, token.size()));
+        }
+        return tokens;
+    }
+
+    // Tokenizador del hilo actual
+    static Tokenizer &local() {
+        thread_local Tokenizer tokenizer;
+        return tokenizer;
+    }
+
+    // AVX2 solo existe en procesadores con SSE2
+    static bool supported(Kernel kernel) { return kernel <= bestKernel(); }
+
+    static Kernel bestKernel() {
+        static const Kernel best = detectKernel();
+        return best;
+    }
+
+private:
+    vector<char> buffer; // Texto en minúsculas y plegado
+    vector<string_view> tokens;
+    bool lastInWord = false;
+
+    // Recorre las máscaras de 64 bytes y agrega una palabra por cada par de cambios.
+    // shift es cuántos bytes más corto quedó el texto plegado hasta el bloque actual:
+    // el byte base del texto va a la posición base - shift del búfer.
+    struct Boundaries {
+        char *out;
+        vector<string_view> *tokens;
+        size_t start = 0;
+        size_t shift = 0;
+        bool inWord = false;
+
+        char *at(size_t base) const { return out + (base - shift); }
+
+        void add(uint64_t mask, size_t base, size_t width) {
+            uint64_t changes = mask ^ ((mask << 1) | (uint64_t)inWord);
+            if (width < 64) changes &= (1ULL << width) - 1;
+            while (changes) {
+                size_t i = base - shift + countTrailingZeros(changes);
+                if (inWord) tokens->emplace_back(out + start, i - start);
+                else start = i;
+                inWord = !inWord;
+                changes &= changes - 1;
+            }
+        }
+
+        // Un carácter de palabra o un separador en la posición i del búfer
+        void word(size_t i) {
+            if (!inWord) start = i;
+            inWord = true;
+        }
+
+        void separator(size_t i) {
+            if (inWord) tokens->emplace_back(out + start, i - start);
+            inWord = false;
+        }
+
+        void finish(size_t size) {
+            if (inWord) tokens->emplace_back(out + start, size - shift - start);
+        }
+    };
+
+    // Los kernels devuelven la máscara de bytes no ASCII del bloque. Si hay alguno, la
+    // máscara de palabras vale hasta el primero, ese carácter se pliega con foldChar y
+    // el siguiente bloque empieza justo después; lo que el kernel haya escrito más
+    // allá en out se vuelve a escribir.
+    static uint64_t classifyScalar(const char *in, char *out, size_t width, uint64_t &mask) {
+        uint64_t high = 0;
+        mask = 0;
+        for (size_t i = 0; i < width; ++i) {
+            unsigned char ch = (unsigned char)in[i];
+            bool letter = (unsigned char)((ch | 0x20) - 'a') < 26;
+            bool digit = (unsigned char)(ch - '0') < 10;
+            out[i] = (char)(letter ? ch | 0x20 : ch);
+            mask |= (uint64_t)(letter || digit) << i;
+            high |= (uint64_t)(ch >> 7) << i;
+        }
+        return high;
+    }
+
+    // Agrega las palabras del bloque hasta el primer byte no ASCII, pliega ese carácter
+    // y devuelve dónde sigue el texto
+    static size_t advance(const char *in, size_t base, size_t width, size_t size, uint64_t mask, uint64_t high,
+                          Boundaries &boundaries) {
+        if (!high) {
+            boundaries.add(mask, base, width);
+            return base + width;
+        }
+        size_t ascii = countTrailingZeros(high);
+        boundaries.add(mask, base, ascii);
+        return foldChar(in, base + ascii, size, boundaries);
+    }
+
+    // Bloques del final, de menos de 64 bytes; el kernel escalar los recorre todos
+    static void scanTail(const char *in, size_t base, size_t size, Boundaries &boundaries) {
+        while (base < size) {
+            size_t width = min<size_t>(64, size - base);
+            uint64_t mask;
+            uint64_t high = classifyScalar(in + base, boundaries.at(base), width, mask);
+            base = advance(in, base, width, size, mask, high, boundaries);
+        }
+        boundaries.finish(size);
+    }
+
+    static void scanScalar(const char *in, size_t size, Boundaries &boundaries) { scanTail(in, 0, size, boundaries); }
+
+    // Plegado de un carácter: kind dice si es parte de una palabra, si separa palabras
+    // o si es una marca que se descarta sin cortar la palabra (tildes combinables)
+    enum FoldKind : uint8_t { SEPARATOR, LETTER, MARK };
+
+    struct Fold {
+        FoldKind kind;
+        uint8_t length; // Bytes de salida, nunca más que los del carácter original
+        char bytes[2];
+    };
+
+    // Letras de U+00C0 a U+017F sin tilde y en minúsculas, una por carácter. Las
+    // mayúsculas son ligaduras de dos letras y ' ' es un signo (× y ÷).
+    static constexpr char LATIN_FOLD[] = "aaaaaaAceeeeiiiidnooooo ouuuuyTS"
+                                         "aaaaaaAceeeeiiiidnooooo ouuuuyTy"
+                                         "aaaaaaccccccccddddeeeeeeeeeegggggggg"
+                                         "hhhhiiiiiiiiiiJJjjkkkllllllllllnnnnnnnnn"
+                                         "ooooooOOrrrrrrsssssssstttttt"
+                                         "uuuuuuuuuuuuwwyyyzzzzzzs";
+    static_assert(sizeof(LATIN_FOLD) - 1 == 0x180 - 0xC0, "Una letra por carácter de U+00C0 a U+017F");
+
+    // Tabla de los caracteres de dos bytes (U+0080 a U+07FF): latín plegado a ASCII,
+    // griego y cirílico en minúsculas, marcas combinables y signos como separadores
+    static const Fold *foldTable() {
+        static const vector<Fold> table = []() {
+            vector<Fold> fold(0x800);
+            auto letter = [&](uint32_t cp, uint32_t to) {
+                fold[cp] = {LETTER, 2, {(char)(0xC0 | (to >> 6)), (char)(0x80 | (to & 0x3F))}};
+            };
+            auto ascii = [&](uint32_t cp, const char *to) {
+                fold[cp] = {LETTER, (uint8_t)strlen(to), {to[0], to[1]}};
+            };
+            auto range = [&](uint32_t first, uint32_t last, FoldKind kind) {
+                for (uint32_t cp = first; cp <= last; ++cp) {
+                    if (kind == LETTER) letter(cp, cp);
+                    else fold[cp] = {kind, 0, {0, 0}};
+                }
+            };
+            // U+0080 a U+00BF son signos, salvo los ordinales y el guion opcional
+            ascii(0xAA, "a");
+            ascii(0xBA, "o");
+            fold[0xAD] = {MARK, 0, {0, 0}};
+            const char *ligatures[] = {"Aae", "Ooe", "Tth", "Sss", "Jij"};
+            for (uint32_t cp = 0xC0; cp < 0x180; ++cp) {
+                char ch = LATIN_FOLD[cp - 0xC0];
+                if (ch == ' ') continue;
+                char to[3] = {ch, 0, 0};
+                for (const char *ligature : ligatures) {
+                    if (ligature[0] == ch) memcpy(to, ligature + 1, 2);
+                }
+                ascii(cp, to);
+            }
+            range(0x180, 0x2AF, LETTER);
+            range(0x300, 0x36F, MARK);
+            // Griego: mayúsculas, tonos y sigma final
+            range(0x370, 0x3FF, LETTER);
+            fold[0x37E] = fold[0x387] = {SEPARATOR, 0, {0, 0}};
+            for (uint32_t cp = 0x391; cp <= 0x3AB; ++cp) letter(cp, cp + 0x20);
+            const uint32_t greekAccents[][2] = {{0x386, 0x3B1}, {0x388, 0x3B5}, {0x389, 0x3B7}, {0x38A, 0x3B9},
+                                                {0x38C, 0x3BF}, {0x38E, 0x3C5}, {0x38F, 0x3C9}, {0x390, 0x3B9},
+                                                {0x3AA, 0x3B9}, {0x3AB, 0x3C5}, {0x3AC, 0x3B1}, {0x3AD, 0x3B5},
+                                                {0x3AE, 0x3B7}, {0x3AF, 0x3B9}, {0x3B0, 0x3C5}, {0x3C2, 0x3C3},
+                                                {0x3CA, 0x3B9}, {0x3CB, 0x3C5}, {0x3CC, 0x3BF}, {0x3CD, 0x3C5},
+                                                {0x3CE, 0x3C9}};
+            for (const auto &accent : greekAccents) letter(accent[0], accent[1]);
+            // Cirílico: mayúsculas (ё se escribe como е) y pares mayúscula/minúscula
+            range(0x400, 0x52F, LETTER);
+            for (uint32_t cp = 0x400; cp < 0x410; ++cp) letter(cp, cp + 0x50);
+            for (uint32_t cp = 0x410; cp < 0x430; ++cp) letter(cp, cp + 0x20);
+            letter(0x401, 0x435);
+            letter(0x451, 0x435);
+            for (uint32_t cp = 0x460; cp < 0x482; cp += 2) letter(cp, cp + 1);
+            for (uint32_t cp = 0x48A; cp < 0x4C0; cp += 2) letter(cp, cp + 1);
+            for (uint32_t cp = 0x4C1; cp < 0x4CF; cp += 2) letter(cp, cp + 1);
+            for (uint32_t cp = 0x4D0; cp < 0x530; cp += 2) letter(cp, cp + 1);
+            fold[0x482] = {SEPARATOR, 0, {0, 0}};
+            range(0x483, 0x489, MARK);
+            // Armenio, hebreo, árabe y el resto: letras tal cual, sin sus signos ni vocales
+            range(0x531, 0x7FF, LETTER);
+            range(0x589, 0x58A, SEPARATOR);
+            range(0x591, 0x5C7, MARK);
+            fold[0x5BE] = fold[0x5C0] = fold[0x5C3] = fold[0x5C6] = {SEPARATOR, 0, {0, 0}};
+            range(0x600, 0x60F, SEPARATOR);
+            range(0x610, 0x61A, MARK);
+            range(0x61B, 0x61F, SEPARATOR);
+            range(0x64B, 0x65F, MARK);
+            range(0x66A, 0x66D, SEPARATOR);
+            fold[0x670] = {MARK, 0, {0, 0}};
+            fold[0x6D4] = {SEPARATOR, 0, {0, 0}};
+            range(0x6D6, 0x6ED, MARK);
+            return fold;
+        }();
+        return table.data();
+    }
+
+    // Caracteres de tres bytes: los signos, símbolos y espacios separan y el resto
+    // (CJK, latín extendido...) queda tal cual
+    static FoldKind kind3(uint32_t cp) {
+        if (cp >= 0x2000 && cp < 0x2C00) return SEPARATOR;
+        if (cp >= 0x3000 && cp < 0x3040) return SEPARATOR;
+        if ((cp >= 0x1AB0 && cp < 0x1B00) || (cp >= 0x1DC0 && cp < 0x1E00)) return MARK;
+        if ((cp >= 0xFE00 && cp < 0xFE10) || (cp >= 0xFE20 && cp < 0xFE30)) return MARK;
+        if ((cp >= 0xFE10 && cp < 0xFE20) || (cp >= 0xFE30 && cp < 0xFE70) || cp == 0xFEFF) return SEPARATOR;
+        if (cp >= 0xFF00 && cp < 0xFF66) return SEPARATOR; // Letras y dígitos ya plegados con fullwidth
+        if (cp >= 0xFFF0) return SEPARATOR;
+        return LETTER;
+    }
+
+    // ASCII de ancho completo (U+FF01 a U+FF5E): misma clasificación que el ASCII común
+    static char fullwidth(uint32_t cp) {
+        if (cp >= 0xFF10 && cp <= 0xFF19) return (char)('0' + cp - 0xFF10);
+        if (cp >= 0xFF21 && cp <= 0xFF3A) return (char)('a' + cp - 0xFF21);
+        if (cp >= 0xFF41 && cp <= 0xFF5A) return (char)('a' + cp - 0xFF41);
+        return 0;
+    }
+
+    // Pliega el carácter no ASCII que empieza en pos y devuelve dónde termina. Los
+    // bytes que no forman UTF-8 válido separan palabras, igual al indexar y al consultar.
+    static size_t foldChar(const char *in, size_t pos, size_t size, Boundaries &boundaries) {
+        char *out = boundaries.at(pos);
+        size_t o = pos - boundaries.shift;
+        unsigned char ch = (unsigned char)in[pos];
+        size_t length = ch >= 0xF0 ? 4 : ch >= 0xE0 ? 3 : 2;
+        uint32_t cp = length == 2 ? ch & 0x1F : length == 3 ? ch & 0x0F : ch & 0x07;
+        bool valid = ch >= 0xC2 && ch <= 0xF4 && pos + length <= size;
+        for (size_t i = 1; valid && i < length; ++i) {
+            unsigned char next = (unsigned char)in[pos + i];
+            valid = (next & 0xC0) == 0x80;
+            cp = (cp << 6) | (next & 0x3F);
+        }
+        valid = valid && (length != 3 || (cp >= 0x800 && (cp < 0xD800 || cp > 0xDFFF))) &&
+                (length != 4 || (cp >= 0x10000 && cp <= 0x10FFFF));
+        if (!valid) {
+            boundaries.separator(o);
+            return pos + 1;
+        }
+        Fold fold = {LETTER, (uint8_t)length, {0, 0}};
+        if (length == 2) {
+            fold = foldTable()[cp];
+        } else if (length == 3 && fullwidth(cp)) {
+            fold = {LETTER, 1, {fullwidth(cp), 0}};
+        } else if (length == 3) {
+            fold.kind = kind3(cp);
+        } else if (cp >= 0x1F000 && cp < 0x1FB00) {
+            fold.kind = SEPARATOR; // Emojis y símbolos
+        }
+        if (fold.kind == SEPARATOR) {
+            boundaries.separator(o);
+            fold.length = 0;
+        } else if (fold.kind == LETTER) {
+            if (length == 2 || fold.length == 1) memcpy(out, fold.bytes, fold.length);
+            else memcpy(out, in + pos, length);
+            boundaries.word(o);
+        } else {
+            fold.length = 0;
+        }
+        boundaries.shift += length - fold.length;
+        return pos + length;
+    }
+
+#ifdef HAVE_SSE2
+    // Bytes en [lo, lo + count): se corre el rango para que empiece en -128 y se
+    // compara con signo, porque SSE2 no tiene comparación sin signo de bytes
+    static __m128i inRange(__m128i bytes, char lo, int count) {
+        __m128i shifted = _mm_add_epi8(bytes, _mm_set1_epi8((char)(0x80 - lo)));
+        return _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(0x80 + count)));
+    }
+
+    static uint64_t classifySSE2(const char *in, char *out, uint64_t &mask) {
+        const __m128i caseBit = _mm_set1_epi8(0x20);
+        uint64_t high = 0;
+        mask = 0;
+        for (int lane = 0; lane < 4; ++lane) {
+            __m128i bytes = _mm_loadu_si128((const __m128i *)(in + 16 * lane));
+            __m128i letter = inRange(_mm_or_si128(bytes, caseBit), 'a', 26);
+            __m128i word = _mm_or_si128(letter, inRange(bytes, '0', 10));
+            _mm_storeu_si128((__m128i *)(out + 16 * lane), _mm_or_si128(bytes, _mm_and_si128(letter, caseBit)));
+            mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(word) << (16 * lane);
+            high |= (uint64_t)(uint32_t)_mm_movemask_epi8(bytes) << (16 * lane);
+        }
+        return high;
+    }
+
+    static void scanSSE2(const char *in, size_t size, Boundaries &boundaries) {
+        size_t base = 0;
+        while (base + 64 <= size) {
+            uint64_t mask;
+            uint64_t high = classifySSE2(in + base, boundaries.at(base), mask);
+            base = advance(in, base, 64, size, mask, high, boundaries);
+        }
+        scanTail(in, base, size, boundaries);
+    }
+#endif
+
+#ifdef HAVE_AVX2
+    TARGET_AVX2 static __m256i inRange(__m256i bytes, char lo, int count) {
+        __m256i shifted = _mm256_add_epi8(bytes, _mm256_set1_epi8((char)(0x80 - lo)));
+        return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + count)), shifted);
+    }
+
+    TARGET_AVX2 static uint64_t classifyAVX2(const char *in, char *out, uint64_t &mask) {
+        const __m256i caseBit = _mm256_set1_epi8(0x20);
+        uint64_t high = 0;
+        mask = 0;
+        for (int lane = 0; lane < 2; ++lane) {
+            __m256i bytes = _mm256_loadu_si256((const __m256i *)(in + 32 * lane));
+            __m256i letter = inRange(_mm256_or_si256(bytes, caseBit), 'a', 26);
+            __m256i word = _mm256_or_si256(letter, inRange(bytes, '0', 10));
+            _mm256_storeu_si256((__m256i *)(out + 32 * lane), _mm256_or_si256(bytes, _mm256_and_si256(letter, caseBit)));
+            mask |= (uint64_t)(uint32_t)_mm256_movemask_epi8(word) << (32 * lane);
+            high |= (uint64_t)(uint32_t)_mm256_movemask_epi8(bytes) << (32 * lane);
+        }
+        return high;
+    }
+
+    TARGET_AVX2 static void scanAVX2(const char *in, size_t size, Boundaries &boundaries) {
+        size_t base = 0;
+        while (base + 64 <= size) {
+            uint64_t mask;
+            uint64_t high = classifyAVX2(in + base, boundaries.at(base), mask);
+            base = advance(in, base, 64, size, mask, high, boundaries);
+        }
+        scanTail(in, base, size, boundaries);
+    }
+
+    static bool cpuHasAVX2() {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        bool osSavesAVX = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+        __cpuidex(info, 7, 0);
+        return osSavesAVX && (info[1] & (1 << 5));
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+
+    static Kernel detectKernel() {
+#ifdef HAVE_AVX2
+        if (cpuHasAVX2()) return AVX2;
+#endif
+#ifdef HAVE_SSE2
+        return SSE2;
+#else
+        return SCALAR;
+#endif
+    }
+};
+
+// Análisis de un campo después de separarlo en palabras: quita las palabras vacías
+// ("the", "and", "de", "que"...) y reduce las demás a su raíz con un stemmer liviano.
+// Se configura por campo y se aplica igual al indexar y al consultar.
+struct FieldAnalysis {
+    enum Language : uint8_t { ENGLISH, SPANISH };
+
+    Language language = ENGLISH;
+    bool stopWords = true; // Quitar las palabras vacías del idioma
+    bool stem = true;
+
+    static FieldAnalysis none() { return {ENGLISH, false, false}; }
+
+    bool operator==(const FieldAnalysis &other) const {
+        return language == other.language && stopWords == other.stopWords && stem == other.stem;
+    }
+    bool operator!=(const FieldAnalysis &other) const { return !(*this == other); }
+};
+
+// Campos de texto de una película que se indexan
+enum class Field : uint8_t { TITLE, SYNOPSIS, TAGS };
+
+// Peso de cada campo en BM25 (al estilo de BM25F): la frecuencia de una palabra en
+// una película es la suma de sus apariciones en cada campo multiplicadas por el
+// peso del campo, y recién esa suma se satura. Así una palabra del título pesa como
+// varias menciones de pasada en la sinopsis.
+struct FieldBoosts {
+    float title = 3.0f;
+    float synopsis = 1.0f;
+    float tags = 2.0f;
+
+    static FieldBoosts uniform() { return {1.0f, 1.0f, 1.0f}; }
+
+    bool operator==(const FieldBoosts &other) const {
+        return title == other.title && synopsis == other.synopsis && tags == other.tags;
+    }
+    bool operator!=(const FieldBoosts &other) const { return !(*this == other); }
+};
+
+// Las palabras llegan plegadas por Tokenizer (minúsculas sin tildes), así que las
+// listas y las reglas de los stemmers solo usan letras ASCII
+class Analyzer {
+public:
+    // Aplica el análisis a las palabras que acaba de separar el tokenizador
+    static const vector<string_view> &analyze(const FieldAnalysis &field, Tokenizer &tokenizer) {
+        return tokenizer.rewrite([&](char *word, size_t length) { return apply(field, word, length); });
+    }
+
+    // Largo de la palabra analizada (0 si es vacía); la raíz se escribe sobre la palabra
+    static size_t apply(const FieldAnalysis &field, char *word, size_t length) {
+        if (field.stopWords && isStopWord(field.language, string_view(word, length))) return 0;
+        if (!field.stem || !isStemmable(word, length)) return length;
+        return field.language == FieldAnalysis::SPANISH ? stemSpanish(word, length) : stemEnglish(word, length);
+    }
+
+    static bool isStopWord(FieldAnalysis::Language language, string_view word) {
+        static const unordered_set<string_view> english = {
+            "a", "about", "after", "again", "against", "all", "am", "an", "and", "any", "are", "as", "at", "be",
+            "because", "been", "before", "being", "between", "both", "but", "by", "can", "could", "did", "do", "does",
+            "doing", "down", "during", "each", "few", "for", "from", "further", "had", "has", "have", "having", "he",
+            "her", "here", "hers", "herself", "him", "himself", "his", "how", "i", "if", "in", "into", "is", "it",
+            "its", "itself", "just", "me", "more", "most", "my", "myself", "no", "nor", "not", "now", "of", "off", "on",
+            "once", "only", "or", "other", "our", "ours", "ourselves", "out", "over", "own", "same", "she", "should",
+            "so", "some", "such", "than", "that", "the", "their", "theirs", "them", "themselves", "then", "there",
+            "these", "they", "this", "those", "through", "to", "too", "under", "until", "up", "very", "was", "we",
+            "were", "what", "when", "where", "which", "while", "who", "whom", "why", "will", "with", "would", "you",
+            "your", "yours", "yourself", "yourselves"};
+        static const unordered_set<string_view> spanish = {
+            "a", "al", "algo", "algunas", "algunos", "ante", "antes", "como", "con", "contra", "cual", "cuando", "de",
+            "del", "desde", "donde", "durante", "e", "el", "ella", "ellas", "ellos", "en", "entre", "era", "erais",
+            "eran", "eras", "eres", "es", "esa", "esas", "ese", "eso", "esos", "esta", "estaba", "estado", "estan",
+            "estar", "estas", "este", "esto", "estos", "estoy", "fue", "fueron", "fui", "ha", "habia", "han", "has",
+            "hasta", "hay", "la", "las", "le", "les", "lo", "los", "mas", "me", "mi", "mis", "mucho", "muchos", "muy",
+            "nada", "ni", "no", "nos", "nosotros", "nuestra", "nuestro", "o", "os", "otra", "otras", "otro", "otros",
+            "para", "pero", "poco", "por", "porque", "que", "quien", "quienes", "se", "sea", "ser", "si", "sido",
+            "sin", "sobre", "son", "su", "sus", "suya", "suyo", "tambien", "tanto", "te", "tiene", "tienen", "todo",
+            "todos", "tu", "tus", "un", "una", "uno", "unos", "usted", "ustedes", "y", "ya", "yo"};
+        return (language == FieldAnalysis::SPANISH ? spanish : english).count(word) > 0;
+    }
+
+private:
+    // Solo se recortan palabras de letras ASCII: números y otros alfabetos quedan igual
+    static bool isStemmable(const char *word, size_t length) {
+        for (size_t i = 0; i < length; ++i) {
+            if ((unsigned char)(word[i] - 'a') >= 26) return false;
+        }
+        return true;
+    }
+
+    static bool endsWith(const char *word, size_t length, string_view suffix) {
+        return length >= suffix.size() && memcmp(word + length - suffix.size(), suffix.data(), suffix.size()) == 0;
+    }
+
+    static bool isVowel(char ch) { return ch == 'a' || ch == 'e' || ch == 'i' || ch == 'o' || ch == 'u'; }
+
+    // Consonante según Porter: la y es consonante al principio o después de una vocal
+    static bool consonant(const char *word, size_t i) {
+        if (isVowel(word[i])) return false;
+        return word[i] != 'y' || i == 0 || !consonant(word, i - 1);
+    }
+
+    // Medida de Porter: cuántas veces una secuencia de vocales va seguida de consonantes
+    static int measure(const char *word, size_t length) {
+        int m = 0;
+        size_t i = 0;
+        while (i < length && consonant(word, i)) ++i;
+        while (i < length) {
+            while (i < length && !consonant(word, i)) ++i;
+            if (i == length) break;
+            while (i < length && consonant(word, i)) ++i;
+            ++m;
+        }
+        return m;
+    }
+
+    static bool hasVowel(const char *word, size_t length) {
+        for (size_t i = 0; i < length; ++i) {
+            if (!consonant(word, i)) return true;
+        }
+        return false;
+    }
+
+    // Termina en consonante-vocal-consonante y la última no es w, x ni y ("hop", no "bow")
+    static bool endsCVC(const char *word, size_t length) {
+        return length >= 3 && consonant(word, length - 1) && !consonant(word, length - 2) &&
+               consonant(word, length - 3) && !strchr("wxy", word[length - 1]);
+    }
+
+    // Paso 1 de Porter: plurales, -ed e -ing y la y final ("ponies" -> "poni",
+    // "hoping" -> "hope", "falling" -> "fall"). Nunca alarga la palabra.
+    static size_t stemEnglish(char *word, size_t length) {
+        if (length <= 2) return length;
+        if (endsWith(word, length, "sses") || endsWith(word, length, "ies")) length -= 2;
+        else if (endsWith(word, length, "s") && !endsWith(word, length, "ss")) length -= 1;
+
+        if (endsWith(word, length, "eed")) {
+            if (measure(word, length - 3) > 0) length -= 1;
+        } else {
+            size_t suffix = endsWith(word, length, "ed") ? 2 : endsWith(word, length, "ing") ? 3 : 0;
+            if (suffix && hasVowel(word, length - suffix)) {
+                length -= suffix;
+                if (endsWith(word, length, "at") || endsWith(word, length, "bl") || endsWith(word, length, "iz")) {
+                    word[length++] = 'e';
+                } else if (length >= 2 && word[length - 1] == word[length - 2] && consonant(word, length - 1) &&
+                           !strchr("lsz", word[length - 1])) {
+                    --length;
+                } else if (measure(word, length) == 1 && endsCVC(word, length)) {
+                    word[length++] = 'e';
+                }
+            }
+        }
+        if (length > 1 && word[length - 1] == 'y' && hasVowel(word, length - 1)) word[length - 1] = 'i';
+        return length;
+    }
+
+    // Stemmer liviano de español: plural y vocal final de género ("canciones" ->
+    // "cancion", "luces" -> "luz", "amigas" y "amigo" -> "amig")
+    static size_t stemSpanish(char *word, size_t length) {
+        if (length <= 3) return length;
+        if (length > 4 && endsWith(word, length, "ces")) {
+            length -= 2;
+            word[length - 1] = 'z';
+        } else if (length > 4 && endsWith(word, length, "es") && !isVowel(word[length - 3])) {
+            length -= 2;
+        } else if (endsWith(word, length, "s") && isVowel(word[length - 2])) {
+            length -= 1;
+        }
+        if (length > 3 && (word[length - 1] == 'a' || word[length - 1] == 'o' || word[length - 1] == 'e')) --length;
+        return length;
+    }
+};
+
+// Autómata de Levenshtein de una palabra: acepta los textos que están a lo más a
+// maxDistance ediciones (insertar, borrar o cambiar un byte). Se simula como NFA con
+// un mapa de bits por cantidad de errores (Wu-Manber): el bit i de bits[d] indica
+// que se llegó a los primeros i bytes de la palabra con d errores o menos. Cuando
+// bits[maxDistance] queda en cero ninguna continuación puede aceptarse, así que un
+// recorrido del Trie puede descartar el subárbol entero.
+class LevenshteinAutomaton {
+public:
+    static constexpr uint32_t MAX_DISTANCE = 2;
+    static constexpr size_t MAX_LENGTH = 63; // Bits 0 a 63 de un uint64_t
+
+    struct State {
+        uint64_t bits[MAX_DISTANCE + 1];
+    };
+
+    LevenshteinAutomaton(string_view word, uint32_t maxDistance)
+        : length(min(word.size(), MAX_LENGTH)), maxDistance(min(maxDistance, MAX_DISTANCE)),
+          valid(length == 63 ? ~0ULL : (2ULL << length) - 1) {
+        for (size_t i = 0; i < length; ++i) charMask[(unsigned char)word[i]] |= 1ULL << (i + 1);
+    }
+
+    // Antes de leer nada: con d errores se pueden haber borrado los primeros d bytes
+    State start() const {
+        State state = {};
+        for (uint32_t d = 0; d <= maxDistance; ++d) state.bits[d] = ((2ULL << d) - 1) & valid;
+        return state;
+    }
+
+    State step(const State &state, unsigned char ch) const {
+        State next = {};
+        uint64_t mask = charMask[ch];
+        next.bits[0] = (state.bits[0] << 1) & mask;
+        for (uint32_t d = 1; d <= maxDistance; ++d) {
+            next.bits[d] = (((state.bits[d] << 1) & mask) // Coincide
+                            | state.bits[d - 1]             // Byte de más en el texto
+                            | (state.bits[d - 1] << 1)      // Byte cambiado
+                            | (next.bits[d - 1] << 1))      // Byte de la palabra que falta
+                           & valid;
+        }
+        return next;
+    }
+
+    bool canMatch(const State &state) const { return state.bits[maxDistance] != 0; }
+
+    // Ediciones del texto leído hasta ahora, UINT32_MAX si son más que maxDistance
+    uint32_t distance(const State &state) const {
+        for (uint32_t d = 0; d <= maxDistance; ++d) {
+            if (state.bits[d] >> length & 1) return d;
+        }
+        return UINT32_MAX;
+    }
+
+private:
+    size_t length;
+    uint32_t maxDistance;
+    uint64_t valid;         // Bits 0 a length
+    uint64_t charMask[256] = {}; // Bit i + 1 si el byte i de la palabra es ese carácter
+};
+
+// Aparición de una palabra en una película: número de película (orden de inserción),
+// cuántas veces aparece la palabra en ella y cuántas de esas son del título y de los
+// tags (el resto son de la sinopsis)
+struct Posting {
+    uint32_t doc;
+    uint32_t freq;
+    uint16_t titleFreq;
+    uint16_t tagFreq;
+};
+
+// Nodo del Trie durante la construcción. El nodo y sus arreglos salen del arena
+// del Trie: nunca se destruyen uno por uno, el arena se libera entero al congelar.
+struct TrieNode {
+    explicit TrieNode(pmr::memory_resource *arena) : children(arena), movies_with_word(arena), positions(arena) {}
+
+    pmr::vector<pair<unsigned char, TrieNode *>> children; // Ordenados por etiqueta
+    pmr::vector<Posting> movies_with_word; // Ordenadas por doc, una entrada por película
+    pmr::vector<uint32_t> positions;       // Posiciones de la palabra en cada película, freq por Posting y en orden
+    bool written = false;                  // La palabra aparece tal cual en algún texto
+    // Formas escritas distintas de la palabra que el análisis lleva a ella ("running"
+    // en "run"), cada una precedida por su largo en 2 bytes; nullptr si no hay
+    pmr::vector<char> *surfaces = nullptr;
+};
+
+static void appendVarint(vector<uint8_t> &out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+static uint32_t readVarint(const uint8_t *&p) {
+    uint32_t value = *p & 0x7F;
+    for (int shift = 7; *p++ & 0x80; shift += 7) {
+        value |= (uint32_t)(*p & 0x7F) << shift;
+    }
+    return value;
+}
+
+// Bloque de una lista de apariciones comprimida. Cada bloque guarda hasta
+// POSTING_BLOCK_SIZE pares (delta de doc, freq) codificados como varint. El último
+// bit de freq indica si siguen las apariciones en el título y en los tags; la
+// mayoría de las palabras solo aparece en la sinopsis y no las necesita.
+const uint32_t POSTING_BLOCK_SIZE = 128;
+
+struct PostingBlock {
+    uint32_t last_doc; // Último doc del bloque, permite saltar bloques sin decodificarlos
+    uint32_t offset;   // Posición del bloque en PostingStore::bytes
+    float max_score;   // Cota superior del puntaje (sin idf) de las películas del bloque
+};
+
+struct TermInfo {
+    uint32_t first_block;
+    uint32_t doc_freq; // Cantidad de películas que contienen la palabra
+    float max_score;   // Cota superior del puntaje (sin idf) en toda la lista
+};
+
+// Listas de apariciones comprimidas, tal como las leen las búsquedas. Las posiciones
+// de cada aparición van aparte (delta + varint, reiniciando en cada película) para
+// que las consultas que no las usan no las recorran.
+struct PostingLists {
+    ArrayView<uint8_t> bytes;
+    ArrayView<PostingBlock> blocks;
+    ArrayView<TermInfo> terms;
+    ArrayView<uint8_t> positions;
+    ArrayView<uint32_t> positionOffsets; // Inicio de las posiciones de cada bloque en positions
+
+    size_t positionBytes() const { return positions.size() + positionOffsets.size() * sizeof(uint32_t); }
+
+    size_t memoryBytes() const {
+        return bytes.size() + blocks.size() * sizeof(PostingBlock) + terms.size() * sizeof(TermInfo);
+    }
+};
+
+// Construcción de las listas de apariciones de todas las palabras, comprimidas con delta + varint
+struct PostingStore {
+    vector<uint8_t> bytes;
+    vector<PostingBlock> blocks;
+    vector<TermInfo> terms;
+    vector<uint8_t> positions;
+    vector<uint32_t> positionOffsets;
+
+    // score(posting) da el puntaje de cada aparición para calcular las cotas.
+    // wordPositions tiene las posiciones de todas las apariciones, en el orden de postings.
+    template <typename ScoreFn>
+    uint32_t add(ArrayView<Posting> postings, ArrayView<uint32_t> wordPositions, ScoreFn &&score) {
+        uint32_t term = (uint32_t)terms.size();
+        terms.push_back({(uint32_t)blocks.size(), (uint32_t)postings.size(), 0.0f});
+        uint32_t previous = 0;
+        size_t nextPosition = 0;
+        for (size_t i = 0; i < postings.size(); ++i) {
+            if (i % POSTING_BLOCK_SIZE == 0) {
+                blocks.push_back({0, (uint32_t)bytes.size(), 0.0f});
+                positionOffsets.push_back((uint32_t)positions.size());
+            }
+            appendVarint(bytes, postings[i].doc - previous);
+            bool byField = postings[i].titleFreq || postings[i].tagFreq;
+            appendVarint(bytes, postings[i].freq << 1 | byField);
+            if (byField) {
+                appendVarint(bytes, postings[i].titleFreq);
+                appendVarint(bytes, postings[i].tagFreq);
+            }
+            uint32_t previousPosition = 0;
+            for (uint32_t f = 0; f < postings[i].freq; ++f, ++nextPosition) {
+                appendVarint(positions, wordPositions[nextPosition] - previousPosition);
+                previousPosition = wordPositions[nextPosition];
+            }
+            previous = postings[i].doc;
+            // Redondeo hacia arriba para que la cota en float nunca quede por debajo del puntaje real
+            float bound = nextafterf((float)score(postings[i]), INFINITY);
+            blocks.back().last_doc = previous;
+            blocks.back().max_score = max(blocks.back().max_score, bound);
+            terms.back().max_score = max(terms.back().max_score, bound);
+        }
+        return term;
+    }
+
+    // Agrega las listas de other a continuación de las propias: sus palabras siguen
+    // a las de este y sus bloques apuntan a los bytes ya corridos
+    void append(const PostingStore &other) {
+        uint32_t byteBase = (uint32_t)bytes.size(), blockBase = (uint32_t)blocks.size();
+        uint32_t positionBase = (uint32_t)positions.size();
+        bytes.insert(bytes.end(), other.bytes.begin(), other.bytes.end());
+        positions.insert(positions.end(), other.positions.begin(), other.positions.end());
+        for (PostingBlock block : other.blocks) {
+            block.offset += byteBase;
+            blocks.push_back(block);
+        }
+        for (TermInfo term : other.terms) {
+            term.first_block += blockBase;
+            terms.push_back(term);
+        }
+        for (uint32_t offset : other.positionOffsets) positionOffsets.push_back(offset + positionBase);
+    }
+
+    PostingLists view() const {
+        return {bytes, blocks, terms, positions, positionOffsets};
+    }
+};
+
+// Recorre la lista de apariciones de una palabra decodificando un bloque a la vez
+class PostingCursor {
+public:
+    static const uint32_t END = UINT32_MAX;
+
+    PostingCursor() = default;
+
+    PostingCursor(const PostingLists *store, uint32_t term) : store(store), term(term) {
+        const TermInfo &info = store->terms[term];
+        firstBlock = info.first_block;
+        docFreq = info.doc_freq;
+        numBlocks = (docFreq + POSTING_BLOCK_SIZE - 1) / POSTING_BLOCK_SIZE;
+        loadBlock(0);
+    }
+
+    uint32_t doc() const { return current < count ? docs[current] : END; }
+    uint32_t freq() const { return freqs[current]; }
+
+    // Apariciones en la película actual dentro de un campo
+    uint32_t freq(Field field) const {
+        switch (field) {
+        case Field::TITLE: return titleFreqs[current];
+        case Field::TAGS: return tagFreqs[current];
+        default: return freqs[current] - titleFreqs[current] - tagFreqs[current];
+        }
+    }
+    uint32_t size() const { return docFreq; }
+    uint32_t blocksDecoded() const { return decoded; }
+    float maxScore() const { return store->terms[term].max_score; }
+
+    // Cota del bloque que contendría target, sin decodificarlo. lastDoc recibe
+    // el último doc de ese bloque (END si target está después de toda la lista).
+    float blockMaxScore(uint32_t target, uint32_t &lastDoc) const {
+        uint32_t b = block;
+        while (b < numBlocks && store->blocks[firstBlock + b].last_doc < target) ++b;
+        if (b == numBlocks) {
+            lastDoc = END;
+            return 0.0f;
+        }
+        lastDoc = store->blocks[firstBlock + b].last_doc;
+        return store->blocks[firstBlock + b].max_score;
+    }
+
+    void next() {
+        if (++current == count && block + 1 < numBlocks) {
+            loadBlock(block + 1);
+        }
+    }
+
+    // Avanza hasta el primer doc >= target. Busca con saltos exponenciales (galloping):
+    // primero entre las cabeceras de bloque y luego dentro del bloque, así avanzar
+    // una distancia d cuesta O(log d) y no O(d).
+    void advance(uint32_t target) {
+        if (doc() >= target) return;
+        if (docs[count - 1] < target) {
+            const PostingBlock *headers = store->blocks.data() + firstBlock;
+            uint32_t lo = block + 1, hi = lo, step = 1;
+            while (hi < numBlocks && headers[hi].last_doc < target) {
+                lo = hi + 1;
+                hi += step;
+                step *= 2;
+            }
+            hi = min(hi, numBlocks);
+            uint32_t b = (uint32_t)(partition_point(headers + lo, headers + hi, [&](const PostingBlock &header) {
+                                        return header.last_doc < target;
+                                    }) - headers);
+            if (b == numBlocks) {
+                current = count;
+                return;
+            }
+            loadBlock(b);
+            if (docs[0] >= target) return;
+        }
+        uint32_t bound = 1;
+        while (current + bound < count && docs[current + bound] < target) bound *= 2;
+        current = (uint32_t)(lower_bound(docs + current + bound / 2, docs + min(current + bound + 1, count), target) - docs);
+    }
+
+    // Posiciones de la palabra en la película actual, en orden
+    void positions(vector<uint32_t> &out) {
+        if (positionIndex > current) {
+            positionPtr = store->positions.data() + store->positionOffsets[firstBlock + block];
+            positionIndex = 0;
+        }
+        // Se saltan las posiciones de las películas anteriores del bloque
+        for (; positionIndex < current; ++positionIndex) {
+            for (uint32_t f = 0; f < freqs[positionIndex]; ++f) {
+                while (*positionPtr++ & 0x80) {}
+            }
+        }
+        out.clear();
+        const uint8_t *p = positionPtr;
+        uint32_t position = 0;
+        for (uint32_t f = 0; f < freqs[current]; ++f) {
+            position += readVarint(p);
+            out.push_back(position);
+        }
+    }
+
+private:
+    const PostingLists *store = nullptr;
+    uint32_t term = 0;
+    uint32_t firstBlock = 0, numBlocks = 0, docFreq = 0;
+    uint32_t block = 0, count = 0, current = 0;
+    uint32_t decoded = 0; // Bloques decodificados hasta ahora
+    uint32_t docs[POSTING_BLOCK_SIZE];
+    uint32_t freqs[POSTING_BLOCK_SIZE];
+    uint16_t titleFreqs[POSTING_BLOCK_SIZE];
+    uint16_t tagFreqs[POSTING_BLOCK_SIZE];
+    const uint8_t *positionPtr = nullptr; // Posiciones de la película positionIndex del bloque
+    uint32_t positionIndex = 0;
+
+    void loadBlock(uint32_t b) {
+        block = b;
+        current = 0;
+        positionIndex = POSTING_BLOCK_SIZE; // Se ubican al pedirlas
+        ++decoded;
+        count = min(POSTING_BLOCK_SIZE, docFreq - b * POSTING_BLOCK_SIZE);
+        uint32_t previous = b == 0 ? 0 : store->blocks[firstBlock + b - 1].last_doc;
+        const uint8_t *p = store->bytes.data() + store->blocks[firstBlock + b].offset;
+        for (uint32_t i = 0; i < count; ++i) {
+            previous += readVarint(p);
+            docs[i] = previous;
+            uint32_t freq = readVarint(p);
+            freqs[i] = freq >> 1;
+            titleFreqs[i] = tagFreqs[i] = 0;
+            if (freq & 1) {
+                titleFreqs[i] = (uint16_t)readVarint(p);
+                tagFreqs[i] = (uint16_t)readVarint(p);
+            }
+        }
+    }
+};
+
+// Resultado de una búsqueda. El puntaje vive en el resultado y no en Movie,
+// así varias consultas pueden correr a la vez sobre el mismo Trie. La película
+// es solo su número en el catálogo: copiar resultados no toca contadores atómicos.
+struct SearchResult {
+    uint32_t doc;
+    double score;
+};
+
+// Orden de los resultados: mayor puntaje primero y, a igual puntaje, menor doc
+static bool betterResult(const SearchResult &a, const SearchResult &b) {
+    return a.score > b.score || (a.score == b.score && a.doc < b.doc);
+}
+
+// Todas las coincidencias de una consulta, ordenadas solo hasta donde se han pedido.
+// Cada página selecciona sus resultados con nth_element sobre lo que falta y
+// ordena únicamente esa ventana, así avanzar de página no reordena todo.
+class SearchResults {
+public:
+    SearchResults() = default;
+    explicit SearchResults(vector<SearchResult> results) : results(move(results)) {}
+
+    size_t size() const { return results.size(); }
+    bool empty() const { return results.empty(); }
+
+    // Resultado en la posición i del ranking
+    const SearchResult &at(size_t i) {
+        ensureSorted(i + 1);
+        return results[i];
+    }
+
+    // Página n (desde 0) de pageSize resultados
+    vector<SearchResult> page(size_t n, size_t pageSize) {
+        size_t begin = min(n * pageSize, results.size());
+        size_t end = min(begin + pageSize, results.size());
+        ensureSorted(end);
+        return vector<SearchResult>(results.begin() + begin, results.begin() + end);
+    }
+
+    vector<SearchResult> top(size_t k) { return page(0, k); }
+
+    // Todos los resultados, en cualquier orden
+    const vector<SearchResult> &unsorted() const { return results; }
+
+private:
+    vector<SearchResult> results;
+    size_t sorted = 0; // results[0, sorted) ya está en orden final
+
+    void ensureSorted(size_t count) {
+        if (count <= sorted) return;
+        // Se selecciona al menos el doble de lo ya ordenado para que las páginas
+        // siguientes salgan del prefijo ordenado sin volver a recorrer todo
+        count = min(max(count, 2 * sorted), results.size());
+        if (count < results.size()) {
+            nth_element(results.begin() + sorted, results.begin() + count, results.end(), betterResult);
+        }
+        sort(results.begin() + sorted, results.begin() + count, betterResult);
+        sorted = count;
+    }
+};
+
+// Llama a fn(i) para cada i de [0, count) desde numThreads hilos (el actual incluido),
+// que toman tramos de chunk índices a medida que terminan los anteriores
+template <typename F>
+void parallelFor(size_t count, unsigned numThreads, F &&fn, size_t chunk = 1) {
+    atomic<size_t> next(0);
+    auto work = [&]() {
+        for (size_t begin; (begin = next.fetch_add(chunk)) < count;) {
+            for (size_t i = begin; i < min(begin + chunk, count); ++i) fn(i);
+        }
+    };
+    vector<thread> workers;
+    for (unsigned t = 1; t < numThreads; ++t) workers.emplace_back(work);
+    work();
+    for (auto &worker : workers) worker.join();
+}
+
+// Puntajes acumulados de una consulta en un arreglo denso por doc. Cada hilo
+// reutiliza el suyo y al terminar solo limpia las posiciones que tocó, así una
+// consulta cuesta lo que sus coincidencias y no lo que el catálogo.
+class ScoreAccumulator {
+public:
+    static ScoreAccumulator &local(size_t numDocs) {
+        thread_local ScoreAccumulator accumulator;
+        if (accumulator.scores.size() < numDocs) {
+            accumulator.scores.resize(numDocs, 0.0);
+        }
+        accumulator.clear();
+        return accumulator;
+    }
+
+    void add(uint32_t doc, double score) {
+        if (scores[doc] == 0) {
+            touched.push_back(doc);
+        }
+        scores[doc] += score;
+    }
+
+    const vector<uint32_t> &docs() const { return touched; }
+    double score(uint32_t doc) const { return scores[doc]; }
+
+    void clear() {
+        for (uint32_t doc : touched) {
+            scores[doc] = 0;
+        }
+        touched.clear();
+    }
+
+private:
+    vector<double> scores;
+    vector<uint32_t> touched; // Películas con puntaje distinto de cero
+};
+
+// Nodo del Trie congelado. Los hijos de un nodo ocupan posiciones contiguas
+// [first_child, first_child + num_children) del arreglo de nodos, ordenados por etiqueta.
+struct FlatTrieNode {
+    uint32_t first_child = 0;
+    uint32_t num_children = 0;
+    uint32_t term = UINT32_MAX; // Índice de la lista de películas, UINT32_MAX si ninguna palabra termina aquí
+};
+
+// Conjunto de números de película al estilo Roaring: los valores se agrupan por
+// sus 16 bits altos y cada grupo (contenedor) guarda los 16 bits bajos como arreglo
+// ordenado si tiene pocos elementos o como mapa de 65536 bits si tiene muchos.
+// Las operaciones entre mapas de bits procesan 128 bits por instrucción (SSE2).
+class RoaringBitmap {
+public:
+    RoaringBitmap() = default;
+
+    // Películas 0 .. n-1
+    static RoaringBitmap range(uint32_t n) {
+        RoaringBitmap result;
+        for (uint32_t key = 0; (uint64_t)key << 16 < n; ++key) {
+            Container container;
+            container.key = (uint16_t)key;
+            uint32_t count = min<uint32_t>(n - (key << 16), 1u << 16);
+            container.bits.assign(BITMAP_WORDS, 0);
+            for (uint32_t w = 0; w < count / 64; ++w) container.bits[w] = ~0ULL;
+            if (count % 64) container.bits[count / 64] = (1ULL << (count % 64)) - 1;
+            container.cardinality = count;
+            normalize(container);
+            result.containers.push_back(move(container));
+        }
+        return result;
+    }
+
+    void add(uint32_t x) {
+        Container &container = containerFor(x >> 16);
+        uint16_t low = (uint16_t)x;
+        if (container.isBitmap()) {
+            uint64_t &word = container.bits[low >> 6];
+            if (!(word >> (low & 63) & 1)) {
+                word |= 1ULL << (low & 63);
+                ++container.cardinality;
+            }
+            return;
+        }
+        auto it = lower_bound(container.array.begin(), container.array.end(), low);
+        if (it != container.array.end() && *it == low) return;
+        container.array.insert(it, low);
+        ++container.cardinality;
+        normalize(container);
+    }
+
+    void remove(uint32_t x) {
+        auto it = findContainer(x >> 16);
+        if (it == containers.end()) return;
+        uint16_t low = (uint16_t)x;
+        if (it->isBitmap()) {
+            uint64_t &word = it->bits[low >> 6];
+            if (word >> (low & 63) & 1) {
+                word &= ~(1ULL << (low & 63));
+                --it->cardinality;
+            }
+        } else {
+            auto pos = lower_bound(it->array.begin(), it->array.end(), low);
+            if (pos == it->array.end() || *pos != low) return;
+            it->array.erase(pos);
+            --it->cardinality;
+        }
+        normalize(*it);
+        if (it->cardinality == 0) containers.erase(it);
+    }
+
+    bool contains(uint32_t x) const {
+        auto it = findContainer(x >> 16);
+        if (it == containers.end()) return false;
+        uint16_t low = (uint16_t)x;
+        if (it->isBitmap()) return it->bits[low >> 6] >> (low & 63) & 1;
+        return binary_search(it->array.begin(), it->array.end(), low);
+    }
+
+    // Menor valor >= x, UINT32_MAX si no hay
+    uint32_t nextValue(uint32_t x) const {
+        auto it = lower_bound(containers.begin(), containers.end(), x >> 16,
+                              [](const Container &c, uint32_t key) { return c.key < key; });
+        for (; it != containers.end(); ++it) {
+            uint32_t from = it->key == x >> 16 ? (x & 0xFFFF) : 0;
+            uint32_t high = (uint32_t)it->key << 16;
+            if (it->isBitmap()) {
+                size_t w = from >> 6;
+                uint64_t word = it->bits[w] & (~0ULL << (from & 63));
+                while (true) {
+                    if (word) return high | (uint32_t)(w * 64 + countTrailingZeros(word));
+                    if (++w == BITMAP_WORDS) break;
+                    word = it->bits[w];
+                }
+            } else {
+                auto pos = lower_bound(it->array.begin(), it->array.end(), (uint16_t)from);
+                if (pos != it->array.end()) return high | *pos;
+            }
+        }
+        return UINT32_MAX;
+    }
+
+    size_t cardinality() const {
+        size_t total = 0;
+        for (const Container &container : containers) total += container.cardinality;
+        return total;
+    }
+
+    bool empty() const { return containers.empty(); }
+
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (const Container &container : containers) {
+            uint32_t high = (uint32_t)container.key << 16;
+            if (container.isBitmap()) {
+                for (size_t w = 0; w < BITMAP_WORDS; ++w) {
+                    for (uint64_t word = container.bits[w]; word; word &= word - 1) {
+                        fn(high | (uint32_t)(w * 64 + countTrailingZeros(word)));
+                    }
+                }
+            } else {
+                for (uint16_t low : container.array) fn(high | low);
+            }
+        }
+    }
+
+    vector<uint32_t> toVector() const {
+        vector<uint32_t> result;
+        result.reserve(cardinality());
+        forEach([&](uint32_t x) { result.push_back(x); });
+        return result;
+    }
+
+    size_t memoryBytes() const {
+        size_t bytes = containers.capacity() * sizeof(Container);
+        for (const Container &container : containers) {
+            bytes += container.array.capacity() * sizeof(uint16_t) + container.bits.capacity() * sizeof(uint64_t);
+        }
+        return bytes;
+    }
+
+    RoaringBitmap operator&(const RoaringBitmap &other) const { return combine(other, AND); }
+    RoaringBitmap operator|(const RoaringBitmap &other) const { return combine(other, OR); }
+    RoaringBitmap operator-(const RoaringBitmap &other) const { return combine(other, AND_NOT); }
+
+private:
+    static constexpr size_t BITMAP_WORDS = 1024; // 65536 bits
+    static constexpr uint32_t ARRAY_MAX = 4096; // Con más elementos el mapa de bits ocupa menos
+
+    struct Container {
+        uint16_t key = 0;
+        uint32_t cardinality = 0;
+        vector<uint16_t> array; // Ordenado; vacío si es mapa de bits
+        vector<uint64_t> bits;  // BITMAP_WORDS palabras; vacío si es arreglo
+
+        bool isBitmap() const { return !bits.empty(); }
+    };
+    vector<Container> containers; // Ordenados por key
+
+    enum Operation { AND, OR, AND_NOT };
+
+    vector<Container>::const_iterator findContainer(uint32_t key) const {
+        auto it = lower_bound(containers.begin(), containers.end(), key,
+                              [](const Container &c, uint32_t k) { return c.key < k; });
+        return it != containers.end() && it->key == key ? it : containers.end();
+    }
+
+    vector<Container>::iterator findContainer(uint32_t key) {
+        auto it = lower_bound(containers.begin(), containers.end(), key,
+                              [](const Container &c, uint32_t k) { return c.key < k; });
+        return it != containers.end() && it->key == key ? it : containers.end();
+    }
+
+    Container &containerFor(uint32_t key) {
+        auto it = lower_bound(containers.begin(), containers.end(), key,
+                              [](const Container &c, uint32_t k) { return c.key < k; });
+        if (it == containers.end() || it->key != key) {
+            it = containers.insert(it, Container());
+            it->key = (uint16_t)key;
+        }
+        return *it;
+    }
+
+    // Elige la representación más compacta según la cardinalidad
+    static void normalize(Container &container) {
+        if (container.isBitmap() && container.cardinality <= ARRAY_MAX) {
+            vector<uint16_t> array;
+            array.reserve(container.cardinality);
+            for (size_t w = 0; w < BITMAP_WORDS; ++w) {
+                for (uint64_t word = container.bits[w]; word; word &= word - 1) {
+                    array.push_back((uint16_t)(w * 64 + countTrailingZeros(word)));
+                }
+            }
+            container.array.swap(array);
+            vector<uint64_t>().swap(container.bits);
+        } else if (!container.isBitmap() && container.cardinality > ARRAY_MAX) {
+            container.bits.assign(BITMAP_WORDS, 0);
+            for (uint16_t low : container.array) container.bits[low >> 6] |= 1ULL << (low & 63);
+            vector<uint16_t>().swap(container.array);
+        }
+    }
+
+    static vector<uint64_t> toBits(const Container &container) {
+        if (container.isBitmap()) return container.bits;
+        vector<uint64_t> bits(BITMAP_WORDS, 0);
+        for (uint16_t low : container.array) bits[low >> 6] |= 1ULL << (low & 63);
+        return bits;
+    }
+
+    // Operación palabra a palabra entre dos mapas de bits; devuelve la cardinalidad
+    static uint32_t combineBits(const uint64_t *a, const uint64_t *b, uint64_t *out, Operation op) {
+        size_t w = 0;
+#ifdef HAVE_SSE2
+        for (; w + 2 <= BITMAP_WORDS; w += 2) {
+            __m128i x = _mm_loadu_si128((const __m128i *)(a + w));
+            __m128i y = _mm_loadu_si128((const __m128i *)(b + w));
+            __m128i r = op == AND ? _mm_and_si128(x, y) : op == OR ? _mm_or_si128(x, y) : _mm_andnot_si128(y, x);
+            _mm_storeu_si128((__m128i *)(out + w), r);
+        }
+#endif
+        for (; w < BITMAP_WORDS; ++w) {
+            out[w] = op == AND ? a[w] & b[w] : op == OR ? a[w] | b[w] : a[w] & ~b[w];
+        }
+        uint32_t cardinality = 0;
+        for (w = 0; w < BITMAP_WORDS; ++w) cardinality += popcount(out[w]);
+        return cardinality;
+    }
+
+    static Container combineContainers(const Container &a, const Container &b, Operation op) {
+        Container result;
+        result.key = a.key;
+        if (!a.isBitmap() && !b.isBitmap()) {
+            // Dos arreglos ordenados: mezcla
+            if (op == AND) {
+                set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), back_inserter(result.array));
+            } else if (op == OR) {
+                set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), back_inserter(result.array));
+            } else {
+                set_difference(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), back_inserter(result.array));
+            }
+            result.cardinality = (uint32_t)result.array.size();
+        } else if (op != OR && !a.isBitmap()) {
+            // Arreglo contra mapa de bits: basta consultar cada elemento del arreglo
+            for (uint16_t low : a.array) {
+                bool inB = b.bits[low >> 6] >> (low & 63) & 1;
+                if (inB == (op == AND)) result.array.push_back(low);
+            }
+            result.cardinality = (uint32_t)result.array.size();
+        } else if (op == AND && !b.isBitmap()) {
+            return combineContainers(b, a, op);
+        } else {
+            vector<uint64_t> bitsA = toBits(a), bitsB = toBits(b);
+            result.bits.resize(BITMAP_WORDS);
+            result.cardinality = combineBits(bitsA.data(), bitsB.data(), result.bits.data(), op);
+        }
+        normalize(result);
+        return result;
+    }
+
+    RoaringBitmap combine(const RoaringBitmap &other, Operation op) const {
+        RoaringBitmap result;
+        size_t i = 0, j = 0;
+        while (i < containers.size() || j < other.containers.size()) {
+            bool hasA = i < containers.size(), hasB = j < other.containers.size();
+            if (hasA && (!hasB || containers[i].key < other.containers[j].key)) {
+                if (op != AND) result.containers.push_back(containers[i]);
+                ++i;
+            } else if (hasB && (!hasA || other.containers[j].key < containers[i].key)) {
+                if (op == OR) result.containers.push_back(other.containers[j]);
+                ++j;
+            } else {
+                Container container = combineContainers(containers[i], other.containers[j], op);
+                if (container.cardinality > 0) result.containers.push_back(move(container));
+                ++i;
+                ++j;
+            }
+        }
+        return result;
+    }
+};
+
+// Filtro de tags: todas las condiciones de `all` deben cumplirse (cada una es una
+// lista de alternativas, basta una) y ninguna película puede tener tags de `none`.
+// Se escribe como "cult, horror|gothic, -comedy".
+struct TagFilter {
+    vector<vector<string>> all;
+    vector<string> none;
+
+    bool empty() const { return all.empty() && none.empty(); }
+
+    static TagFilter parse(const string &text);
+};
+
+// Índice invertido de tags: para cada tag normalizado (minúsculas, sin espacios
+// alrededor) la lista ordenada de películas que lo tienen. Mientras se construye
+// vive en un mapa; freeze() lo pasa a arreglos contiguos ordenados por nombre.
+class TagIndex {
+public:
+    // Tags de una película: el campo tags separado por comas
+    static vector<string> splitTags(string_view tags) {
+        vector<string> result;
+        size_t begin = 0;
+        while (begin <= tags.size()) {
+            size_t end = tags.find(',', begin);
+            if (end == string_view::npos) end = tags.size();
+            string tag = normalize(tags.substr(begin, end - begin));
+            if (!tag.empty()) result.push_back(tag);
+            begin = end + 1;
+        }
+        return result;
+    }
+
+    static string normalize(string_view tag) {
+        size_t begin = tag.find_first_not_of(" \t\r\n\"");
+        if (begin == string_view::npos) return "";
+        size_t end = tag.find_last_not_of(" \t\r\n\"");
+        string result(tag.substr(begin, end - begin + 1));
+        for (char &ch : result) ch = (char)tolower((unsigned char)ch);
+        return result;
+    }
+
+    void add(uint32_t doc, string_view tags) {
+        for (const string &tag : splitTags(tags)) {
+            vector<uint32_t> &docs = building[tag];
+            if (docs.empty() || docs.back() != doc) docs.push_back(doc);
+        }
+    }
+
+    void freeze() {
+        for (const auto &entry : building) {
+            nameOffsetStorage.push_back((uint32_t)nameStorage.size());
+            nameStorage += entry.first;
+            docOffsetStorage.push_back((uint32_t)docStorage.size());
+            docStorage.insert(docStorage.end(), entry.second.begin(), entry.second.end());
+        }
+        nameOffsetStorage.push_back((uint32_t)nameStorage.size());
+        docOffsetStorage.push_back((uint32_t)docStorage.size());
+        building.clear();
+        attach(ArrayView<char>(nameStorage.data(), nameStorage.size()), nameOffsetStorage, docOffsetStorage, docStorage);
+    }
+
+    // Usa arreglos ya construidos (por ejemplo, las secciones de un snapshot)
+    bool attach(ArrayView<char> nameText, ArrayView<uint32_t> nameStarts, ArrayView<uint32_t> docStarts,
+                ArrayView<uint32_t> docList) {
+        if (nameStarts.empty() || nameStarts.size() != docStarts.size() ||
+            nameStarts[nameStarts.size() - 1] != nameText.size() || docStarts[docStarts.size() - 1] != docList.size()) {
+            return false;
+        }
+        names = nameText;
+        nameOffsets = nameStarts;
+        docOffsets = docStarts;
+        docs = docList;
+        frozen = true;
+        return true;
+    }
+
+    size_t size() const { return frozen ? nameOffsets.size() - 1 : building.size(); }
+
+    string name(size_t i) const {
+        return string(names.data() + nameOffsets[i], nameOffsets[i + 1] - nameOffsets[i]);
+    }
+
+    // Películas con el tag, ordenadas; vacío si el tag no existe
+    ArrayView<uint32_t> find(const string &tag) const {
+        string key = normalize(tag);
+        if (!frozen) {
+            auto it = building.find(key);
+            return it == building.end() ? ArrayView<uint32_t>() : ArrayView<uint32_t>(it->second);
+        }
+        size_t lo = 0, hi = size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            int cmp = key.compare(0, string::npos, names.data() + nameOffsets[mid], nameOffsets[mid + 1] - nameOffsets[mid]);
+            if (cmp == 0) {
+                return ArrayView<uint32_t>(docs.data() + docOffsets[mid], docOffsets[mid + 1] - docOffsets[mid]);
+            }
+            if (cmp < 0) hi = mid;
+            else lo = mid + 1;
+        }
+        return {};
+    }
+
+    // Películas (de 0 a numDocs) que cumplen el filtro, ordenadas
+    vector<uint32_t> filter(const TagFilter &tagFilter, size_t numDocs) const {
+        vector<uint32_t> result, scratch;
+        bool universe = true; // result representa todavía a todas las películas
+        for (const auto &alternatives : tagFilter.all) {
+            // OR de las alternativas
+            vector<uint32_t> any;
+            for (const string &tag : alternatives) {
+                ArrayView<uint32_t> list = find(tag);
+                scratch.clear();
+                set_union(any.begin(), any.end(), list.begin(), list.end(), back_inserter(scratch));
+                any.swap(scratch);
+            }
+            // AND con lo acumulado
+            if (universe) {
+                result.swap(any);
+                universe = false;
+            } else {
+                scratch.clear();
+                set_intersection(result.begin(), result.end(), any.begin(), any.end(), back_inserter(scratch));
+                result.swap(scratch);
+            }
+            if (result.empty()) return result;
+        }
+        if (universe) {
+            result.resize(numDocs);
+            for (size_t doc = 0; doc < numDocs; ++doc) result[doc] = (uint32_t)doc;
+        }
+        for (const string &tag : tagFilter.none) {
+            ArrayView<uint32_t> list = find(tag);
+            scratch.clear();
+            set_difference(result.begin(), result.end(), list.begin(), list.end(), back_inserter(scratch));
+            result.swap(scratch);
+        }
+        return result;
+    }
+
+    ArrayView<char> names;
+    ArrayView<uint32_t> nameOffsets; // Inicio de cada nombre en names (uno más al final)
+    ArrayView<uint32_t> docOffsets;  // Inicio de la lista de cada tag en docs (uno más al final)
+    ArrayView<uint32_t> docs;
+
+private:
+    map<string, vector<uint32_t>> building;
+    bool frozen = false;
+    string nameStorage;
+    vector<uint32_t> nameOffsetStorage, docOffsetStorage, docStorage;
+};
+
+TagFilter TagFilter::parse(const string &text) {
+    TagFilter result;
+    size_t begin = 0;
+    while (begin <= text.size()) {
+        size_t end = text.find(',', begin);
+        if (end == string::npos) end = text.size();
+        string clause = text.substr(begin, end - begin);
+        begin = end + 1;
+
+        size_t first = clause.find_first_not_of(" \t");
+        if (first == string::npos) continue;
+        if (clause[first] == '-') {
+            string tag = TagIndex::normalize(clause.substr(first + 1));
+            if (!tag.empty()) result.none.push_back(tag);
+            continue;
+        }
+        vector<string> alternatives;
+        size_t altBegin = 0;
+        while (altBegin <= clause.size()) {
+            size_t altEnd = clause.find('|', altBegin);
+            if (altEnd == string::npos) altEnd = clause.size();
+            string tag = TagIndex::normalize(clause.substr(altBegin, altEnd - altBegin));
+            if (!tag.empty()) alternatives.push_back(tag);
+            altBegin = altEnd + 1;
+        }
+        if (!alternatives.empty()) result.all.push_back(alternatives);
+    }
+    return result;
+}
+
+// Filtro sobre atributos de las películas. Cada condición es un atributo ("tag",
+// "split", "source" o una marca como "liked") con valores alternativos (basta uno)
+// y puede estar negada; todas las condiciones deben cumplirse.
+// Se escribe como "tag=crime|heist, split=train, not liked"; las partes que no son
+// condiciones forman el texto de la búsqueda.
+struct MovieFilter {
+    struct Condition {
+        string attribute;
+        vector<string> values; // Vacío para las marcas
+        bool negated = false;
+    };
+    vector<Condition> conditions;
+
+    bool empty() const { return conditions.empty(); }
+
+    static bool isFlag(const string &name) { return name == "liked" || name == "watch_later"; }
+
+    static MovieFilter fromTags(const TagFilter &tagFilter) {
+        MovieFilter result;
+        for (const auto &alternatives : tagFilter.all) {
+            result.conditions.push_back({"tag", alternatives, false});
+        }
+        for (const string &tag : tagFilter.none) {
+            result.conditions.push_back({"tag", {tag}, true});
+        }
+        return result;
+    }
+
+    // Separa una consulta en texto y filtro. Una parte negada que no es condición
+    // se toma como tag, igual que en TagFilter ("-comedy").
+    static MovieFilter parse(const string &query, string &text) {
+        MovieFilter result;
+        text.clear();
+        size_t begin = 0;
+        while (begin <= query.size()) {
+            size_t end = query.find(',', begin);
+            if (end == string::npos) end = query.size();
+            string raw = query.substr(begin, end - begin);
+            string clause = TagIndex::normalize(raw);
+            begin = end + 1;
+            if (clause.empty()) continue;
+
+            Condition condition;
+            if (clause[0] == '-' || clause.compare(0, 4, "not ") == 0) {
+                condition.negated = true;
+                clause = TagIndex::normalize(clause.substr(clause[0] == '-' ? 1 : 4));
+            }
+            size_t equals = clause.find('=');
+            if (equals != string::npos) {
+                condition.attribute = attributeName(TagIndex::normalize(clause.substr(0, equals)));
+                string values = clause.substr(equals + 1);
+                size_t valueBegin = 0;
+                while (valueBegin <= values.size()) {
+                    size_t valueEnd = values.find('|', valueBegin);
+                    if (valueEnd == string::npos) valueEnd = values.size();
+                    string value = TagIndex::normalize(values.substr(valueBegin, valueEnd - valueBegin));
+                    if (!value.empty()) condition.values.push_back(value);
+                    valueBegin = valueEnd + 1;
+                }
+            } else if (isFlag(attributeName(clause))) {
+                condition.attribute = attributeName(clause);
+            } else if (condition.negated) {
+                condition.attribute = "tag";
+                condition.values.push_back(clause);
+            } else {
+                // El texto conserva sus comillas para las búsquedas de frases
+                size_t first = raw.find_first_not_of(" \t"), last = raw.find_last_not_of(" \t");
+                text += (text.empty() ? "" : " ") + raw.substr(first, last - first + 1);
+                continue;
+            }
+            result.conditions.push_back(condition);
+        }
+        return result;
+    }
+
+    static string attributeName(const string &name) {
+        if (name == "tags") return "tag";
+        if (name == "synopsis_source") return "source";
+        if (name == "watch later" || name == "later") return "watch_later";
+        return name;
+    }
+};
+
+// Mapas de bits por valor de atributo: para cada (atributo, valor) el conjunto de
+// películas que lo tienen. Un filtro se resuelve con operaciones entre mapas de bits.
+class FilterIndex {
+public:
+    void add(const string &attribute, string_view value, uint32_t doc) {
+        bitmaps[attribute][TagIndex::normalize(value)].add(doc);
+    }
+
+    void remove(const string &attribute, const string &value, uint32_t doc) {
+        auto it = bitmaps.find(attribute);
+        if (it == bitmaps.end()) return;
+        auto valueIt = it->second.find(TagIndex::normalize(value));
+        if (valueIt != it->second.end()) valueIt->second.remove(doc);
+    }
+
+    // Películas con el valor; nullptr si ninguna lo tiene
+    const RoaringBitmap *find(const string &attribute, const string &value) const {
+        auto it = bitmaps.find(attribute);
+        if (it == bitmaps.end()) return nullptr;
+        auto valueIt = it->second.find(value);
+        return valueIt == it->second.end() ? nullptr : &valueIt->second;
+    }
+
+    // Películas (de 0 a numDocs) que cumplen el filtro. Primero se intersectan las
+    // condiciones positivas de menor a mayor tamaño y al final se restan las negadas.
+    RoaringBitmap evaluate(const MovieFilter &filter, uint32_t numDocs) const {
+        vector<RoaringBitmap> positive, negative;
+        for (const auto &condition : filter.conditions) {
+            RoaringBitmap matches;
+            if (condition.values.empty()) {
+                if (const RoaringBitmap *bitmap = find(condition.attribute, "")) matches = *bitmap;
+            }
+            for (const string &value : condition.values) {
+                if (const RoaringBitmap *bitmap = find(condition.attribute, value)) matches = matches | *bitmap;
+            }
+            (condition.negated ? negative : positive).push_back(move(matches));
+        }
+        sort(positive.begin(), positive.end(), [](const RoaringBitmap &a, const RoaringBitmap &b) {
+            return a.cardinality() < b.cardinality();
+        });
+
+        RoaringBitmap result = positive.empty() ? RoaringBitmap::range(numDocs) : positive[0];
+        for (size_t i = 1; i < positive.size() && !result.empty(); ++i) {
+            result = result & positive[i];
+        }
+        for (const RoaringBitmap &bitmap : negative) {
+            if (result.empty()) break;
+            result = result - bitmap;
+        }
+        return result;
+    }
+
+    void clear() { bitmaps.clear(); }
+
+    size_t memoryBytes() const {
+        size_t bytes = 0;
+        for (const auto &attribute : bitmaps) {
+            for (const auto &value : attribute.second) bytes += value.second.memoryBytes();
+        }
+        return bytes;
+    }
+
+private:
+    map<string, map<string, RoaringBitmap>> bitmaps;
+};
+
+// Árbol de una consulta booleana
+struct QueryNode {
+    enum Type { EMPTY, TERM, PREFIX, FUZZY, PHRASE, FIELD, AND, OR, NOT };
+    Type type = EMPTY;
+    string text;           // Palabra, prefijo, frase o valor del campo
+    string attribute;      // Para FIELD: "tag", "split" o "source"
+    bool exact = true;     // Para PHRASE: frase exacta o palabras cercanas
+    uint32_t maxGap = 0;   // Para PHRASE no exacta: palabras de por medio permitidas
+    uint32_t distance = 0; // Para FUZZY: ediciones permitidas, 0 para elegirlas según el largo
+    vector<QueryNode> children;
+};
+
+// Parser del lenguaje de consultas:
+//   heist AND (bank OR casino) NOT comedy
+//   "the dark knight"  "dark knight"~3  tag:crime  tag:"good versus evil"  detect*  -comedy
+//   detectiv~  detectiv~2 (palabras parecidas, con a lo más 1 o 2 ediciones)
+// Las palabras seguidas sin operador se unen con AND. Los operadores van en mayúsculas;
+// "and" en minúsculas es una palabra más.
+class QueryParser {
+public:
+    static QueryNode parse(const string &query) {
+        QueryParser parser(query);
+        QueryNode root = parser.parseOr();
+        // Paréntesis de cierre sobrantes: se ignoran y se sigue leyendo
+        while (parser.pos < query.size()) {
+            ++parser.pos;
+            QueryNode rest = parser.parseOr();
+            if (rest.type != QueryNode::EMPTY) root = combine(QueryNode::AND, move(root), move(rest));
+        }
+        return root;
+    }
+
+    // Si la consulta usa algo del lenguaje (operadores, comillas, campos, prefijos, paréntesis)
+    static bool isBoolean(const string &query) {
+        if (query.find_first_of("\"()*:~") != string::npos) return true;
+        stringstream ss(query);
+        string token;
+        while (ss >> token) {
+            if (token == "AND" || token == "OR" || token == "NOT" || (token.size() > 1 && token[0] == '-')) return true;
+        }
+        return false;
+    }
+
+private:
+    const string &query;
+    size_t pos = 0;
+
+    explicit QueryParser(const string &query) : query(query) {}
+
+    static QueryNode combine(QueryNode::Type type, QueryNode left, QueryNode right) {
+        if (left.type == QueryNode::EMPTY) return right;
+        if (right.type == QueryNode::EMPTY) return left;
+        QueryNode node;
+        node.type = type;
+        for (QueryNode *side : {&left, &right}) {
+            // a AND (b AND c) se aplana en un solo AND
+            if (side->type == type) {
+                for (QueryNode &child : side->children) node.children.push_back(move(child));
+            } else {
+                node.children.push_back(move(*side));
+            }
+        }
+        return node;
+    }
+
+    void skipSpaces() {
+        while (pos < query.size() && isspace((unsigned char)query[pos])) ++pos;
+    }
+
+    bool keyword(const char *word) {
+        skipSpaces();
+        size_t length = strlen(word);
+        if (query.compare(pos, length, word) != 0) return false;
+        size_t after = pos + length;
+        if (after < query.size() && !isspace((unsigned char)query[after]) && query[after] != '(' && query[after] != '"') {
+            return false;
+        }
+        pos = after;
+        return true;
+    }
+
+    QueryNode parseOr() {
+        QueryNode node = parseAnd();
+        while (keyword("OR")) {
+            node = combine(QueryNode::OR, move(node), parseAnd());
+        }
+        return node;
+    }
+
+    QueryNode parseAnd() {
+        QueryNode node;
+        while (true) {
+            skipSpaces();
+            if (pos >= query.size() || query[pos] == ')') break;
+            size_t before = pos;
+            if (keyword("OR")) {
+                pos = before;
+                break;
+            }
+            if (keyword("AND")) continue;
+            node = combine(QueryNode::AND, move(node), parseUnary());
+        }
+        return node;
+    }
+
+    QueryNode parseUnary() {
+        skipSpaces();
+        bool dash = pos + 1 < query.size() && query[pos] == '-' && !isspace((unsigned char)query[pos + 1]);
+        if (dash || keyword("NOT")) {
+            if (dash) ++pos;
+            QueryNode child = parseUnary();
+            if (child.type == QueryNode::EMPTY) return child;
+            QueryNode node;
+            node.type = QueryNode::NOT;
+            node.children.push_back(move(child));
+            return node;
+        }
+        return parsePrimary();
+    }
+
+    string readQuoted() {
+        size_t closing = query.find('"', pos + 1);
+        if (closing == string::npos) closing = query.size();
+        string text = query.substr(pos + 1, closing - pos - 1);
+        pos = min(closing + 1, query.size());
+        return text;
+    }
+
+    QueryNode parsePrimary() {
+        QueryNode node;
+        if (query[pos] == '(') {
+            ++pos;
+            node = parseOr();
+            skipSpaces();
+            if (pos < query.size() && query[pos] == ')') ++pos;
+            return node;
+        }
+        if (query[pos] == '"') {
+            node.type = QueryNode::PHRASE;
+            node.text = readQuoted();
+            if (pos < query.size() && query[pos] == '~') {
+                ++pos;
+                node.exact = false;
+                while (pos < query.size() && isdigit((unsigned char)query[pos])) {
+                    node.maxGap = node.maxGap * 10 + (query[pos++] - '0');
+                }
+            }
+            return node;
+        }
+
+        size_t start = pos;
+        while (pos < query.size() && !isspace((unsigned char)query[pos]) && query[pos] != '(' && query[pos] != ')' &&
+               query[pos] != '"') {
+            ++pos;
+        }
+        string word = query.substr(start, pos - start);
+        size_t colon = word.find(':');
+        if (colon != string::npos && colon > 0) {
+            node.type = QueryNode::FIELD;
+            node.attribute = MovieFilter::attributeName(TagIndex::normalize(word.substr(0, colon)));
+            string value = word.substr(colon + 1);
+            if (value.empty() && pos < query.size() && query[pos] == '"') value = readQuoted();
+            node.text = TagIndex::normalize(value);
+            if (node.text.empty()) node.type = QueryNode::EMPTY;
+            return node;
+        }
+        size_t tilde = word.find('~');
+        if (word.size() > 1 && word.back() == '*') {
+            node.type = QueryNode::PREFIX;
+            word.pop_back();
+        } else if (tilde != string::npos && tilde > 0) {
+            node.type = QueryNode::FUZZY;
+            for (size_t i = tilde + 1; i < word.size() && isdigit((unsigned char)word[i]); ++i) {
+                node.distance = node.distance * 10 + (word[i] - '0');
+            }
+            word.resize(tilde);
+        } else {
+            node.type = QueryNode::PHRASE; // Una sola palabra se resuelve como TERM al planificar
+        }
+        node.text = word;
+        if (word.empty()) {
+            if (pos == start) ++pos; // Carácter suelto que no forma palabra
+            node.type = QueryNode::EMPTY;
+        }
+        return node;
+    }
+};
+
+// Snapshot binario del índice congelado. Es un archivo con una cabecera, una
+// tabla de secciones y los arreglos del Trie tal cual están en memoria, de modo
+// que al cargarlo basta con mapearlo y apuntar las vistas a cada sección.
+const char SNAPSHOT_MAGIC[8] = {'M', 'P', 'S', 'T', 'I', 'D', 'X', '\0'};
+const uint32_t SNAPSHOT_VERSION = 12;
+const uint32_t SNAPSHOT_ENDIAN = 0x01020304; // Se lee distinto en una máquina con otro orden de bytes
+const uint64_t SNAPSHOT_ALIGNMENT = 64;
+
+enum SnapshotSectionId : uint32_t {
+    SECTION_STATS = 1,      // Cantidad de películas y suma de largos
+    SECTION_NODES,
+    SECTION_LABELS,
+    SECTION_POSTING_BYTES,
+    SECTION_POSTING_BLOCKS,
+    SECTION_POSTING_TERMS,
+    SECTION_DOC_LENGTHS,
+    SECTION_TERM_TEXT,
+    SECTION_TERM_OFFSETS,
+    SECTION_COMPLETION_OFFSETS,
+    SECTION_COMPLETION_TERMS,
+    SECTION_TAG_NAMES,
+    SECTION_TAG_NAME_OFFSETS,
+    SECTION_TAG_DOC_OFFSETS,
+    SECTION_TAG_DOCS,
+    SECTION_POSITIONS,
+    SECTION_POSITION_OFFSETS,
+    SECTION_ANALYSIS,       // Análisis del título y de la sinopsis
+    SECTION_BOOSTS,         // Peso de cada campo en BM25
+    SECTION_SIMILARITY_NORMS,
+    SECTION_SIMILARITY_BOUNDS,
+    // Índice HNSW, que se guarda en su propio archivo (ver HnswIndex)
+    SECTION_HNSW_STATS,
+    SECTION_HNSW_VECTORS,
+    SECTION_HNSW_LINK_OFFSETS,
+    SECTION_HNSW_LINKS,
+    // Formas de las palabras tal como se escriben (ver Trie::surfaceNodes)
+    SECTION_SURFACE_NODES,
+    SECTION_SURFACE_LABELS,
+    SECTION_SURFACE_TEXT,
+    SECTION_SURFACE_TEXT_OFFSETS,
+    SECTION_SURFACE_TERM_OFFSETS,
+    SECTION_SURFACE_TERMS,
+    // Columnas de MovieStore: la sección base más el número de columna
+    SECTION_MOVIE_TEXT = 32,
+    SECTION_MOVIE_TEXT_OFFSETS = SECTION_MOVIE_TEXT + MovieStore::TEXT_COLUMNS,
+    SECTION_MOVIE_VALUE_NAMES = SECTION_MOVIE_TEXT_OFFSETS + MovieStore::TEXT_COLUMNS,
+    SECTION_MOVIE_VALUE_OFFSETS = SECTION_MOVIE_VALUE_NAMES + MovieStore::CODED_COLUMNS,
+    SECTION_MOVIE_CODES = SECTION_MOVIE_VALUE_OFFSETS + MovieStore::CODED_COLUMNS,
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t endian;
+    uint32_t version;
+    uint64_t source_size;    // Tamaño del CSV con el que se construyó el índice
+    int64_t source_mtime;    // Fecha de modificación de ese CSV
+    uint32_t num_sections;
+    uint32_t reserved;
+    uint64_t table_checksum; // Checksum de la tabla de secciones
+};
+
+struct SnapshotSection {
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t checksum;
+};
+
+// Estructuras que se guardan tal cual: su tamaño es parte del formato
+static_assert(sizeof(FlatTrieNode) == 12 && sizeof(PostingBlock) == 12 && sizeof(TermInfo) == 12 &&
+                  sizeof(FieldAnalysis) == 3 && sizeof(FieldBoosts) == 12,
+              "Cambio en el formato del snapshot: subir SNAPSHOT_VERSION");
+
+// Checksum de 64 bits para detectar archivos corruptos; procesa 8 bytes por paso
+static uint64_t checksum64(const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t hash = 0xcbf29ce484222325ULL ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ p[i]) * 0x100000001b3ULL;
+    }
+    hash ^= hash >> 32;
+    return hash * 0x9e3779b97f4a7c15ULL;
+}
+
+// Identifica la versión del CSV de origen para saber si un snapshot quedó viejo
+struct SourceFingerprint {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    bool exists = false;
+
+    static SourceFingerprint of(const string &filename) {
+        SourceFingerprint fingerprint;
+        error_code error;
+        uintmax_t size = filesystem::file_size(filename, error);
+        if (error) return fingerprint;
+        auto mtime = filesystem::last_write_time(filename, error);
+        if (error) return fingerprint;
+        fingerprint.size = size;
+        fingerprint.mtime = (int64_t)mtime.time_since_epoch().count();
+        fingerprint.exists = true;
+        return fingerprint;
+    }
+};
+
+class SnapshotWriter {
+public:
+    void add(uint32_t id, const void *data, size_t size) {
+        sections.push_back({id, data, size});
+    }
+
+    template <typename T>
+    void add(uint32_t id, ArrayView<T> values) {
+        add(id, values.data(), values.size() * sizeof(T));
+    }
+
+    // Escribe a un archivo temporal y lo renombra, para no dejar un snapshot a medias
+    bool write(const string &path, const SourceFingerprint &source) const {
+        SnapshotHeader header = {};
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.endian = SNAPSHOT_ENDIAN;
+        header.version = SNAPSHOT_VERSION;
+        header.source_size = source.size;
+        header.source_mtime = source.mtime;
+        header.num_sections = (uint32_t)sections.size();
+
+        vector<SnapshotSection> table;
+        uint64_t offset = alignUp(sizeof(SnapshotHeader) + sections.size() * sizeof(SnapshotSection));
+        for (const auto &section : sections) {
+            table.push_back({section.id, 0, offset, section.size, checksum64(section.data, section.size)});
+            offset = alignUp(offset + section.size);
+        }
+        header.table_checksum = checksum64(table.data(), table.size() * sizeof(SnapshotSection));
+
+        string temporary = path + ".tmp";
+        ofstream file(temporary, ios::binary | ios::trunc);
+        if (!file.is_open()) {
+            cerr << "Error al crear el snapshot: " << temporary << endl;
+            return false;
+        }
+        file.write((const char *)&header, sizeof(header));
+        file.write((const char *)table.data(), table.size() * sizeof(SnapshotSection));
+        for (size_t i = 0; i < sections.size(); ++i) {
+            padTo(file, table[i].offset);
+            file.write((const char *)sections[i].data, sections[i].size);
+        }
+        padTo(file, offset);
+        file.close();
+        if (!file) {
+            cerr << "Error al escribir el snapshot: " << temporary << endl;
+            return false;
+        }
+        error_code error;
+        filesystem::rename(temporary, path, error);
+        if (error) {
+            cerr << "Error al reemplazar el snapshot: " << path << endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    struct PendingSection {
+        uint32_t id;
+        const void *data;
+        size_t size;
+    };
+    vector<PendingSection> sections;
+
+    static uint64_t alignUp(uint64_t offset) {
+        return (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+    }
+
+    static void padTo(ofstream &file, uint64_t offset) {
+        static const char zeros[SNAPSHOT_ALIGNMENT] = {};
+        uint64_t position = (uint64_t)file.tellp();
+        if (offset > position) file.write(zeros, offset - position);
+    }
+};
+
+class SnapshotReader {
+public:
+    // Mapea el snapshot y valida cabecera, versión, origen y checksums.
+    // Devuelve false si no existe, está corrupto o es de otra versión del CSV.
+    bool open(const string &path, const SourceFingerprint &source) {
+        file = make_shared<MappedFile>(path);
+        if (!file->is_open() || file->size() < sizeof(SnapshotHeader)) return false;
+
+        const SnapshotHeader *header = (const SnapshotHeader *)file->data();
+        if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+            header->endian != SNAPSHOT_ENDIAN || header->version != SNAPSHOT_VERSION) {
+            return false;
+        }
+        if (source.exists && (header->source_size != source.size || header->source_mtime != source.mtime)) {
+            return false;
+        }
+        size_t tableBytes = (size_t)header->num_sections * sizeof(SnapshotSection);
+        if (file->size() < sizeof(SnapshotHeader) + tableBytes) return false;
+        const SnapshotSection *table = (const SnapshotSection *)(file->data() + sizeof(SnapshotHeader));
+        if (checksum64(table, tableBytes) != header->table_checksum) return false;
+
+        sections.assign(table, table + header->num_sections);
+        for (const auto &section : sections) {
+            if (section.offset > file->size() || section.size > file->size() - section.offset ||
+                section.offset % SNAPSHOT_ALIGNMENT != 0 ||
+                checksum64(file->data() + section.offset, section.size) != section.checksum) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Vista tipada de una sección; vacía si falta o su tamaño no calza con T
+    template <typename T>
+    ArrayView<T> view(uint32_t id) const {
+        for (const auto &section : sections) {
+            if (section.id == id && section.size % sizeof(T) == 0) {
+                return ArrayView<T>((const T *)(file->data() + section.offset), section.size / sizeof(T));
+            }
+        }
+        return {};
+    }
+
+    bool has(uint32_t id) const {
+        for (const auto &section : sections) {
+            if (section.id == id) return true;
+        }
+        return false;
+    }
+
+    // El archivo mapeado: las vistas de view() son válidas mientras alguien lo conserve
+    shared_ptr<const MappedFile> mapping() const { return file; }
+
+private:
+    shared_ptr<MappedFile> file;
+    vector<SnapshotSection> sections;
+};
+
+void MovieStore::addSections(SnapshotWriter &writer) const {
+    for (uint32_t c = 0; c < TEXT_COLUMNS; ++c) {
+        writer.add(SECTION_MOVIE_TEXT + c, text[c]);
+        writer.add(SECTION_MOVIE_TEXT_OFFSETS + c, offsets[c]);
+    }
+    for (uint32_t c = 0; c < CODED_COLUMNS; ++c) {
+        writer.add(SECTION_MOVIE_VALUE_NAMES + c, valueNames[c]);
+        writer.add(SECTION_MOVIE_VALUE_OFFSETS + c, valueOffsets[c]);
+        writer.add(SECTION_MOVIE_CODES + c, codes[c]);
+    }
+}
+
+// Usa las columnas directamente desde el snapshot mapeado, sin copiar el texto
+bool MovieStore::attach(const SnapshotReader &reader) {
+    MovieStore mapped;
+    for (uint32_t c = 0; c < TEXT_COLUMNS; ++c) {
+        mapped.text[c] = reader.view<char>(SECTION_MOVIE_TEXT + c);
+        mapped.offsets[c] = reader.view<uint64_t>(SECTION_MOVIE_TEXT_OFFSETS + c);
+        if (mapped.offsets[c].empty() || mapped.offsets[c].size() != mapped.offsets[IMDB_ID].size() ||
+            mapped.offsets[c][mapped.offsets[c].size() - 1] != mapped.text[c].size()) {
+            return false;
+        }
+    }
+    for (uint32_t c = 0; c < CODED_COLUMNS; ++c) {
+        mapped.valueNames[c] = reader.view<char>(SECTION_MOVIE_VALUE_NAMES + c);
+        mapped.valueOffsets[c] = reader.view<uint32_t>(SECTION_MOVIE_VALUE_OFFSETS + c);
+        mapped.codes[c] = reader.view<uint16_t>(SECTION_MOVIE_CODES + c);
+        ArrayView<uint32_t> starts = mapped.valueOffsets[c];
+        if (starts.empty() || starts[starts.size() - 1] != mapped.valueNames[c].size() ||
+            mapped.codes[c].size() != mapped.size()) {
+            return false;
+        }
+        for (uint16_t code : mapped.codes[c]) {
+            if (code >= starts.size() - 1) return false;
+        }
+    }
+    *this = move(mapped);
+    attached = true;
+    mapping = reader.mapping();
+    return true;
+}
+
+// Estadísticas de una consulta booleana: cuántos bloques de las listas se decodificaron
+struct QueryStats {
+    size_t blocksDecoded = 0;
+    size_t blocksTotal = 0; // Bloques de todas las listas que participan
+};
+
+// Estadísticas de varios índices juntos (ver SegmentedIndex): cuántas películas
+// tienen entre todos y en cuántas aparece cada palabra de una consulta
+struct CollectionStats {
+    uint64_t numDocs = 0;
+    unordered_map<string, uint32_t> docFreq;
+};
+
+// Clase Trie para insertar y buscar palabras en títulos y sinopsis
+class Trie {
+public:
+    Trie() : arena(make_unique<BuildArena>()), root(newNode(*arena)) {}
+
+    // Copia la película al catálogo del Trie y la indexa
+    void insert(const Movie &movie) {
+        if (frozen) {
+            cerr << "No se puede insertar en un Trie congelado" << endl;
+            return;
+        }
+        uint32_t doc = catalog->add(movie.imdb_id(), movie.title(), movie.plot_synopsis(), movie.tags(), movie.split(),
+                                   movie.synopsis_source());
+        indexMovie(doc);
+    }
+
+    // Indexa todas las películas de un catálogo. Si el Trie está vacío se queda con
+    // el catálogo tal cual, sin copiar su texto, y lo indexa en paralelo: cada uno de
+    // numThreads hilos (0: uno por núcleo) indexa un tramo seguido de películas en su
+    // propio sub-Trie, con su propio arena, y después los sub-Tries se unen (ver
+    // mergeShards). El índice queda igual que insertando las películas de a una.
+    void insert(MovieStore &&movies, unsigned numThreads = 0) {
+        if (frozen) {
+            cerr << "No se puede insertar en un Trie congelado" << endl;
+            return;
+        }
+        if (!catalog->empty()) {
+            for (const Movie &movie : movies) insert(movie);
+            return;
+        }
+        *catalog = move(movies);
+        size_t numMovies = catalog->size();
+        if (numThreads == 0) numThreads = max(1u, thread::hardware_concurrency());
+        numThreads = (unsigned)max<size_t>(1, min<size_t>(numThreads, numMovies / MIN_SHARD_MOVIES));
+
+        // El primer sub-Trie es el del propio Trie
+        vector<Shard> shards(numThreads);
+        shards[0] = {move(arena), root};
+        for (unsigned t = 1; t < numThreads; ++t) {
+            shards[t].arena = make_unique<BuildArena>();
+            shards[t].root = newNode(*shards[t].arena);
+        }
+        docLengths.resize(numMovies);
+        vector<uint64_t> shardLengths(numThreads, 0);
+        auto work = [&](unsigned t) {
+            for (size_t doc = numMovies * t / numThreads; doc < numMovies * (t + 1) / numThreads; ++doc) {
+                docLengths[doc] = indexWords(shards[t].root, *shards[t].arena, (uint32_t)doc);
+                shardLengths[t] += docLengths[doc];
+            }
+        };
+        vector<thread> workers;
+        for (unsigned t = 1; t < numThreads; ++t) workers.emplace_back(work, t);
+        work(0);
+        for (auto &worker : workers) worker.join();
+        lengths = docLengths;
+        for (uint64_t length : shardLengths) totalLength += length;
+        for (const Movie &movie : *catalog) {
+            tagIndex.add(movie.id(), movie.tags());
+            indexAttributes(movie.id(), movie);
+        }
+        mergeShards(shards);
+    }
+
+    // Análisis de cada campo; solo se puede cambiar antes de insertar películas
+    void setAnalysis(const FieldAnalysis &title, const FieldAnalysis &synopsis) {
+        if (frozen || !catalog->empty()) {
+            cerr << "El análisis de los campos se elige antes de insertar películas" << endl;
+            return;
+        }
+        titleAnalysis = title;
+        synopsisAnalysis = synopsis;
+    }
+
+    // Peso de cada campo en el puntaje. Las cotas de Block-Max WAND se calculan con
+    // estos pesos al congelar, así que después ya no se pueden cambiar.
+    void setFieldBoosts(const FieldBoosts &fieldBoosts) {
+        if (frozen) {
+            cerr << "Los pesos de los campos se eligen antes de congelar el Trie" << endl;
+            return;
+        }
+        if (fieldBoosts.title < 0 || fieldBoosts.synopsis < 0 || fieldBoosts.tags < 0) {
+            cerr << "Los pesos de los campos no pueden ser negativos" << endl;
+            return;
+        }
+        boosts = fieldBoosts;
+    }
+
+    const FieldBoosts &fieldBoosts() const { return boosts; }
+
+    // Mismo análisis y pesos que other, para indexar películas nuevas igual que él
+    void copySettings(const Trie &other) {
+        setAnalysis(other.titleAnalysis, other.synopsisAnalysis);
+        setFieldBoosts(other.boosts);
+    }
+
+    // Búsqueda por palabras y frases
+    SearchResults search(const string &query) const { return search(query, nullptr); }
+
+    // Búsqueda por palabras y frases, solo entre las películas que cumplen el filtro
+    SearchResults search(const string &query, const MovieFilter &filter) const {
+        if (filter.empty()) return search(query, nullptr);
+        RoaringBitmap allowed = this->filter(filter);
+        return search(query, &allowed);
+    }
+
+    SearchResults search(const string &query, const TagFilter &filter) const {
+        return search(query, MovieFilter::fromTags(filter));
+    }
+
+    // Las k películas con mayor puntaje BM25 (Block-Max WAND, ver abajo)
+    vector<SearchResult> searchTopK(const string &query, size_t k) const { return searchTopK(query, k, nullptr); }
+
+    vector<SearchResult> searchTopK(const string &query, size_t k, const MovieFilter &filter) const {
+        if (filter.empty()) return searchTopK(query, k, nullptr);
+        RoaringBitmap allowed = this->filter(filter);
+        return searchTopK(query, k, &allowed);
+    }
+
+    vector<SearchResult> searchTopK(const string &query, size_t k, const TagFilter &filter) const {
+        return searchTopK(query, k, MovieFilter::fromTags(filter));
+    }
+
+    // Películas que cumplen el filtro, como mapa de bits
+    RoaringBitmap filter(const MovieFilter &filter) const {
+        return filters.evaluate(filter, (uint32_t)catalog->size());
+    }
+
+    // Marca o desmarca una película ("liked", "watch_later") para poder filtrar por ella.
+    // Como insert, no debe llamarse mientras otros hilos buscan.
+    void setFlag(uint32_t doc, const string &flag, bool value) {
+        if (doc >= catalog->size()) return;
+        if (value) filters.add(flag, "", doc);
+        else filters.remove(flag, "", doc);
+    }
+
+    // Búsqueda por tags: coincidencia exacta con uno de los tags de la película
+    vector<uint32_t> searchByTag(const string &tag) const {
+        ArrayView<uint32_t> docs = tagIndex.find(tag);
+        return vector<uint32_t>(docs.begin(), docs.end());
+    }
+
+    // Películas que cumplen un filtro de tags (AND / OR / NOT), en orden de carga
+    vector<uint32_t> searchByTags(const TagFilter &filter) const {
+        return tagIndex.filter(filter, catalog->size());
+    }
+
+    const TagIndex &tags() const { return tagIndex; }
+
+    // Consulta booleana (ver QueryParser). Solo devuelve las películas que cumplen la
+    // expresión, ordenadas por BM25 de sus palabras y frases.
+    SearchResults searchQuery(const string &query, QueryStats *stats = nullptr) const {
+        return runQuery(QueryParser::parse(query), nullptr, stats);
+    }
+
+    SearchResults searchQuery(const string &query, const MovieFilter &filter, QueryStats *stats = nullptr) const {
+        if (filter.empty()) return searchQuery(query, stats);
+        RoaringBitmap allowed = this->filter(filter);
+        return runQuery(QueryParser::parse(query), &allowed, stats);
+    }
+
+    // Frase exacta: las palabras seguidas y en el mismo orden ("the dark knight")
+    SearchResults searchPhrase(const string &phrase) const { return positionalSearch(phrase, true, 0, nullptr); }
+
+    SearchResults searchPhrase(const string &phrase, const MovieFilter &filter) const {
+        if (filter.empty()) return searchPhrase(phrase);
+        RoaringBitmap allowed = this->filter(filter);
+        return positionalSearch(phrase, true, 0, &allowed);
+    }
+
+    // Proximidad: todas las palabras, en cualquier orden, con a lo más maxGap
+    // palabras de por medio entre la primera y la última
+    SearchResults searchNear(const string &words, uint32_t maxGap) const {
+        return positionalSearch(words, false, maxGap, nullptr);
+    }
+
+    SearchResults searchNear(const string &words, uint32_t maxGap, const MovieFilter &filter) const {
+        if (filter.empty()) return searchNear(words, maxGap);
+        RoaringBitmap allowed = this->filter(filter);
+        return positionalSearch(words, false, maxGap, &allowed);
+    }
+
+    // Congela el índice: copia el diccionario a arreglos contiguos en orden por
+    // niveles (estilo LOUDS) y libera los nodos. Después solo admite búsquedas.
+    // Las listas y los vectores de similitud se calculan desde numThreads hilos (0:
+    // uno por núcleo); el resultado no depende de cuántos.
+    void freeze(unsigned numThreads = 0) {
+        if (frozen) return;
+        if (numThreads == 0) numThreads = max(1u, thread::hardware_concurrency());
+        vector<TrieNode *> order = {root};
+        vector<uint32_t> parents = {0};
+        vector<const TrieNode *> termNodes; // Nodo de cada palabra, en orden de palabra
+        nodeStorage.emplace_back();
+        labelStorage.push_back(0);
+        for (size_t i = 0; i < order.size(); ++i) {
+            TrieNode *node = order[i];
+            nodeStorage[i].first_child = (uint32_t)order.size();
+            nodeStorage[i].num_children = (uint32_t)node->children.size();
+            for (const auto &child : node->children) {
+                order.push_back(child.second);
+                parents.push_back((uint32_t)i);
+                labelStorage.push_back(child.first);
+                nodeStorage.emplace_back();
+            }
+            if (!node->movies_with_word.empty()) {
+                nodeStorage[i].term = (uint32_t)termNodes.size();
+                termNodes.push_back(node);
+                // Texto de la palabra, reconstruido subiendo hasta la raíz
+                string word;
+                for (size_t n = i; n != 0; n = parents[n]) word += (char)labelStorage[n];
+                reverse(word.begin(), word.end());
+                termOffsetStorage.push_back((uint32_t)termTextStorage.size());
+                termTextStorage += word;
+            }
+        }
+        termOffsetStorage.push_back((uint32_t)termTextStorage.size());
+        compressPostings(termNodes, numThreads);
+        postings = postingStorage.view();
+        flatNodes = nodeStorage;
+        flatLabels = labelStorage;
+        termText = ArrayView<char>(termTextStorage.data(), termTextStorage.size());
+        termOffsets = termOffsetStorage;
+        buildSurfaceDictionary(termNodes);
+        buildCompletionCache();
+        buildSimilarityNorms(numThreads);
+        tagIndex.freeze();
+        catalog->shrinkToFit();
+        nodeStorage.shrink_to_fit();
+        labelStorage.shrink_to_fit();
+        postingStorage.bytes.shrink_to_fit();
+        postingStorage.blocks.shrink_to_fit();
+        postingStorage.terms.shrink_to_fit();
+        postingStorage.positions.shrink_to_fit();
+        postingStorage.positionOffsets.shrink_to_fit();
+        flatNodes = nodeStorage;
+        flatLabels = labelStorage;
+        postings = postingStorage.view();
+        termText = ArrayView<char>(termTextStorage.data(), termTextStorage.size());
+        termOffsets = termOffsetStorage;
+        surfaceNodes = surfaceNodeStorage;
+        surfaceLabels = surfaceLabelStorage;
+        surfaceText = ArrayView<char>(surfaceTextStorage.data(), surfaceTextStorage.size());
+        surfaceTextOffsets = surfaceTextOffsetStorage;
+        surfaceTermOffsets = surfaceTermOffsetStorage;
+        surfaceTerms = surfaceTermStorage;
+        completionOffsets = completionOffsetStorage;
+        completionTerms = completionTermStorage;
+        similarityNorms = similarityNormStorage;
+        similarityBounds = similarityBoundStorage;
+        releaseArena();
+        frozen = true;
+    }
+
+    // Palabras que empiezan con prefix tal como se escriben ("runni" -> "running"),
+    // las de más películas primero y una sola forma por palabra del índice (la más
+    // corta: "run" y no también "runs"). doc_freq es el de la palabra del índice. Hasta COMPLETION_CACHE resultados salen directo de la caché del nodo.
+    static constexpr size_t COMPLETION_CACHE = 8;
+
+    struct Completion {
+        string word;
+        uint32_t doc_freq;
+    };
+
+    vector<Completion> complete(const string &prefix, size_t n = 5) const {
+        vector<Completion> result;
+        for (uint32_t surface : completeSurfaces(prefix, n)) {
+            result.push_back({surfaceWord(surface), postings.terms[primaryTerm(surface)].doc_freq});
+        }
+        return result;
+    }
+
+    // Búsqueda mientras se escribe: la última palabra de la consulta se toma como
+    // prefijo y se reemplaza por las palabras del índice de sus mejores completaciones
+    vector<SearchResult> searchPrefix(const string &query, size_t k, size_t expansions = COMPLETION_CACHE) const {
+        vector<string> words = splitWords(query);
+        if (words.empty()) return {};
+        // splitWords acaba de usar el tokenizador de este hilo
+        bool endsInWord = Tokenizer::local().endsInWord();
+        string written;
+        for (size_t i = 0; i + (endsInWord ? 1 : 0) < words.size(); ++i) {
+            written += words[i] + " ";
+        }
+        if (!frozen) return searchTopK(written, k);
+        vector<WeightedTerm> terms = weightedTerms(written, nullptr);
+        if (endsInWord) {
+            for (uint32_t surface : completeSurfaces(words.back(), expansions)) {
+                for (uint32_t i = surfaceTermOffsets[surface]; i < surfaceTermOffsets[surface + 1]; ++i) {
+                    uint32_t term = surfaceTerms[i];
+                    auto same = [&](const WeightedTerm &other) { return other.term == term; };
+                    if (none_of(terms.begin(), terms.end(), same)) {
+                        terms.push_back({term, idf(postings.terms[term].doc_freq)});
+                    }
+                }
+            }
+        }
+        return searchTopK(terms, k, nullptr);
+    }
+
+    // Búsqueda tolerante a errores de tipeo: cada palabra de la consulta se reemplaza
+    // por las palabras del índice de las formas escritas a lo más a maxDistance
+    // ediciones (1 o 2; con AUTO_DISTANCE según el largo), y cada una aporta menos
+    // mientras más lejos esté
+    static constexpr uint32_t AUTO_DISTANCE = UINT32_MAX;
+    // Las palabras parecidas que más aportan son las de menos ediciones; se toman
+    // hasta FUZZY_EXPANSIONS por palabra de la consulta, como máximo
+    static constexpr size_t FUZZY_EXPANSIONS = 50;
+
+    SearchResults searchFuzzy(const string &query, uint32_t maxDistance = AUTO_DISTANCE) const {
+        return searchFuzzy(query, maxDistance, nullptr);
+    }
+
+    SearchResults searchFuzzy(const string &query, uint32_t maxDistance, const MovieFilter &filter) const {
+        if (filter.empty()) return searchFuzzy(query, maxDistance);
+        RoaringBitmap allowed = this->filter(filter);
+        return searchFuzzy(query, maxDistance, &allowed);
+    }
+
+    // Palabras escritas en el catálogo parecidas a word, de la más cercana a la más
+    // lejana y, a igual distancia, de la de más películas a la de menos. doc_freq es
+    // el de la palabra del índice de cada una, como en complete().
+    struct Correction {
+        string word;
+        uint32_t distance;
+        uint32_t doc_freq;
+    };
+
+    vector<Correction> corrections(const string &word, uint32_t maxDistance = AUTO_DISTANCE,
+                                   size_t *visitedNodes = nullptr) const {
+        vector<Correction> result;
+        if (maxDistance == AUTO_DISTANCE) maxDistance = autoDistance(word.size());
+        for (const FuzzySurface &match : fuzzySurfaces(word, maxDistance, visitedNodes)) {
+            result.push_back({surfaceWord(match.surface), match.distance, postings.terms[primaryTerm(match.surface)].doc_freq});
+        }
+        return result;
+    }
+
+    // Ediciones permitidas según el largo: ninguna hasta 2 bytes, 1 hasta 5 y 2 desde 6
+    static uint32_t autoDistance(size_t length) { return length <= 2 ? 0 : length <= 5 ? 1 : 2; }
+
+    // Cantidad de palabras del índice congelado
+    size_t numTerms() const { return frozen ? postings.terms.size() : 0; }
+
+    string term(uint32_t index) const { return termWord(index); }
+
+    // Películas parecidas a las de docs por su contenido. Cada película es un vector
+    // TF-IDF de las palabras de su título, sinopsis y tags (con el peso de cada campo),
+    // de largo 1, y la consulta es la suma de los vectores de docs. El coseno se
+    // acumula recorriendo las listas de las palabras de la consulta, sin comparar
+    // todos los pares, y con poda al estilo MaxScore usando la cota de cada palabra:
+    // - Las palabras se recorren de mayor a menor cota. Cuando lo que falta sumar no
+    //   alcanza al k-ésimo puntaje, ninguna película nueva puede entrar al top k.
+    // - Desde ahí solo se completan los candidatos que todavía pueden entrar,
+    //   saltando en cada lista directo a ellos.
+    // El resultado es el mismo que comparar con todas las películas.
+    vector<SearchResult> similarMovies(const vector<uint32_t> &docs, size_t k) const {
+        if (!frozen) {
+            cerr << "Las películas similares requieren un Trie congelado" << endl;
+            return {};
+        }
+        if (k == 0) return {};
+        struct QueryTerm {
+            uint32_t term;
+            double weight; // Peso en la consulta (normalizado) por idf
+            double upper;  // Cota del aporte de la palabra a cualquier película
+            uint32_t inDocs; // Películas de docs que la contienen
+        };
+        map<uint32_t, pair<double, uint32_t>> combined;
+        for (uint32_t doc : docs) {
+            if (doc >= catalog->size()) continue;
+            for (const auto &entry : termVector(doc)) {
+                combined[entry.first].first += entry.second;
+                combined[entry.first].second++;
+            }
+        }
+        double queryNorm = 0;
+        for (const auto &entry : combined) queryNorm += entry.second.first * entry.second.first;
+        if (queryNorm == 0) return {};
+        queryNorm = sqrt(queryNorm);
+        vector<QueryTerm> query;
+        for (const auto &entry : combined) {
+            // Una palabra que solo está en docs no suma a ninguna otra película
+            if (postings.terms[entry.first].doc_freq == entry.second.second) continue;
+            double weight = entry.second.first / queryNorm;
+            query.push_back({entry.first, weight * idf(postings.terms[entry.first].doc_freq),
+                             weight * similarityBounds[entry.first], entry.second.second});
+        }
+        sort(query.begin(), query.end(), [](const QueryTerm &a, const QueryTerm &b) { return a.upper > b.upper; });
+        vector<double> remaining(query.size() + 1, 0.0); // Suma de las cotas desde cada palabra
+        for (size_t i = query.size(); i-- > 0;) remaining[i] = remaining[i + 1] + query[i].upper;
+
+        auto excluded = [&](uint32_t doc) { return find(docs.begin(), docs.end(), doc) != docs.end(); };
+        // La mayoría de las apariciones son pocas y solo de la sinopsis: su log1p se precalcula
+        double synopsisWeights[16];
+        for (uint32_t f = 0; f < 16; ++f) synopsisWeights[f] = log1p(weightedFreq(f, 0, 0));
+        auto contribution = [&](const QueryTerm &term, const PostingCursor &cursor) {
+            uint32_t freq = cursor.freq();
+            double tf = freq < 16 && freq == cursor.freq(Field::SYNOPSIS) ? synopsisWeights[freq] : log1p(weightedFreq(cursor));
+            return term.weight * tf / similarityNorms[cursor.doc()];
+        };
+
+        // k-ésimo mejor puntaje acumulado entre scores (0 si hay menos de k)
+        vector<double> scores;
+        auto kthScore = [&]() {
+            if (scores.size() < k) return 0.0;
+            nth_element(scores.begin(), scores.begin() + (k - 1), scores.end(), greater<double>());
+            return scores[k - 1];
+        };
+
+        // Todas las películas de las listas pueden entrar
+        ScoreAccumulator &accumulator = ScoreAccumulator::local(catalog->size());
+        double threshold = 0, checked = remaining[0];
+        size_t i = 0;
+        for (; i < query.size(); ++i) {
+            // El umbral solo sube: se recalcula cuando lo que falta bajó bastante
+            if (remaining[i] < checked * 0.9) {
+                checked = remaining[i];
+                scores.clear();
+                for (uint32_t doc : accumulator.docs()) {
+                    if (!excluded(doc)) scores.push_back(accumulator.score(doc));
+                }
+                threshold = kthScore();
+            }
+            if (threshold > remaining[i]) break;
+            for (PostingCursor cursor(&postings, query[i].term); cursor.doc() != PostingCursor::END; cursor.next()) {
+                accumulator.add(cursor.doc(), contribution(query[i], cursor));
+            }
+        }
+        vector<SearchResult> candidates;
+        for (uint32_t doc : accumulator.docs()) {
+            if (!excluded(doc)) candidates.push_back({doc, accumulator.score(doc)});
+        }
+        accumulator.clear();
+
+        // Solo los candidatos que con lo que falta todavía superan el umbral
+        sort(candidates.begin(), candidates.end(),
+             [](const SearchResult &a, const SearchResult &b) { return a.doc < b.doc; });
+        for (; i < query.size() && candidates.size() > k; ++i) {
+            scores.clear();
+            for (const SearchResult &candidate : candidates) scores.push_back(candidate.score);
+            threshold = kthScore();
+            candidates.erase(remove_if(candidates.begin(), candidates.end(),
+                                       [&](const SearchResult &c) { return c.score + remaining[i] < threshold; }),
+                             candidates.end());
+            PostingCursor cursor(&postings, query[i].term);
+            for (SearchResult &candidate : candidates) {
+                cursor.advance(candidate.doc);
+                if (cursor.doc() == PostingCursor::END) break;
+                if (cursor.doc() == candidate.doc) candidate.score += contribution(query[i], cursor);
+            }
+        }
+        for (; i < query.size(); ++i) {
+            PostingCursor cursor(&postings, query[i].term);
+            for (SearchResult &candidate : candidates) {
+                cursor.advance(candidate.doc);
+                if (cursor.doc() == PostingCursor::END) break;
+                if (cursor.doc() == candidate.doc) candidate.score += contribution(query[i], cursor);
+            }
+        }
+        return SearchResults(move(candidates)).top(k);
+    }
+
+    // Vector TF-IDF de largo 1 de una película: (palabra, peso), en orden de palabra
+    vector<pair<uint32_t, float>> termVector(uint32_t doc) const {
+        vector<pair<uint32_t, float>> result;
+        if (!frozen || doc >= catalog->size() || similarityNorms[doc] == 0) return result;
+        map<uint32_t, double> freqs;
+        forEachIndexedWord((*catalog)[doc], [&](string_view word, uint32_t, Field field, string_view) {
+            uint32_t term = findTerm(string(word));
+            if (term == UINT32_MAX) return;
+            freqs[term] += field == Field::TITLE ? boosts.title : field == Field::TAGS ? boosts.tags : boosts.synopsis;
+        });
+        for (const auto &entry : freqs) {
+            double weight = log1p(entry.second) * idf(postings.terms[entry.first].doc_freq) / similarityNorms[doc];
+            result.push_back({entry.first, (float)weight});
+        }
+        return result;
+    }
+
+    // Los vectores TF-IDF de todas las películas desde las listas, palabra por palabra:
+    // llama a fn(palabra, doc, peso) con el mismo peso que daría termVector(doc)
+    template <typename F>
+    void forEachTermWeight(F &&fn) const {
+        if (!frozen) return;
+        for (uint32_t term = 0; term < postings.terms.size(); ++term) {
+            double termIdf = idf(postings.terms[term].doc_freq);
+            for (PostingCursor cursor(&postings, term); cursor.doc() != PostingCursor::END; cursor.next()) {
+                fn(term, cursor.doc(), (float)(log1p(weightedFreq(cursor)) * termIdf / similarityNorms[cursor.doc()]));
+            }
+        }
+    }
+
+    bool isFrozen() const { return frozen; }
+
+    // Películas del índice; los resultados de búsqueda son números de película en él
+    const MovieStore &allMovies() const { return *catalog; }
+    Movie movie(uint32_t doc) const { return (*catalog)[doc]; }
+
+    // El catálogo compartido, para quien lo necesite aunque el Trie deje de existir
+    shared_ptr<const MovieStore> sharedMovies() const { return catalog; }
+
+    // Búsqueda en un segmento de varios (ver SegmentedIndex): suma a stats las
+    // películas de este índice y en cuántas aparece cada palabra de la consulta. Solo
+    // cuenta las películas 0 .. numDocs-1 (las que ve una vista de un Trie sin congelar).
+    void addCollectionStats(const string &query, CollectionStats &stats, uint32_t numDocs = UINT32_MAX) const {
+        numDocs = (uint32_t)min<size_t>(numDocs, catalog->size());
+        stats.numDocs += numDocs;
+        for (const auto &queryWord : groupQueryWords(query)) {
+            uint32_t docFreq = 0;
+            if (numDocs == catalog->size()) {
+                docFreq = docFrequency(queryWord.first);
+            } else {
+                forEachPosting(queryWord.first, [&](uint32_t doc, double) { docFreq += doc < numDocs; });
+            }
+            stats.docFreq[queryWord.first] += docFreq;
+        }
+    }
+
+    // Como search y searchTopK, solo entre las películas de allowed (nullptr: todas)
+    // y con el idf de stats en vez del de este índice, para que los puntajes de
+    // distintos segmentos se puedan comparar
+    SearchResults searchSegment(const string &query, const RoaringBitmap *allowed, const CollectionStats &stats) const {
+        return search(query, allowed, &stats);
+    }
+
+    vector<SearchResult> searchTopKSegment(const string &query, size_t k, const RoaringBitmap *allowed,
+                                           const CollectionStats &stats) const {
+        return searchTopK(query, k, allowed, &stats);
+    }
+
+    // Guarda el índice congelado (películas, diccionario y listas) en un snapshot.
+    // sourceCSV es el archivo del que salió, para detectar después si cambió.
+    bool saveSnapshot(const string &path, const string &sourceCSV) const {
+        if (!frozen) {
+            cerr << "Solo se puede guardar un Trie congelado" << endl;
+            return false;
+        }
+        uint64_t stats[2] = {catalog->size(), totalLength};
+        FieldAnalysis analysis[2] = {titleAnalysis, synopsisAnalysis};
+
+        SnapshotWriter writer;
+        writer.add(SECTION_STATS, stats, sizeof(stats));
+        writer.add(SECTION_ANALYSIS, analysis, sizeof(analysis));
+        writer.add(SECTION_BOOSTS, &boosts, sizeof(boosts));
+        writer.add(SECTION_NODES, flatNodes);
+        writer.add(SECTION_LABELS, flatLabels);
+        writer.add(SECTION_POSTING_BYTES, postings.bytes);
+        writer.add(SECTION_POSTING_BLOCKS, postings.blocks);
+        writer.add(SECTION_POSTING_TERMS, postings.terms);
+        writer.add(SECTION_POSITIONS, postings.positions);
+        writer.add(SECTION_POSITION_OFFSETS, postings.positionOffsets);
+        writer.add(SECTION_DOC_LENGTHS, lengths);
+        writer.add(SECTION_TERM_TEXT, termText);
+        writer.add(SECTION_TERM_OFFSETS, termOffsets);
+        writer.add(SECTION_SURFACE_NODES, surfaceNodes);
+        writer.add(SECTION_SURFACE_LABELS, surfaceLabels);
+        writer.add(SECTION_SURFACE_TEXT, surfaceText);
+        writer.add(SECTION_SURFACE_TEXT_OFFSETS, surfaceTextOffsets);
+        writer.add(SECTION_SURFACE_TERM_OFFSETS, surfaceTermOffsets);
+        writer.add(SECTION_SURFACE_TERMS, surfaceTerms);
+        writer.add(SECTION_COMPLETION_OFFSETS, completionOffsets);
+        writer.add(SECTION_COMPLETION_TERMS, completionTerms);
+        writer.add(SECTION_TAG_NAMES, tagIndex.names);
+        writer.add(SECTION_TAG_NAME_OFFSETS, tagIndex.nameOffsets);
+        writer.add(SECTION_TAG_DOC_OFFSETS, tagIndex.docOffsets);
+        writer.add(SECTION_TAG_DOCS, tagIndex.docs);
+        writer.add(SECTION_SIMILARITY_NORMS, similarityNorms);
+        writer.add(SECTION_SIMILARITY_BOUNDS, similarityBounds);
+        catalog->addSections(writer);
+        return writer.write(path, SourceFingerprint::of(sourceCSV));
+    }
+
+    // Carga un snapshot sobre un Trie vacío. Los arreglos del índice y las columnas
+    // del catálogo se usan directamente desde el archivo mapeado, sin copiarlos.
+    // Devuelve false si el snapshot no existe, está corrupto, el CSV cambió o se
+    // construyó con otro análisis o con otros pesos de los campos (las cotas de
+    // Block-Max WAND dependen de los pesos).
+    bool loadSnapshot(const string &path, const string &sourceCSV) {
+        if (frozen || !catalog->empty()) {
+            cerr << "Solo se puede cargar un snapshot en un Trie vacío" << endl;
+            return false;
+        }
+        SnapshotReader reader;
+        if (!reader.open(path, SourceFingerprint::of(sourceCSV))) return false;
+
+        ArrayView<uint64_t> stats = reader.view<uint64_t>(SECTION_STATS);
+        ArrayView<FieldAnalysis> analysis = reader.view<FieldAnalysis>(SECTION_ANALYSIS);
+        if (analysis.size() != 2 || analysis[0] != titleAnalysis || analysis[1] != synopsisAnalysis) return false;
+        ArrayView<FieldBoosts> savedBoosts = reader.view<FieldBoosts>(SECTION_BOOSTS);
+        if (savedBoosts.size() != 1 || savedBoosts[0] != boosts) return false;
+        if (stats.size() != 2 || !reader.has(SECTION_NODES) || !catalog->attach(reader) || catalog->size() != stats[0]) {
+            return false;
+        }
+        flatNodes = reader.view<FlatTrieNode>(SECTION_NODES);
+        flatLabels = reader.view<unsigned char>(SECTION_LABELS);
+        postings.bytes = reader.view<uint8_t>(SECTION_POSTING_BYTES);
+        postings.blocks = reader.view<PostingBlock>(SECTION_POSTING_BLOCKS);
+        postings.terms = reader.view<TermInfo>(SECTION_POSTING_TERMS);
+        postings.positions = reader.view<uint8_t>(SECTION_POSITIONS);
+        postings.positionOffsets = reader.view<uint32_t>(SECTION_POSITION_OFFSETS);
+        if (postings.positionOffsets.size() != postings.blocks.size()) return false;
+        lengths = reader.view<uint32_t>(SECTION_DOC_LENGTHS);
+        termText = reader.view<char>(SECTION_TERM_TEXT);
+        termOffsets = reader.view<uint32_t>(SECTION_TERM_OFFSETS);
+        surfaceNodes = reader.view<FlatTrieNode>(SECTION_SURFACE_NODES);
+        surfaceLabels = reader.view<unsigned char>(SECTION_SURFACE_LABELS);
+        surfaceText = reader.view<char>(SECTION_SURFACE_TEXT);
+        surfaceTextOffsets = reader.view<uint32_t>(SECTION_SURFACE_TEXT_OFFSETS);
+        surfaceTermOffsets = reader.view<uint32_t>(SECTION_SURFACE_TERM_OFFSETS);
+        surfaceTerms = reader.view<uint32_t>(SECTION_SURFACE_TERMS);
+        completionOffsets = reader.view<uint32_t>(SECTION_COMPLETION_OFFSETS);
+        completionTerms = reader.view<uint32_t>(SECTION_COMPLETION_TERMS);
+        if (surfaceNodes.empty() || completionOffsets.size() != surfaceNodes.size() + 1 ||
+            surfaceTermOffsets.size() != surfaceTextOffsets.size()) {
+            return false;
+        }
+        similarityNorms = reader.view<float>(SECTION_SIMILARITY_NORMS);
+        similarityBounds = reader.view<float>(SECTION_SIMILARITY_BOUNDS);
+        if (similarityNorms.size() != catalog->size() || similarityBounds.size() != postings.terms.size()) return false;
+        if (!tagIndex.attach(reader.view<char>(SECTION_TAG_NAMES), reader.view<uint32_t>(SECTION_TAG_NAME_OFFSETS),
+                             reader.view<uint32_t>(SECTION_TAG_DOC_OFFSETS), reader.view<uint32_t>(SECTION_TAG_DOCS))) {
+            return false;
+        }
+        totalLength = stats[1];
+
+        for (const Movie &movie : *catalog) {
+            indexAttributes(movie.id(), movie);
+        }
+        snapshot = reader.mapping();
+        releaseArena();
+        frozen = true;
+        return true;
+    }
+
+    bool containsWord(const string &word) const {
+        if (frozen) {
+            return findTerm(word) != UINT32_MAX;
+        }
+        const TrieNode *node = findNode(word);
+        return node && !node->movies_with_word.empty();
+    }
+
+    // Memoria de las listas de apariciones
+    size_t postingsBytes() const {
+        if (frozen) {
+            return postings.memoryBytes();
+        }
+        size_t bytes = 0;
+        vector<const TrieNode *> pending = {root};
+        while (!pending.empty()) {
+            const TrieNode *node = pending.back();
+            pending.pop_back();
+            bytes += node->movies_with_word.capacity() * sizeof(Posting);
+            for (const auto &child : node->children) {
+                pending.push_back(child.second);
+            }
+        }
+        return bytes;
+    }
+
+    // Memoria de las posiciones de cada aparición
+    size_t positionsBytes() const { return frozen ? postings.positionBytes() : 0; }
+
+    // Memoria aproximada del diccionario (nodos y aristas, sin las listas de películas).
+    // Congelado incluye el Trie de las formas de las palabras.
+    size_t dictionaryBytes() const {
+        if (frozen) {
+            return (flatNodes.size() + surfaceNodes.size()) * sizeof(FlatTrieNode) + flatLabels.size() +
+                   surfaceLabels.size();
+        }
+        // Nodos y arreglos de hijos salen del arena, sin cabeceras del heap por asignación
+        size_t bytes = 0;
+        vector<const TrieNode *> pending = {root};
+        while (!pending.empty()) {
+            const TrieNode *node = pending.back();
+            pending.pop_back();
+            bytes += sizeof(TrieNode) + node->children.capacity() * sizeof(node->children[0]);
+            for (const auto &child : node->children) {
+                pending.push_back(child.second);
+            }
+        }
+        return bytes;
+    }
+
+    // Palabras del texto como strings propios; indexar y buscar usan Tokenizer directamente
+    vector<string> splitWords(string_view text) const {
+        const vector<string_view> &tokens = Tokenizer::local().split(text);
+        return vector<string>(tokens.begin(), tokens.end());
+    }
+
+private:
+    // Memoria de construcción: los nodos se piden directo a chunks (solo avanzar un
+    // puntero) y los arreglos que crecen usan pools, que reutilizan los bloques que
+    // sueltan al crecer. Todo se devuelve de una vez al destruir el arena.
+    struct BuildArena {
+        pmr::monotonic_buffer_resource chunks{1 << 20};
+        pmr::unsynchronized_pool_resource pools{&chunks};
+    };
+    unique_ptr<BuildArena> arena;
+    TrieNode *root; // Nulo una vez congelado
+    // Arenas de los sub-Tries ya unidos: sus nodos son parte del árbol hasta congelar
+    vector<unique_ptr<BuildArena>> shardArenas;
+
+    // Sub-Trie de un hilo durante insert en paralelo
+    struct Shard {
+        unique_ptr<BuildArena> arena;
+        TrieNode *root = nullptr;
+    };
+    static constexpr size_t MIN_SHARD_MOVIES = 256; // Con menos por hilo no conviene repartir
+    shared_ptr<MovieStore> catalog = make_shared<MovieStore>();
+    // Los títulos son cortos y a veces son solo palabras vacías ("It", "Up"): por
+    // omisión conservan las palabras vacías y solo se recortan a su raíz
+    FieldAnalysis titleAnalysis = {FieldAnalysis::ENGLISH, false, true};
+    FieldAnalysis synopsisAnalysis;
+    FieldBoosts boosts;
+    TagIndex tagIndex;
+    FilterIndex filters; // Mapas de bits de tags, split, source y marcas
+
+    // Estadísticas para BM25
+    static constexpr double BM25_K1 = 1.2;
+    static constexpr double BM25_B = 0.75;
+    vector<uint32_t> docLengths;  // Palabras indexadas de título + sinopsis + tags de cada película
+    ArrayView<uint32_t> lengths;  // Vista de docLengths o del snapshot
+    uint64_t totalLength = 0;
+
+    // Representación congelada. Las búsquedas leen las vistas, que apuntan a los
+    // vectores de almacenamiento (tras freeze) o a un snapshot mapeado en memoria.
+    bool frozen = false;
+    ArrayView<FlatTrieNode> flatNodes;
+    ArrayView<unsigned char> flatLabels; // Etiqueta de la arista que llega a cada nodo
+    PostingLists postings;
+    ArrayView<char> termText;               // Texto de todas las palabras concatenado
+    ArrayView<uint32_t> termOffsets;        // Inicio de cada palabra en termText (una más al final)
+    // Formas de las palabras tal como se escriben (plegadas, sin quitar palabras vacías
+    // ni recortar raíces), para autocompletar, prefijos y correcciones. Cada forma
+    // apunta a las palabras del índice en que queda al analizarla ("running" -> "run"),
+    // casi siempre una. Se numeran de la mejor a la peor (ver buildSurfaceDictionary).
+    ArrayView<FlatTrieNode> surfaceNodes;   // Trie de las formas; term es el número de la forma
+    ArrayView<unsigned char> surfaceLabels;
+    ArrayView<char> surfaceText;            // Texto de todas las formas concatenado
+    ArrayView<uint32_t> surfaceTextOffsets; // Inicio de cada forma en surfaceText (una más al final)
+    ArrayView<uint32_t> surfaceTermOffsets; // Inicio de las palabras de cada forma en surfaceTerms
+    ArrayView<uint32_t> surfaceTerms;       // Palabras del índice de cada forma, la de más películas primero
+    ArrayView<uint32_t> completionOffsets;  // Inicio de la caché de cada nodo de surfaceNodes
+    ArrayView<uint32_t> completionTerms;    // Mejores formas del subárbol de cada nodo
+    vector<FlatTrieNode> nodeStorage, surfaceNodeStorage;
+    vector<unsigned char> labelStorage, surfaceLabelStorage;
+    PostingStore postingStorage;
+    string termTextStorage, surfaceTextStorage;
+    vector<uint32_t> termOffsetStorage, completionOffsetStorage, completionTermStorage;
+    vector<uint32_t> surfaceTextOffsetStorage, surfaceTermOffsetStorage, surfaceTermStorage;
+    ArrayView<float> similarityNorms;  // Largo del vector TF-IDF de cada película
+    ArrayView<float> similarityBounds; // Mayor peso de cada palabra en los vectores TF-IDF
+    vector<float> similarityNormStorage, similarityBoundStorage;
+    shared_ptr<const MappedFile> snapshot;
+
+    // Palabras analizadas de una consulta y su posición en el texto
+    struct QueryTerms {
+        vector<string> words;
+        vector<uint32_t> positions;
+
+        bool operator==(const QueryTerms &other) const { return words == other.words && positions == other.positions; }
+    };
+
+    // Iteradores de películas para ejecutar consultas booleanas. Todos recorren
+    // películas en orden creciente; advance(target) salta a la primera >= target
+    // usando los saltos de las listas, así un AND selectivo no decodifica todo.
+    class DocIterator {
+    public:
+        virtual ~DocIterator() = default;
+        virtual uint32_t doc() const = 0;
+        virtual void advance(uint32_t target) = 0;
+        virtual uint64_t cost() const = 0;    // Cota de cuántas películas puede devolver
+        virtual double score() { return 0; }  // Puntaje BM25 en la película actual
+        virtual void addStats(QueryStats &) const {}
+
+        void next() {
+            if (doc() != PostingCursor::END) advance(doc() + 1);
+        }
+    };
+
+    class EmptyIterator : public DocIterator {
+    public:
+        uint32_t doc() const override { return PostingCursor::END; }
+        void advance(uint32_t) override {}
+        uint64_t cost() const override { return 0; }
+    };
+
+    class AllDocsIterator : public DocIterator {
+    public:
+        explicit AllDocsIterator(uint32_t numDocs) : numDocs(numDocs), current(numDocs ? 0 : PostingCursor::END) {}
+        uint32_t doc() const override { return current; }
+        void advance(uint32_t target) override {
+            if (target > current) current = target < numDocs ? target : PostingCursor::END;
+        }
+        uint64_t cost() const override { return numDocs; }
+
+    private:
+        uint32_t numDocs, current;
+    };
+
+    class TermIterator : public DocIterator {
+    public:
+        // boost multiplica el aporte (las palabras parecidas pesan menos que la exacta)
+        TermIterator(const Trie &trie, uint32_t term, double boost = 1.0)
+            : trie(trie), cursor(&trie.postings, term), weight(boost * trie.idf(cursor.size())) {}
+        uint32_t doc() const override { return cursor.doc(); }
+        void advance(uint32_t target) override { cursor.advance(target); }
+        uint64_t cost() const override { return cursor.size(); }
+        double score() override { return weight * tfScore(trie.weightedFreq(cursor), trie.lengthNorm(cursor.doc())); }
+        void addStats(QueryStats &stats) const override {
+            stats.blocksDecoded += cursor.blocksDecoded();
+            stats.blocksTotal += (cursor.size() + POSTING_BLOCK_SIZE - 1) / POSTING_BLOCK_SIZE;
+        }
+
+    private:
+        const Trie &trie;
+        PostingCursor cursor;
+        double weight;
+    };
+
+    // Películas de un mapa de bits (tags, split, source o un filtro ya evaluado)
+    class BitmapIterator : public DocIterator {
+    public:
+        explicit BitmapIterator(const RoaringBitmap *bitmap) : bitmap(bitmap), current(bitmap->nextValue(0)) {}
+        explicit BitmapIterator(RoaringBitmap bitmap)
+            : owned(move(bitmap)), bitmap(&owned), current(owned.nextValue(0)) {}
+        uint32_t doc() const override { return current; }
+        void advance(uint32_t target) override {
+            if (target > current) current = bitmap->nextValue(target);
+        }
+        uint64_t cost() const override { return bitmap->cardinality(); }
+
+    private:
+        RoaringBitmap owned;
+        const RoaringBitmap *bitmap;
+        uint32_t current;
+    };
+
+    // Frases y proximidad: las películas candidatas salen de intersectar las listas
+    // con saltos exponenciales, empezando por la palabra menos frecuente; solo en
+    // las que tienen todas las palabras se decodifican las posiciones.
+    // El puntaje es BM25 tomando la frase como un término: tf = veces que aparece,
+    // idf = suma de los idf de sus palabras.
+    class PhraseIterator : public DocIterator {
+    public:
+        // offsets: posición de cada palabra en la frase, relativa a la primera
+        PhraseIterator(const Trie &trie, const vector<uint32_t> &terms, const vector<uint32_t> &offsets, bool exact,
+                       uint32_t maxGap)
+            : trie(trie), exact(exact), maxSpan((uint32_t)terms.size() - 1 + maxGap), offsets(offsets),
+              positions(terms.size()) {
+            cursors.reserve(terms.size());
+            for (uint32_t term : terms) {
+                cursors.emplace_back(&trie.postings, term);
+                phraseIdf += trie.idf(cursors.back().size());
+            }
+            for (size_t i = 0; i < cursors.size(); ++i) order.push_back(i);
+            sort(order.begin(), order.end(), [&](size_t a, size_t b) { return cursors[a].size() < cursors[b].size(); });
+            find(0);
+        }
+        uint32_t doc() const override { return current; }
+        void advance(uint32_t target) override {
+            if (target > current) find(target);
+        }
+        uint64_t cost() const override { return cursors[order[0]].size(); }
+        double score() override { return phraseIdf * tfScore(matches, trie.lengthNorm(current)); }
+        void addStats(QueryStats &stats) const override {
+            for (const PostingCursor &cursor : cursors) {
+                stats.blocksDecoded += cursor.blocksDecoded();
+                stats.blocksTotal += (cursor.size() + POSTING_BLOCK_SIZE - 1) / POSTING_BLOCK_SIZE;
+            }
+        }
+
+    private:
+        const Trie &trie;
+        bool exact;
+        uint32_t maxSpan;
+        vector<uint32_t> offsets;
+        vector<PostingCursor> cursors;
+        vector<size_t> order; // Cursores de la palabra menos frecuente a la más frecuente
+        vector<vector<uint32_t>> positions;
+        double phraseIdf = 0;
+        uint32_t current = 0, matches = 0;
+
+        // Leapfrog: cada lista salta al doc de la anterior hasta que todas coinciden;
+        // solo entonces se decodifican las posiciones
+        void find(uint32_t target) {
+            while (target != PostingCursor::END) {
+                bool aligned = true;
+                for (size_t i = 0; aligned && i < order.size(); ++i) {
+                    PostingCursor &cursor = cursors[order[i]];
+                    cursor.advance(target);
+                    if (cursor.doc() != target) {
+                        target = cursor.doc();
+                        aligned = false;
+                    }
+                }
+                if (!aligned) continue;
+                for (size_t i = 0; i < cursors.size(); ++i) cursors[i].positions(positions[i]);
+                matches = exact ? countPhrase(positions, offsets) : countWindows(positions, maxSpan);
+                if (matches > 0) break;
+                ++target;
+            }
+            current = target;
+        }
+    };
+
+    // AND: la lista más corta propone y las demás confirman con advance (leapfrog).
+    // Las negaciones solo descartan: se consultan en las películas que ya pasaron.
+    class AndIterator : public DocIterator {
+    public:
+        AndIterator(vector<unique_ptr<DocIterator>> required, vector<unique_ptr<DocIterator>> excluded, uint32_t numDocs)
+            : required(move(required)), excluded(move(excluded)) {
+            if (this->required.empty()) this->required.push_back(make_unique<AllDocsIterator>(numDocs));
+            // Plan: de menor a mayor costo
+            sort(this->required.begin(), this->required.end(),
+                 [](const unique_ptr<DocIterator> &a, const unique_ptr<DocIterator> &b) { return a->cost() < b->cost(); });
+            align(this->required[0]->doc());
+        }
+        uint32_t doc() const override { return current; }
+        void advance(uint32_t target) override {
+            if (target <= current) return;
+            required[0]->advance(target);
+            align(required[0]->doc());
+        }
+        uint64_t cost() const override { return required[0]->cost(); }
+        double score() override {
+            double total = 0;
+            for (auto &child : required) total += child->score();
+            return total;
+        }
+        void addStats(QueryStats &stats) const override {
+            for (auto &child : required) child->addStats(stats);
+            for (auto &child : excluded) child->addStats(stats);
+        }
+
+    private:
+        vector<unique_ptr<DocIterator>> required, excluded;
+        uint32_t current = 0;
+
+        void align(uint32_t target) {
+            while (target != PostingCursor::END) {
+                bool aligned = true;
+                for (size_t i = 0; aligned && i < required.size(); ++i) {
+                    required[i]->advance(target);
+                    if (required[i]->doc() != target) {
+                        target = required[i]->doc();
+                        aligned = false;
+                    }
+                }
+                if (!aligned) continue;
+                bool rejected = false;
+                for (size_t i = 0; !rejected && i < excluded.size(); ++i) {
+                    excluded[i]->advance(target);
+                    rejected = excluded[i]->doc() == target;
+                }
+                if (!rejected) break;
+                ++target; // Descartada por una negación
+            }
+            current = target;
+        }
+    };
+
+    // OR: montículo con el doc actual de cada hijo; los hijos en la película actual
+    // quedan fuera del montículo para sumar sus puntajes
+    class OrIterator : public DocIterator {
+    public:
+        explicit OrIterator(vector<unique_ptr<DocIterator>> children) : children(move(children)) {
+            for (size_t i = 0; i < this->children.size(); ++i) push(i);
+            settle();
+        }
+        uint32_t doc() const override { return current; }
+        void advance(uint32_t target) override {
+            if (target <= current) return;
+            for (size_t i : atCurrent) {
+                children[i]->advance(target);
+                push(i);
+            }
+            while (!heap.empty() && children[heap.front()]->doc() < target) {
+                pop_heap(heap.begin(), heap.end(), later());
+                size_t i = heap.back();
+                heap.pop_back();
+                children[i]->advance(target);
+                push(i);
+            }
+            settle();
+        }
+        uint64_t cost() const override {
+            uint64_t total = 0;
+            for (auto &child : children) total += child->cost();
+            return total;
+        }
+        double score() override {
+            double total = 0;
+            for (size_t i : atCurrent) total += children[i]->score();
+            return total;
+        }
+        void addStats(QueryStats &stats) const override {
+            for (auto &child : children) child->addStats(stats);
+        }
+
+    private:
+        vector<unique_ptr<DocIterator>> children;
+        vector<size_t> heap, atCurrent;
+        uint32_t current = PostingCursor::END;
+
+        // Orden del montículo: arriba el hijo con menor doc
+        struct Later {
+            const vector<unique_ptr<DocIterator>> *children;
+            bool operator()(size_t a, size_t b) const { return (*children)[a]->doc() > (*children)[b]->doc(); }
+        };
+        Later later() const { return {&children}; }
+
+        void push(size_t i) {
+            if (children[i]->doc() == PostingCursor::END) return;
+            heap.push_back(i);
+            push_heap(heap.begin(), heap.end(), later());
+        }
+
+        void settle() {
+            atCurrent.clear();
+            current = heap.empty() ? PostingCursor::END : children[heap.front()]->doc();
+            while (!heap.empty() && children[heap.front()]->doc() == current) {
+                pop_heap(heap.begin(), heap.end(), later());
+                atCurrent.push_back(heap.back());
+                heap.pop_back();
+            }
+            sort(atCurrent.begin(), atCurrent.end()); // Suma en orden fijo: mismo puntaje siempre
+        }
+    };
+
+    // NOT fuera de un AND: todas las películas que el hijo no devuelve
+    class NotIterator : public DocIterator {
+    public:
+        NotIterator(unique_ptr<DocIterator> child, uint32_t numDocs) : child(move(child)), numDocs(numDocs) { find(0); }
+        uint32_t doc() const override { return current; }
+        void advance(uint32_t target) override {
+            if (target > current) find(target);
+        }
+        uint64_t cost() const override { return numDocs; }
+        void addStats(QueryStats &stats) const override { child->addStats(stats); }
+
+    private:
+        unique_ptr<DocIterator> child;
+        uint32_t numDocs, current = 0;
+
+        void find(uint32_t target) {
+            while (target < numDocs) {
+                child->advance(target);
+                if (child->doc() != target) break;
+                ++target;
+            }
+            current = target < numDocs ? target : PostingCursor::END;
+        }
+    };
+
+    // Convierte el árbol de la consulta en iteradores
+    unique_ptr<DocIterator> plan(const QueryNode &node) const {
+        uint32_t numDocs = (uint32_t)catalog->size();
+        switch (node.type) {
+        case QueryNode::TERM:
+        case QueryNode::PHRASE: {
+            // Una alternativa por cada análisis de los campos; casi siempre hay una sola
+            vector<unique_ptr<DocIterator>> alternatives;
+            for (QueryTerms &analysis : analyzeQuery(node.text)) {
+                alternatives.push_back(planTerms(analysis, node.exact, node.maxGap));
+            }
+            if (alternatives.size() == 1) return move(alternatives[0]);
+            return make_unique<OrIterator>(move(alternatives));
+        }
+        case QueryNode::PREFIX: {
+            // El prefijo se busca entre las formas escritas, no entre las raíces:
+            // "runni*" llega a "running" y de ahí a la palabra del índice "run"
+            vector<string> words = splitWords(node.text);
+            vector<uint32_t> terms;
+            if (words.size() == 1) {
+                for (uint32_t surface : surfacesWithPrefix(words[0])) {
+                    terms.insert(terms.end(), surfaceTerms.begin() + surfaceTermOffsets[surface],
+                                 surfaceTerms.begin() + surfaceTermOffsets[surface + 1]);
+                }
+            }
+            sort(terms.begin(), terms.end());
+            terms.erase(unique(terms.begin(), terms.end()), terms.end());
+            vector<unique_ptr<DocIterator>> children;
+            for (uint32_t term : terms) children.push_back(make_unique<TermIterator>(*this, term));
+            return make_unique<OrIterator>(move(children));
+        }
+        case QueryNode::FUZZY: {
+            vector<unique_ptr<DocIterator>> children;
+            for (const auto &queryWord : groupWrittenWords(node.text)) {
+                uint32_t distance = node.distance ? node.distance : autoDistance(queryWord.first.size());
+                for (const FuzzyTerm &match : fuzzyTerms(queryWord.first, distance)) {
+                    children.push_back(make_unique<TermIterator>(*this, match.term, fuzzyBoost(match.distance)));
+                }
+            }
+            return make_unique<OrIterator>(move(children));
+        }
+        case QueryNode::FIELD: {
+            const RoaringBitmap *bitmap = filters.find(node.attribute, node.text);
+            if (!bitmap) return make_unique<EmptyIterator>();
+            return make_unique<BitmapIterator>(bitmap);
+        }
+        case QueryNode::AND: {
+            vector<unique_ptr<DocIterator>> required, excluded;
+            for (const QueryNode &child : node.children) {
+                if (child.type == QueryNode::NOT) excluded.push_back(plan(child.children[0]));
+                else required.push_back(plan(child));
+            }
+            return make_unique<AndIterator>(move(required), move(excluded), numDocs);
+        }
+        case QueryNode::OR: {
+            vector<unique_ptr<DocIterator>> children;
+            for (const QueryNode &child : node.children) children.push_back(plan(child));
+            return make_unique<OrIterator>(move(children));
+        }
+        case QueryNode::NOT:
+            return make_unique<NotIterator>(plan(node.children[0]), numDocs);
+        default:
+            return make_unique<EmptyIterator>();
+        }
+    }
+
+    // Palabras analizadas de un término o una frase; en la frase cada palabra va en su
+    // posición relativa a la primera, contando las palabras vacías quitadas
+    unique_ptr<DocIterator> planTerms(QueryTerms &analysis, bool exact, uint32_t maxGap) const {
+        vector<string> &words = analysis.words;
+        if (!exact) {
+            sort(words.begin(), words.end());
+            words.erase(unique(words.begin(), words.end()), words.end());
+        }
+        vector<uint32_t> terms, offsets;
+        for (size_t i = 0; i < words.size(); ++i) {
+            uint32_t term = findTerm(words[i]);
+            if (term == UINT32_MAX) return make_unique<EmptyIterator>();
+            terms.push_back(term);
+            offsets.push_back(exact ? analysis.positions[i] - analysis.positions[0] : (uint32_t)i);
+        }
+        if (terms.empty()) return make_unique<EmptyIterator>();
+        if (terms.size() == 1) return make_unique<TermIterator>(*this, terms[0]);
+        return make_unique<PhraseIterator>(*this, terms, offsets, exact, maxGap);
+    }
+
+    SearchResults runQuery(const QueryNode &root, const RoaringBitmap *allowed, QueryStats *stats) const {
+        if (root.type == QueryNode::EMPTY) return SearchResults();
+        if (!frozen) {
+            cerr << "Las consultas booleanas y las frases requieren un Trie congelado" << endl;
+            return SearchResults();
+        }
+        unique_ptr<DocIterator> it = plan(root);
+        if (allowed) {
+            vector<unique_ptr<DocIterator>> required;
+            required.push_back(move(it));
+            required.push_back(make_unique<BitmapIterator>(allowed));
+            it = make_unique<AndIterator>(move(required), vector<unique_ptr<DocIterator>>(), (uint32_t)catalog->size());
+        }
+        vector<SearchResult> result;
+        for (; it->doc() != PostingCursor::END; it->next()) {
+            result.push_back({it->doc(), it->score()});
+        }
+        if (stats) it->addStats(*stats);
+        return SearchResults(move(result));
+    }
+
+    SearchResults positionalSearch(const string &text, bool exact, uint32_t maxGap, const RoaringBitmap *allowed) const {
+        QueryNode node;
+        node.type = QueryNode::PHRASE;
+        node.text = text;
+        node.exact = exact;
+        node.maxGap = maxGap;
+        return runQuery(node, allowed, nullptr);
+    }
+
+    // Primer índice >= from con list[i] >= target, con saltos exponenciales
+    static size_t gallop(const vector<uint32_t> &list, size_t from, uint32_t target) {
+        size_t bound = 1;
+        while (from + bound < list.size() && list[from + bound] < target) bound *= 2;
+        auto first = list.begin() + min(from + bound / 2, list.size());
+        auto last = list.begin() + min(from + bound + 1, list.size());
+        return lower_bound(first, last, target) - list.begin();
+    }
+
+    // Veces que aparece la frase: p en la primera palabra, p + offsets[i] en la i-ésima
+    static uint32_t countPhrase(const vector<vector<uint32_t>> &positions, const vector<uint32_t> &offsets) {
+        vector<size_t> next(positions.size(), 0);
+        uint32_t matches = 0;
+        for (uint32_t start : positions[0]) {
+            bool found = true;
+            for (size_t i = 1; found && i < positions.size(); ++i) {
+                next[i] = gallop(positions[i], next[i], start + offsets[i]);
+                if (next[i] == positions[i].size()) return matches;
+                found = positions[i][next[i]] == start + offsets[i];
+            }
+            matches += found;
+        }
+        return matches;
+    }
+
+    // Ventanas mínimas que contienen todas las palabras y miden a lo más maxSpan
+    // (distancia entre la primera y la última posición)
+    static uint32_t countWindows(const vector<vector<uint32_t>> &positions, uint32_t maxSpan) {
+        vector<size_t> next(positions.size(), 0);
+        uint32_t matches = 0;
+        while (true) {
+            size_t lowest = 0;
+            uint32_t highest = 0;
+            for (size_t i = 0; i < positions.size(); ++i) {
+                uint32_t position = positions[i][next[i]];
+                if (position < positions[lowest][next[lowest]]) lowest = i;
+                highest = max(highest, position);
+            }
+            if (highest - positions[lowest][next[lowest]] <= maxSpan) ++matches;
+            if (++next[lowest] == positions[lowest].size()) return matches;
+        }
+    }
+
+    // allowed: películas permitidas por un filtro, nullptr si no hay filtro.
+    // stats: estadísticas de todos los segmentos, nullptr para usar las propias.
+    SearchResults search(const string &query, const RoaringBitmap *allowed,
+                         const CollectionStats *stats = nullptr) const {
+        ScoreAccumulator &accumulator = ScoreAccumulator::local(catalog->size());
+        for (const auto &queryWord : groupQueryWords(query)) {
+            const string &word = queryWord.first;
+            double weight = queryWord.second * idf(word, docFrequency(word), stats);
+            forEachPosting(word, [&](uint32_t doc, double freq) {
+                accumulator.add(doc, weight * tfScore(freq, lengthNorm(doc))); // Aporte BM25 de la palabra
+            });
+        }
+
+        vector<SearchResult> result;
+        result.reserve(accumulator.docs().size());
+        for (uint32_t doc : accumulator.docs()) {
+            if (allowed && !allowed->contains(doc)) continue;
+            result.push_back({doc, accumulator.score(doc)});
+        }
+        accumulator.clear();
+        return SearchResults(move(result));
+    }
+
+    // Las k películas con mayor puntaje BM25, sin puntuar todas las coincidencias.
+    // Usa Block-Max WAND: una película solo se evalúa si la suma de las cotas de
+    // sus palabras puede superar al k-ésimo mejor puntaje encontrado hasta ahora.
+    vector<SearchResult> searchTopK(const string &query, size_t k, const RoaringBitmap *allowed,
+                                    const CollectionStats *stats = nullptr) const {
+        if (!frozen) {
+            return search(query, allowed, stats).top(k);
+        }
+        return searchTopK(weightedTerms(query, stats), k, allowed);
+    }
+
+    // Palabra del índice congelado y su peso en la consulta
+    struct WeightedTerm {
+        uint32_t term;
+        double weight; // idf por repeticiones de la palabra en la consulta
+    };
+
+    // Palabras de la consulta que están en el índice, en el orden de groupQueryWords
+    vector<WeightedTerm> weightedTerms(const string &query, const CollectionStats *stats) const {
+        vector<WeightedTerm> terms;
+        for (const auto &queryWord : groupQueryWords(query)) {
+            uint32_t term = findTerm(queryWord.first);
+            if (term == UINT32_MAX) continue;
+            terms.push_back({term, queryWord.second * idf(queryWord.first, postings.terms[term].doc_freq, stats)});
+        }
+        return terms;
+    }
+
+    // Block-Max WAND sobre palabras ya buscadas; los aportes se suman en el orden de terms
+    vector<SearchResult> searchTopK(const vector<WeightedTerm> &terms, size_t k, const RoaringBitmap *allowed) const {
+        if (k == 0) return {};
+
+        struct TermCursor {
+            PostingCursor cursor;
+            double weight; // idf por repeticiones de la palabra en la consulta
+            double upper;  // Cota superior del aporte de la palabra
+            size_t index;  // Posición de la palabra en terms
+        };
+        vector<TermCursor> cursors;
+        cursors.reserve(terms.size());
+        for (const WeightedTerm &term : terms) {
+            cursors.push_back({PostingCursor(&postings, term.term), term.weight, 0, cursors.size()});
+            TermCursor &c = cursors.back();
+            c.upper = c.weight * c.cursor.maxScore();
+        }
+        vector<double> contributions(cursors.size());
+        vector<TermCursor *> order;
+        for (auto &c : cursors) order.push_back(&c);
+
+        // Montículo de los k mejores; en la cima queda el peor (menor puntaje, mayor doc)
+        auto better = [](const pair<double, uint32_t> &a, const pair<double, uint32_t> &b) {
+            return a.first > b.first || (a.first == b.first && a.second < b.second);
+        };
+        priority_queue<pair<double, uint32_t>, vector<pair<double, uint32_t>>, decltype(better)> heap(better);
+        double threshold = -1;
+
+        while (true) {
+            sort(order.begin(), order.end(), [](const TermCursor *a, const TermCursor *b) {
+                return a->cursor.doc() < b->cursor.doc();
+            });
+
+            // Pivote: primera película en la que la suma de cotas supera el umbral
+            size_t pivotIndex = order.size();
+            double bound = 0;
+            for (size_t i = 0; i < order.size() && order[i]->cursor.doc() != PostingCursor::END; ++i) {
+                bound += order[i]->upper;
+                if (bound > threshold) {
+                    pivotIndex = i;
+                    break;
+                }
+            }
+            if (pivotIndex == order.size()) break;
+            uint32_t pivot = order[pivotIndex]->cursor.doc();
+            while (pivotIndex + 1 < order.size() && order[pivotIndex + 1]->cursor.doc() == pivot) ++pivotIndex;
+
+            // Cotas por bloque: si ni los bloques que contienen al pivote alcanzan,
+            // se salta hasta el final del bloque más corto
+            double blockBound = 0;
+            uint32_t blockEnd = PostingCursor::END;
+            for (size_t i = 0; i <= pivotIndex; ++i) {
+                uint32_t lastDoc;
+                blockBound += order[i]->weight * order[i]->cursor.blockMaxScore(pivot, lastDoc);
+                blockEnd = min(blockEnd, lastDoc);
+            }
+            if (blockBound <= threshold) {
+                uint32_t target = blockEnd == PostingCursor::END ? PostingCursor::END : blockEnd + 1;
+                if (pivotIndex + 1 < order.size()) target = min(target, order[pivotIndex + 1]->cursor.doc());
+                for (size_t i = 0; i <= pivotIndex; ++i) order[i]->cursor.advance(target);
+                continue;
+            }
+
+            if (allowed && !allowed->contains(pivot)) {
+                // El pivote no pasa el filtro: se salta a la siguiente película permitida
+                uint32_t target = allowed->nextValue(pivot);
+                for (size_t i = 0; i <= pivotIndex; ++i) order[i]->cursor.advance(target);
+                continue;
+            }
+
+            if (order[0]->cursor.doc() == pivot) {
+                // Se suma en el mismo orden que search() para obtener exactamente el mismo puntaje
+                fill(contributions.begin(), contributions.end(), 0.0);
+                double norm = lengthNorm(pivot);
+                for (size_t i = 0; i <= pivotIndex; ++i) {
+                    contributions[order[i]->index] = order[i]->weight * tfScore(weightedFreq(order[i]->cursor), norm);
+                    order[i]->cursor.next();
+                }
+                double score = 0;
+                for (double contribution : contributions) {
+                    score += contribution;
+                }
+                if (heap.size() < k) {
+                    heap.emplace(score, pivot);
+                } else if (score > threshold) {
+                    heap.pop();
+                    heap.emplace(score, pivot);
+                }
+                if (heap.size() == k) threshold = heap.top().first;
+            } else {
+                for (size_t i = 0; i < pivotIndex && order[i]->cursor.doc() < pivot; ++i) {
+                    order[i]->cursor.advance(pivot);
+                }
+            }
+        }
+
+        vector<pair<double, uint32_t>> best;
+        while (!heap.empty()) {
+            best.push_back(heap.top());
+            heap.pop();
+        }
+        vector<SearchResult> result;
+        for (auto it = best.rbegin(); it != best.rend(); ++it) {
+            result.push_back({it->second, it->first});
+        }
+        return result;
+    }
+
+    // Llama a fn(palabra, posición, campo, escrita) por cada palabra que se indexa de la
+    // película, ya analizada. Posiciones: el título empieza en 0, la sinopsis una
+    // posición después del título y los tags después de la sinopsis, también con una
+    // posición libre antes de cada tag, así una frase no queda unida entre dos campos
+    // o dos tags. Las palabras vacías quitadas por el análisis no se indexan, pero sí
+    // ocupan su posición. Los tags son textos cortos como los títulos y se analizan
+    // igual que ellos. fn recibe también la palabra tal como estaba escrita (plegada,
+    // antes del análisis) y no debe usar Tokenizer::local().
+    template <typename F>
+    void forEachIndexedWord(const Movie &movie, F &&fn) const {
+        Tokenizer &tokenizer = Tokenizer::local();
+        thread_local WrittenWords written;
+        const vector<string_view> &titleWritten = written.copy(tokenizer.split(movie.title()));
+        const vector<string_view> &titleWords = Analyzer::analyze(titleAnalysis, tokenizer);
+        size_t titleLength = titleWords.size();
+        for (size_t i = 0; i < titleLength; ++i) {
+            if (!titleWords[i].empty()) fn(titleWords[i], (uint32_t)i, Field::TITLE, titleWritten[i]);
+        }
+        const vector<string_view> &synopsisWritten = written.copy(tokenizer.split(movie.plot_synopsis()));
+        const vector<string_view> &synopsisWords = Analyzer::analyze(synopsisAnalysis, tokenizer);
+        for (size_t i = 0; i < synopsisWords.size(); ++i) {
+            if (synopsisWords[i].empty()) continue;
+            fn(synopsisWords[i], (uint32_t)(titleLength + 1 + i), Field::SYNOPSIS, synopsisWritten[i]);
+        }
+        size_t position = titleLength + 1 + synopsisWords.size();
+        for (const string &tag : TagIndex::splitTags(movie.tags())) {
+            const vector<string_view> &tagWritten = written.copy(tokenizer.split(tag));
+            const vector<string_view> &tagWords = Analyzer::analyze(titleAnalysis, tokenizer);
+            for (size_t i = 0; i < tagWords.size(); ++i) {
+                if (!tagWords[i].empty()) fn(tagWords[i], (uint32_t)(position + 1 + i), Field::TAGS, tagWritten[i]);
+            }
+            position += 1 + tagWords.size();
+        }
+    }
+
+    // Copia de las palabras que acaba de separar el tokenizador, porque el análisis
+    // las reescribe en su mismo búfer. Se reutiliza entre películas.
+    struct WrittenWords {
+        string text;
+        vector<string_view> words;
+
+        const vector<string_view> &copy(const vector<string_view> &tokens) {
+            size_t total = 0;
+            for (string_view token : tokens) total += token.size();
+            text.resize(total);
+            words.clear();
+            size_t offset = 0;
+            for (string_view token : tokens) {
+                memcpy(&text[offset], token.data(), token.size());
+                words.emplace_back(text.data() + offset, token.size());
+                offset += token.size();
+            }
+            return words;
+        }
+    };
+
+    // Indexa la película doc del catálogo. El largo para BM25 cuenta solo las
+    // palabras indexadas.
+    void indexMovie(uint32_t doc) {
+        Movie movie = (*catalog)[doc];
+        uint32_t numWords = indexWords(root, *arena, doc);
+        docLengths.push_back(numWords);
+        lengths = docLengths;
+        totalLength += numWords;
+        tagIndex.add(doc, movie.tags());
+        indexAttributes(doc, movie);
+    }
+
+    // Agrega las palabras de la película doc al árbol de node (el Trie o un sub-Trie,
+    // con sus nodos nuevos en nodeArena) y devuelve cuántas son
+    uint32_t indexWords(TrieNode *node, BuildArena &nodeArena, uint32_t doc) const {
+        uint32_t numWords = 0;
+        forEachIndexedWord((*catalog)[doc], [&](string_view word, uint32_t position, Field field, string_view written) {
+            insertWord(node, nodeArena, word, doc, position, field, written);
+            ++numWords;
+        });
+        return numWords;
+    }
+
+    // Une los sub-Tries de a pares, en paralelo, hasta que queda uno, que pasa a ser el
+    // Trie. Cada unión solo toca los dos árboles que une (y sus arenas), así las de un
+    // mismo paso no se cruzan.
+    void mergeShards(vector<Shard> &shards) {
+        for (size_t step = 1; step < shards.size(); step *= 2) {
+            vector<thread> workers;
+            for (size_t i = 0; i + step < shards.size(); i += 2 * step) {
+                workers.emplace_back([&, i]() { mergeNode(shards[i].root, shards[i + step].root); });
+            }
+            for (auto &worker : workers) worker.join();
+        }
+        root = shards[0].root;
+        arena = move(shards[0].arena);
+        for (size_t i = 1; i < shards.size(); ++i) shardArenas.push_back(move(shards[i].arena));
+    }
+
+    // Une from (la misma palabra en un tramo posterior de películas) en into. Las
+    // películas de from son todas mayores, así que sus apariciones van al final y
+    // las listas siguen ordenadas por doc. Los hijos se unen por etiqueta como dos
+    // listas ordenadas; los que solo están en from se adoptan enteros, sin copiarlos.
+    static void mergeNode(TrieNode *into, TrieNode *from) {
+        into->movies_with_word.insert(into->movies_with_word.end(), from->movies_with_word.begin(),
+                                      from->movies_with_word.end());
+        into->positions.insert(into->positions.end(), from->positions.begin(), from->positions.end());
+        into->written = into->written || from->written;
+        if (!into->surfaces) {
+            into->surfaces = from->surfaces; // El arena de from vive hasta congelar
+        } else {
+            forEachSurface(from->surfaces, [&](string_view surface) {
+                if (!hasSurface(into->surfaces, surface)) addSurface(*into->surfaces, surface);
+            });
+        }
+        if (from->children.empty()) return;
+        pmr::vector<pair<unsigned char, TrieNode *>> merged(into->children.get_allocator());
+        merged.reserve(into->children.size() + from->children.size());
+        auto a = into->children.begin(), b = from->children.begin();
+        while (a != into->children.end() || b != from->children.end()) {
+            if (b == from->children.end() || (a != into->children.end() && a->first < b->first)) {
+                merged.push_back(*a++);
+            } else if (a == into->children.end() || b->first < a->first) {
+                merged.push_back(*b++);
+            } else {
+                mergeNode(a->second, b->second);
+                merged.push_back(*a++);
+                ++b;
+            }
+        }
+        into->children.swap(merged);
+    }
+
+    // Las marcas (liked, watch_later) no son parte de la película: se agregan con setFlag
+    void indexAttributes(uint32_t doc, const Movie &movie) {
+        filters.add("split", movie.split(), doc);
+        filters.add("source", movie.synopsis_source(), doc);
+        for (const string &tag : TagIndex::splitTags(movie.tags())) {
+            filters.add("tag", tag, doc);
+        }
+    }
+
+    static TrieNode *newNode(BuildArena &arena) {
+        void *memory = arena.chunks.allocate(sizeof(TrieNode), alignof(TrieNode));
+        return new (memory) TrieNode(&arena.pools);
+    }
+
+    // Los nodos no se destruyen: toda su memoria (hijos y listas incluidos) es del arena.
+    // glibc no devuelve al sistema los huecos que quedan en medio del heap: se piden aparte.
+    void releaseArena() {
+        root = nullptr;
+        arena.reset();
+        shardArenas.clear();
+#ifdef __GLIBC__
+        malloc_trim(0);
+#endif
+    }
+
+    static TrieNode *childOf(const TrieNode *node, unsigned char label) {
+        auto it = lower_bound(node->children.begin(), node->children.end(), label,
+                              [](const pair<unsigned char, TrieNode *> &child, unsigned char l) { return child.first < l; });
+        return it != node->children.end() && it->first == label ? it->second : nullptr;
+    }
+
+    static void insertWord(TrieNode *node, BuildArena &nodeArena, string_view word, uint32_t doc, uint32_t position,
+                           Field field, string_view written) {
+        for (char ch : word) {
+            unsigned char label = (unsigned char)tolower((unsigned char)ch);
+            auto &children = node->children;
+            auto it = lower_bound(children.begin(), children.end(), label,
+                                  [](const pair<unsigned char, TrieNode *> &child, unsigned char l) { return child.first < l; });
+            if (it == children.end() || it->first != label) {
+                it = children.insert(it, {label, newNode(nodeArena)});
+            }
+            node = it->second;
+        }
+        pmr::vector<Posting> &list = node->movies_with_word;
+        if (list.empty() || list.back().doc != doc) list.push_back({doc, 0, 0, 0});
+        list.back().freq++;
+        if (field == Field::TITLE) list.back().titleFreq++;
+        if (field == Field::TAGS) list.back().tagFreq++;
+        node->positions.push_back(position);
+        if (written == word) {
+            node->written = true;
+        } else if (!hasSurface(node->surfaces, written)) {
+            if (!node->surfaces) {
+                void *memory = nodeArena.chunks.allocate(sizeof(pmr::vector<char>), alignof(pmr::vector<char>));
+                node->surfaces = new (memory) pmr::vector<char>(&nodeArena.pools);
+            }
+            addSurface(*node->surfaces, written);
+        }
+    }
+
+    // Recorre las formas de TrieNode::surfaces
+    template <typename F>
+    static void forEachSurface(const pmr::vector<char> *surfaces, F &&fn) {
+        if (!surfaces) return;
+        for (size_t i = 0; i < surfaces->size();) {
+            size_t length = (unsigned char)(*surfaces)[i] | (size_t)(unsigned char)(*surfaces)[i + 1] << 8;
+            fn(string_view(surfaces->data() + i + 2, length));
+            i += 2 + length;
+        }
+    }
+
+    static bool hasSurface(const pmr::vector<char> *surfaces, string_view surface) {
+        bool found = false;
+        forEachSurface(surfaces, [&](string_view other) { found = found || other == surface; });
+        return found;
+    }
+
+    // Las formas de más de 65535 bytes no se guardan
+    static void addSurface(pmr::vector<char> &surfaces, string_view surface) {
+        if (surface.size() > 0xFFFF) return;
+        surfaces.push_back((char)(surface.size() & 0xFF));
+        surfaces.push_back((char)(surface.size() >> 8));
+        surfaces.insert(surfaces.end(), surface.begin(), surface.end());
+    }
+
+    double idf(uint32_t docFreq) const { return idf(docFreq, catalog->size()); }
+
+    static double idf(uint64_t docFreq, uint64_t numDocs) {
+        return log(1.0 + (numDocs - docFreq + 0.5) / (docFreq + 0.5));
+    }
+
+    // idf de word con las estadísticas de todos los segmentos, si las hay
+    double idf(const string &word, uint32_t docFreq, const CollectionStats *stats) const {
+        if (!stats) return idf(docFreq);
+        auto it = stats->docFreq.find(word);
+        return idf(it == stats->docFreq.end() ? docFreq : it->second, stats->numDocs);
+    }
+
+    // Parte de BM25 que depende del largo de la película
+    double lengthNorm(uint32_t doc) const {
+        double avgLength = catalog->empty() ? 1.0 : max(1.0, (double)totalLength / catalog->size());
+        return BM25_K1 * (1.0 - BM25_B + BM25_B * lengths[doc] / avgLength);
+    }
+
+    // freq puede ser la frecuencia ponderada por campo
+    static double tfScore(double freq, double norm) {
+        return freq * (BM25_K1 + 1.0) / (freq + norm);
+    }
+
+    // Frecuencia de la palabra con el peso de cada campo
+    double weightedFreq(uint32_t freq, uint32_t titleFreq, uint32_t tagFreq) const {
+        return (double)boosts.title * titleFreq + (double)boosts.tags * tagFreq +
+               (double)boosts.synopsis * (freq - titleFreq - tagFreq);
+    }
+
+    double weightedFreq(const PostingCursor &cursor) const {
+        return weightedFreq(cursor.freq(), cursor.freq(Field::TITLE), cursor.freq(Field::TAGS));
+    }
+
+    // Palabras distintas de la consulta con sus repeticiones, en orden alfabético.
+    // search() y searchTopK() suman los aportes en este orden. Si los campos se
+    // analizan distinto, una palabra cuenta con las repeticiones de su mejor análisis.
+    vector<pair<string, int>> groupQueryWords(const string &query) const {
+        map<string, int> grouped;
+        for (const QueryTerms &analysis : analyzeQuery(query)) {
+            map<string, int> counts;
+            for (const string &word : analysis.words) counts[word]++;
+            for (const auto &count : counts) grouped[count.first] = max(grouped[count.first], count.second);
+        }
+        return vector<pair<string, int>>(grouped.begin(), grouped.end());
+    }
+
+    // Palabras de un texto de consulta tal como quedan en el índice y su posición en
+    // el texto. Hay una lista por cada análisis distinto entre los campos: si el
+    // título conserva las palabras vacías y la sinopsis no, "the end" da ["the", "end"]
+    // para buscar en los títulos y ["end"] para las sinopsis.
+    vector<QueryTerms> analyzeQuery(string_view text) const {
+        vector<QueryTerms> result;
+        Tokenizer &tokenizer = Tokenizer::local();
+        for (const FieldAnalysis *field : {&titleAnalysis, &synopsisAnalysis}) {
+            tokenizer.split(text);
+            QueryTerms terms;
+            const vector<string_view> &words = Analyzer::analyze(*field, tokenizer);
+            for (size_t i = 0; i < words.size(); ++i) {
+                if (words[i].empty()) continue;
+                terms.words.emplace_back(words[i]);
+                terms.positions.push_back((uint32_t)i);
+            }
+            if (find(result.begin(), result.end(), terms) == result.end()) result.push_back(move(terms));
+        }
+        return result;
+    }
+
+    uint32_t docFrequency(const string &word) const {
+        if (frozen) {
+            uint32_t term = findTerm(word);
+            return term == UINT32_MAX ? 0 : postings.terms[term].doc_freq;
+        }
+        const TrieNode *node = findNode(word);
+        return node ? (uint32_t)node->movies_with_word.size() : 0;
+    }
+
+    vector<uint32_t> searchWord(const string &word) const {
+        vector<uint32_t> result;
+        forEachPosting(word, [&](uint32_t doc, double) { result.push_back(doc); });
+        return result;
+    }
+
+    // Llama a fn(doc, freq) por cada película que contiene la palabra, en orden de doc.
+    // freq es la frecuencia ponderada por el peso de cada campo.
+    template <typename F>
+    void forEachPosting(const string &word, F &&fn) const {
+        if (frozen) {
+            uint32_t term = findTerm(word);
+            if (term == UINT32_MAX) return;
+            for (PostingCursor cursor(&postings, term); cursor.doc() != PostingCursor::END; cursor.next()) {
+                fn(cursor.doc(), weightedFreq(cursor));
+            }
+            return;
+        }
+        const TrieNode *node = findNode(word);
+        if (!node) return;
+        for (const Posting &posting : node->movies_with_word) {
+            fn(posting.doc, weightedFreq(posting.freq, posting.titleFreq, posting.tagFreq));
+        }
+    }
+
+    const TrieNode *findNode(const string &word) const {
+        const TrieNode *node = root;
+        for (char ch : word) {
+            node = childOf(node, (unsigned char)tolower((unsigned char)ch));
+            if (!node) {
+                return nullptr;
+            }
+        }
+        return node;
+    }
+
+    // Las palabras se reparten en FREEZE_PARTS tramos seguidos; cada tramo se procesa
+    // entero en un hilo y los resultados se juntan en el orden de los tramos, así no
+    // dependen de cuántos hilos hubo
+    static constexpr size_t FREEZE_PARTS = 64;
+
+    // Comprime las listas de las palabras: cada tramo en su propio PostingStore, que
+    // después se agregan en orden. Los tramos se cortan por cantidad de apariciones,
+    // porque unas pocas palabras frecuentes tienen la mayoría.
+    void compressPostings(const vector<const TrieNode *> &termNodes, unsigned numThreads) {
+        size_t totalPostings = 0;
+        for (const TrieNode *node : termNodes) totalPostings += node->movies_with_word.size();
+        vector<size_t> cuts = {0};
+        for (size_t term = 0, seen = 0; term < termNodes.size(); ++term) {
+            seen += termNodes[term]->movies_with_word.size();
+            if (seen * FREEZE_PARTS >= totalPostings * cuts.size()) cuts.push_back(term + 1);
+        }
+        if (cuts.back() != termNodes.size()) cuts.push_back(termNodes.size());
+        vector<PostingStore> parts(cuts.size() - 1);
+        parallelFor(parts.size(), numThreads, [&](size_t part) {
+            for (size_t term = cuts[part]; term < cuts[part + 1]; ++term) {
+                const TrieNode *node = termNodes[term];
+                parts[part].add(node->movies_with_word, node->positions, [&](const Posting &posting) {
+                    return tfScore(weightedFreq(posting.freq, posting.titleFreq, posting.tagFreq), lengthNorm(posting.doc));
+                });
+            }
+        });
+        for (const PostingStore &part : parts) postingStorage.append(part);
+    }
+
+    // Largo del vector TF-IDF de cada película, para que las similitudes sean cosenos,
+    // y el mayor peso de cada palabra en esos vectores, para podar en similarMovies.
+    // Cada tramo de palabras suma sus cuadrados aparte y las sumas se juntan en orden.
+    void buildSimilarityNorms(unsigned numThreads) {
+        size_t numTerms = postings.terms.size();
+        vector<vector<double>> squares(FREEZE_PARTS);
+        parallelFor(FREEZE_PARTS, numThreads, [&](size_t part) {
+            squares[part].assign(catalog->size(), 0.0);
+            for (size_t term = numTerms * part / FREEZE_PARTS; term < numTerms * (part + 1) / FREEZE_PARTS; ++term) {
+                double termIdf = idf(postings.terms[term].doc_freq);
+                for (PostingCursor cursor(&postings, (uint32_t)term); cursor.doc() != PostingCursor::END; cursor.next()) {
+                    double weight = log1p(weightedFreq(cursor)) * termIdf;
+                    squares[part][cursor.doc()] += weight * weight;
+                }
+            }
+        });
+        similarityNormStorage.resize(catalog->size());
+        for (size_t doc = 0; doc < catalog->size(); ++doc) {
+            double sum = 0;
+            for (const vector<double> &part : squares) sum += part[doc];
+            similarityNormStorage[doc] = (float)sqrt(sum);
+        }
+        similarityNorms = similarityNormStorage;
+        similarityBoundStorage.assign(numTerms, 0.0f);
+        parallelFor(numTerms, numThreads, [&](size_t term) {
+            double termIdf = idf(postings.terms[term].doc_freq);
+            for (PostingCursor cursor(&postings, (uint32_t)term); cursor.doc() != PostingCursor::END; cursor.next()) {
+                double weight = log1p(weightedFreq(cursor)) * termIdf / similarityNorms[cursor.doc()];
+                // Redondeo hacia arriba, como las cotas de los bloques
+                similarityBoundStorage[term] = max(similarityBoundStorage[term], nextafterf((float)weight, INFINITY));
+            }
+        }, 256);
+    }
+
+    // Formas de las palabras, juntadas al indexar en los nodos de cada palabra. Una
+    // forma lleva a más de una palabra si los campos se analizan distinto. Se numeran
+    // de la mejor a la peor: más películas (las de su palabra del índice con más
+    // películas), más corta y orden alfabético, así comparar dos formas es comparar
+    // sus números.
+    void buildSurfaceDictionary(const vector<const TrieNode *> &termNodes) {
+        vector<pair<string, uint32_t>> pairs; // (forma, palabra del índice)
+        for (uint32_t term = 0; term < termNodes.size(); ++term) {
+            if (termNodes[term]->written) pairs.emplace_back(termWord(term), term);
+            forEachSurface(termNodes[term]->surfaces, [&](string_view surface) { pairs.emplace_back(surface, term); });
+        }
+        sort(pairs.begin(), pairs.end());
+        pairs.erase(unique(pairs.begin(), pairs.end()), pairs.end());
+
+        struct Surface {
+            string word;
+            vector<uint32_t> terms;
+        };
+        vector<Surface> surfaces;
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            if (i == 0 || pairs[i].first != pairs[i - 1].first) surfaces.push_back({move(pairs[i].first), {}});
+            surfaces.back().terms.push_back(pairs[i].second);
+        }
+        vector<pair<string, uint32_t>>().swap(pairs);
+        for (Surface &surface : surfaces) {
+            sort(surface.terms.begin(), surface.terms.end(), [&](uint32_t a, uint32_t b) { return betterCompletion(a, b); });
+        }
+        sort(surfaces.begin(), surfaces.end(), [&](const Surface &a, const Surface &b) {
+            uint32_t dfA = postings.terms[a.terms[0]].doc_freq, dfB = postings.terms[b.terms[0]].doc_freq;
+            if (dfA != dfB) return dfA > dfB;
+            if (a.word.size() != b.word.size()) return a.word.size() < b.word.size();
+            return a.word < b.word;
+        });
+        for (const Surface &surface : surfaces) {
+            surfaceTextOffsetStorage.push_back((uint32_t)surfaceTextStorage.size());
+            surfaceTextStorage += surface.word;
+            surfaceTermOffsetStorage.push_back((uint32_t)surfaceTermStorage.size());
+            surfaceTermStorage.insert(surfaceTermStorage.end(), surface.terms.begin(), surface.terms.end());
+        }
+        surfaceTextOffsetStorage.push_back((uint32_t)surfaceTextStorage.size());
+        surfaceTermOffsetStorage.push_back((uint32_t)surfaceTermStorage.size());
+
+        // Trie de las formas en orden por niveles, como el del índice: cada nodo
+        // corresponde a un tramo de las formas ordenadas alfabéticamente que comparten
+        // los primeros depth bytes, y sus hijos son los subtramos por el byte siguiente
+        vector<uint32_t> byWord(surfaces.size());
+        for (uint32_t i = 0; i < byWord.size(); ++i) byWord[i] = i;
+        sort(byWord.begin(), byWord.end(), [&](uint32_t a, uint32_t b) { return surfaces[a].word < surfaces[b].word; });
+        struct Range {
+            uint32_t begin, end, depth;
+        };
+        vector<Range> ranges = {{0, (uint32_t)byWord.size(), 0}};
+        surfaceNodeStorage.emplace_back();
+        surfaceLabelStorage.push_back(0);
+        for (size_t node = 0; node < ranges.size(); ++node) {
+            Range range = ranges[node];
+            uint32_t i = range.begin;
+            if (i < range.end && surfaces[byWord[i]].word.size() == range.depth) surfaceNodeStorage[node].term = byWord[i++];
+            surfaceNodeStorage[node].first_child = (uint32_t)surfaceNodeStorage.size();
+            while (i < range.end) {
+                unsigned char label = (unsigned char)surfaces[byWord[i]].word[range.depth];
+                uint32_t j = i;
+                while (j < range.end && (unsigned char)surfaces[byWord[j]].word[range.depth] == label) ++j;
+                ranges.push_back({i, j, range.depth + 1});
+                surfaceNodeStorage.emplace_back();
+                surfaceLabelStorage.push_back(label);
+                i = j;
+            }
+            surfaceNodeStorage[node].num_children = (uint32_t)surfaceNodeStorage.size() - surfaceNodeStorage[node].first_child;
+        }
+        surfaceNodes = surfaceNodeStorage;
+        surfaceLabels = surfaceLabelStorage;
+        surfaceText = ArrayView<char>(surfaceTextStorage.data(), surfaceTextStorage.size());
+        surfaceTextOffsets = surfaceTextOffsetStorage;
+        surfaceTermOffsets = surfaceTermOffsetStorage;
+        surfaceTerms = surfaceTermStorage;
+    }
+
+    // Caché de autocompletado sobre el Trie de las formas: recorre los nodos de abajo
+    // hacia arriba (en orden por niveles los hijos siempre están después del padre) y
+    // combina las cachés de los hijos. Como cada caché ya tiene la mejor forma de cada
+    // palabra del índice de su subárbol, juntarlas y quedarse con la primera forma de
+    // cada palabra da lo mismo que recorrer todo el subárbol.
+    void buildCompletionCache() {
+        size_t numNodes = surfaceNodeStorage.size();
+        vector<uint32_t> start(numNodes), length(numNodes), lists, candidates;
+        for (size_t i = numNodes; i-- > 0;) {
+            const FlatTrieNode &node = surfaceNodeStorage[i];
+            candidates.clear();
+            if (node.term != UINT32_MAX) candidates.push_back(node.term);
+            for (uint32_t c = node.first_child; c < node.first_child + node.num_children; ++c) {
+                candidates.insert(candidates.end(), lists.begin() + start[c], lists.begin() + start[c] + length[c]);
+            }
+            sort(candidates.begin(), candidates.end());
+            start[i] = (uint32_t)lists.size();
+            length[i] = (uint32_t)keepBestSurfaces(candidates, COMPLETION_CACHE);
+            lists.insert(lists.end(), candidates.begin(), candidates.begin() + length[i]);
+        }
+        completionOffsetStorage.resize(numNodes + 1);
+        completionTermStorage.reserve(lists.size());
+        for (size_t i = 0; i < numNodes; ++i) {
+            completionOffsetStorage[i] = (uint32_t)completionTermStorage.size();
+            completionTermStorage.insert(completionTermStorage.end(), lists.begin() + start[i],
+                                         lists.begin() + start[i] + length[i]);
+        }
+        completionOffsetStorage[numNodes] = (uint32_t)completionTermStorage.size();
+    }
+
+    // Nodo del Trie congelado al que lleva word, UINT32_MAX si no existe
+    uint32_t findFlatNode(const string &word) const { return findFlatNode(flatNodes, flatLabels, word); }
+
+    // Lo mismo en otro Trie con la misma representación (el de las formas)
+    static uint32_t findFlatNode(ArrayView<FlatTrieNode> nodes, ArrayView<unsigned char> labels, const string &word) {
+        uint32_t node = 0;
+        for (char ch : word) {
+            unsigned char label = (unsigned char)tolower((unsigned char)ch);
+            const FlatTrieNode &current = nodes[node];
+            auto first = labels.begin() + current.first_child;
+            auto last = first + current.num_children;
+            auto it = lower_bound(first, last, label);
+            if (it == last || *it != label) {
+                return UINT32_MAX;
+            }
+            node = (uint32_t)(it - labels.begin());
+        }
+        return node;
+    }
+
+    // Todas las formas que empiezan con prefix, en ningún orden en particular
+    vector<uint32_t> surfacesWithPrefix(const string &prefix) const {
+        vector<uint32_t> result;
+        uint32_t start = findFlatNode(surfaceNodes, surfaceLabels, prefix);
+        vector<uint32_t> pending;
+        if (start != UINT32_MAX) pending.push_back(start);
+        while (!pending.empty()) {
+            const FlatTrieNode &current = surfaceNodes[pending.back()];
+            pending.pop_back();
+            if (current.term != UINT32_MAX) result.push_back(current.term);
+            for (uint32_t c = 0; c < current.num_children; ++c) pending.push_back(current.first_child + c);
+        }
+        return result;
+    }
+
+    // Las n mejores completaciones de prefix, una forma por palabra del índice
+    vector<uint32_t> completeSurfaces(const string &prefix, size_t n) const {
+        vector<uint32_t> surfaces;
+        if (!frozen) return surfaces;
+        if (n <= COMPLETION_CACHE) {
+            uint32_t node = findFlatNode(surfaceNodes, surfaceLabels, prefix);
+            if (node == UINT32_MAX) return surfaces;
+            uint32_t begin = completionOffsets[node], end = completionOffsets[node + 1];
+            surfaces.assign(completionTerms.begin() + begin, completionTerms.begin() + min<size_t>(end, begin + n));
+        } else {
+            // Más de lo que guarda la caché: se recorre todo el subárbol
+            surfaces = surfacesWithPrefix(prefix);
+            sort(surfaces.begin(), surfaces.end());
+            surfaces.resize(keepBestSurfaces(surfaces, n));
+        }
+        return surfaces;
+    }
+
+    // Deja al principio de surfaces (ordenadas de mejor a peor) hasta n formas, solo
+    // la primera de cada palabra del índice, y devuelve cuántas quedaron
+    size_t keepBestSurfaces(vector<uint32_t> &surfaces, size_t n) const {
+        size_t kept = 0;
+        for (size_t i = 0; i < surfaces.size() && kept < n; ++i) {
+            uint32_t term = primaryTerm(surfaces[i]);
+            auto same = [&](uint32_t other) { return primaryTerm(other) == term; };
+            if (none_of(surfaces.begin(), surfaces.begin() + kept, same)) surfaces[kept++] = surfaces[i];
+        }
+        return kept;
+    }
+
+    // Palabra del índice con más películas de la forma
+    uint32_t primaryTerm(uint32_t surface) const { return surfaceTerms[surfaceTermOffsets[surface]]; }
+
+    string surfaceWord(uint32_t surface) const {
+        return string(surfaceText.data() + surfaceTextOffsets[surface],
+                      surfaceTextOffsets[surface + 1] - surfaceTextOffsets[surface]);
+    }
+
+    static constexpr double FUZZY_PENALTY = 0.5; // Peso por cada edición
+
+    static double fuzzyBoost(uint32_t distance) { return pow(FUZZY_PENALTY, distance); }
+
+    struct FuzzyTerm {
+        uint32_t term;
+        uint32_t distance;
+    };
+
+    struct FuzzySurface {
+        uint32_t surface;
+        uint32_t distance;
+    };
+
+    // Recorre el Trie de formas escritas en profundidad junto con el autómata de
+    // Levenshtein de word; un nodo cuyo estado ya no puede aceptar nada no se expande.
+    // Las formas quedan de la más cercana a la más lejana y, a igual distancia, de la
+    // mejor a la peor, como en el autocompletado.
+    vector<FuzzySurface> fuzzySurfaces(const string &word, uint32_t maxDistance, size_t *visitedNodes = nullptr) const {
+        vector<FuzzySurface> result;
+        if (!frozen) {
+            cerr << "La búsqueda tolerante a errores requiere un Trie congelado" << endl;
+            return result;
+        }
+        LevenshteinAutomaton automaton(word, maxDistance);
+        vector<pair<uint32_t, LevenshteinAutomaton::State>> pending = {{0, automaton.start()}};
+        size_t visited = 0;
+        while (!pending.empty()) {
+            uint32_t node = pending.back().first;
+            LevenshteinAutomaton::State state = pending.back().second;
+            pending.pop_back();
+            ++visited;
+            const FlatTrieNode &current = surfaceNodes[node];
+            if (current.term != UINT32_MAX) {
+                uint32_t distance = automaton.distance(state);
+                if (distance != UINT32_MAX) result.push_back({current.term, distance});
+            }
+            for (uint32_t c = 0; c < current.num_children; ++c) {
+                uint32_t child = current.first_child + c;
+                LevenshteinAutomaton::State next = automaton.step(state, surfaceLabels[child]);
+                if (automaton.canMatch(next)) pending.emplace_back(child, next);
+            }
+        }
+        if (visitedNodes) *visitedNodes += visited;
+        sort(result.begin(), result.end(), [](const FuzzySurface &a, const FuzzySurface &b) {
+            if (a.distance != b.distance) return a.distance < b.distance;
+            return a.surface < b.surface;
+        });
+        if (result.size() > FUZZY_EXPANSIONS) result.resize(FUZZY_EXPANSIONS);
+        return result;
+    }
+
+    // Palabras del índice de las formas parecidas a word, cada una con la distancia de
+    // su forma más cercana: "runnin" llega a "running" y de ahí a "run"
+    vector<FuzzyTerm> fuzzyTerms(const string &word, uint32_t maxDistance) const {
+        vector<FuzzyTerm> result;
+        for (const FuzzySurface &match : fuzzySurfaces(word, maxDistance)) {
+            for (uint32_t i = surfaceTermOffsets[match.surface]; i < surfaceTermOffsets[match.surface + 1]; ++i) {
+                uint32_t term = surfaceTerms[i];
+                auto same = [&](const FuzzyTerm &other) { return other.term == term; };
+                if (none_of(result.begin(), result.end(), same)) result.push_back({term, match.distance});
+            }
+        }
+        if (result.size() > FUZZY_EXPANSIONS) result.resize(FUZZY_EXPANSIONS);
+        return result;
+    }
+
+    // Palabras de la consulta tal como están escritas (plegadas, sin análisis) que
+    // algún campo indexa, con sus repeticiones y en orden alfabético. Los errores de
+    // tipeo se buscan en estas y no en las raíces: "runnin" no tiene la raíz de
+    // "running", pero está a una edición de la palabra escrita.
+    vector<pair<string, int>> groupWrittenWords(const string &query) const {
+        vector<string> words = splitWords(query);
+        vector<bool> indexed(words.size(), false);
+        Tokenizer &tokenizer = Tokenizer::local();
+        for (const FieldAnalysis *field : {&titleAnalysis, &synopsisAnalysis}) {
+            tokenizer.split(query);
+            const vector<string_view> &analyzed = Analyzer::analyze(*field, tokenizer);
+            for (size_t i = 0; i < analyzed.size(); ++i) {
+                if (!analyzed[i].empty()) indexed[i] = true;
+            }
+        }
+        map<string, int> grouped;
+        for (size_t i = 0; i < words.size(); ++i) {
+            if (indexed[i]) grouped[words[i]]++;
+        }
+        return vector<pair<string, int>>(grouped.begin(), grouped.end());
+    }
+
+    SearchResults searchFuzzy(const string &query, uint32_t maxDistance, const RoaringBitmap *allowed) const {
+        ScoreAccumulator &accumulator = ScoreAccumulator::local(catalog->size());
+        for (const auto &queryWord : groupWrittenWords(query)) {
+            uint32_t distance = maxDistance == AUTO_DISTANCE ? autoDistance(queryWord.first.size()) : maxDistance;
+            for (const FuzzyTerm &match : fuzzyTerms(queryWord.first, distance)) {
+                double weight = queryWord.second * fuzzyBoost(match.distance) * idf(postings.terms[match.term].doc_freq);
+                for (PostingCursor cursor(&postings, match.term); cursor.doc() != PostingCursor::END; cursor.next()) {
+                    accumulator.add(cursor.doc(), weight * tfScore(weightedFreq(cursor), lengthNorm(cursor.doc())));
+                }
+            }
+        }
+
+        vector<SearchResult> result;
+        result.reserve(accumulator.docs().size());
+        for (uint32_t doc : accumulator.docs()) {
+            if (allowed && !allowed->contains(doc)) continue;
+            result.push_back({doc, accumulator.score(doc)});
+        }
+        accumulator.clear();
+        return SearchResults(move(result));
+    }
+
+    uint32_t findTerm(const string &word) const {
+        uint32_t node = findFlatNode(word);
+        return node == UINT32_MAX ? UINT32_MAX : flatNodes[node].term;
+    }
+
+    string termWord(uint32_t term) const {
+        return string(termText.data() + termOffsets[term], termOffsets[term + 1] - termOffsets[term]);
+    }
+
+    // Mejor completación primero: más películas y, a igualdad, menor término
+    // (el orden por niveles deja primero las palabras cortas y luego el orden alfabético)
+    bool betterCompletion(uint32_t a, uint32_t b) const {
+        uint32_t dfA = postings.terms[a].doc_freq, dfB = postings.terms[b].doc_freq;
+        return dfA > dfB || (dfA == dfB && a < b);
+    }
+};
+
+// Algoritmo de relevancia para filtrar y ordenar resultados
+// Usa un montículo acotado a topN en vez de ordenar todos los resultados
+vector<SearchResult> getTopRelevantMovies(const vector<SearchResult> &movies, int topN = 5) {
+    size_t k = min((size_t)max(topN, 0), movies.size());
+    // Con betterResult como comparador, la cima del montículo es el peor de los k mejores
+    auto worse = [](const SearchResult *a, const SearchResult *b) { return betterResult(*a, *b); };
+    vector<const SearchResult *> heap;
+    heap.reserve(k);
+    for (const SearchResult &movie : movies) {
+        if (heap.size() < k) {
+            heap.push_back(&movie);
+            push_heap(heap.begin(), heap.end(), worse);
+        } else if (k > 0 && betterResult(movie, *heap.front())) {
+            pop_heap(heap.begin(), heap.end(), worse);
+            heap.back() = &movie;
+            push_heap(heap.begin(), heap.end(), worse);
+        }
+    }
+    sort_heap(heap.begin(), heap.end(), worse);
+
+    vector<SearchResult> sortedMovies;
+    sortedMovies.reserve(k);
+    for (const SearchResult *movie : heap) {
+        sortedMovies.push_back(*movie);
+    }
+    return sortedMovies;
+}
+
+// Las topN películas más relevantes para una consulta, sin puntuar ni ordenar todas las coincidencias
+vector<SearchResult> getTopRelevantMovies(const Trie &trie, const string &query, int topN = 5) {
+    return trie.searchTopK(query, topN);
+}
+
+// Índice HNSW (Hierarchical Navigable Small World) para "más como esta" sobre todo
+// el catálogo. Cada película es un vector denso de DIMENSIONS floats de largo 1: su
+// vector TF-IDF (Trie::termVector) reducido con una proyección aleatoria, donde cada
+// palabra suma o resta su peso en cada dimensión según los bits de un hash de su
+// número. El producto punto aproxima el coseno de los vectores TF-IDF.
+// El grafo tiene niveles: todas las películas están en el nivel 0 y cada una sube a
+// los siguientes con probabilidad 1 / MAX_LINKS. Una búsqueda baja por los niveles
+// de forma voraz y en el nivel 0 explora los ef mejores candidatos, así compara con
+// unos pocos cientos de películas en vez de con todas; a cambio, el resultado puede
+// no ser exacto (ver --bench-hnsw).
+// Los enlaces de cada película ocupan un bloque fijo de un solo arreglo (por nivel,
+// la cantidad de vecinos y los vecinos), así el índice se guarda y se mapea como el
+// snapshot del Trie.
+class HnswIndex {
+public:
+    static constexpr uint32_t DIMENSIONS = 128;
+    static constexpr uint32_t MAX_LINKS = 16;                  // Vecinos por nivel arriba del 0
+    static constexpr uint32_t MAX_LINKS_BASE = 2 * MAX_LINKS;  // Vecinos en el nivel 0
+    static constexpr uint32_t MAX_LEVEL = 15;
+    static constexpr size_t EF_CONSTRUCTION = 100;
+    static constexpr size_t EF_SEARCH = 64;
+
+    // Producto punto de dos vectores de DIMENSIONS floats, con SSE2 o AVX2 según lo
+    // que tenga el procesador (la misma detección que el tokenizador)
+    static float dot(const float *a, const float *b) { return dot(a, b, Tokenizer::bestKernel()); }
+
+    static float dot(const float *a, const float *b, Tokenizer::Kernel kernel) {
+        switch (kernel) {
+#ifdef HAVE_AVX2
+        case Tokenizer::AVX2:
+            return dotAVX2(a, b);
+#endif
+#ifdef HAVE_SSE2
+        case Tokenizer::SSE2:
+            return dotSSE2(a, b);
+#endif
+        default:
+            return dotScalar(a, b);
+        }
+    }
+
+    // Calcula los vectores de las películas del Trie congelado y construye el grafo,
+    // insertando las películas desde numThreads hilos (0: uno por núcleo)
+    void build(const Trie &trie, unsigned numThreads = 0) {
+        if (!trie.isFrozen()) {
+            cerr << "El índice HNSW requiere un Trie congelado" << endl;
+            return;
+        }
+        if (numThreads == 0) numThreads = max(1u, thread::hardware_concurrency());
+        size_t numMovies = trie.allMovies().size();
+        vectorStorage.assign(numMovies * DIMENSIONS, 0.0f);
+        embed(trie);
+        vectors = vectorStorage;
+        snapshot.reset();
+        buildGraph(numThreads);
+    }
+
+    // Las k películas con mayor producto punto con query (de DIMENSIONS floats).
+    // ef es cuántos candidatos se exploran en el nivel 0: más es más lento y más exacto.
+    vector<SearchResult> search(const float *query, size_t k, size_t ef = EF_SEARCH) const {
+        if (size() == 0 || k == 0) return {};
+        uint32_t entry = entryPoint;
+        float best = dot(query, embedding(entry));
+        for (uint32_t level = maxLevel; level > 0; --level) {
+            entry = greedyStep(query, entry, best, level, nullptr);
+        }
+        vector<SearchResult> results;
+        for (const Candidate &candidate : searchLevel(query, entry, max(ef, k), 0, nullptr)) {
+            if (results.size() == k) break;
+            results.push_back({candidate.node, candidate.similarity});
+        }
+        return results;
+    }
+
+    // Las k películas más parecidas al conjunto docs, sin incluirlas: se busca el
+    // promedio de sus vectores
+    vector<SearchResult> similarTo(const vector<uint32_t> &docs, size_t k, size_t ef = EF_SEARCH) const {
+        float query[DIMENSIONS] = {};
+        for (uint32_t doc : docs) {
+            if (doc >= size()) continue;
+            const float *point = embedding(doc);
+            for (uint32_t d = 0; d < DIMENSIONS; ++d) query[d] += point[d];
+        }
+        if (!normalize(query)) return {};
+        vector<SearchResult> results = search(query, k + docs.size(), max(ef, k + docs.size()));
+        results.erase(remove_if(results.begin(), results.end(),
+                                [&](const SearchResult &result) {
+                                    return find(docs.begin(), docs.end(), result.doc) != docs.end();
+                                }),
+                      results.end());
+        if (results.size() > k) results.resize(k);
+        return results;
+    }
+
+    const float *embedding(uint32_t doc) const { return vectors.data() + (size_t)doc * DIMENSIONS; }
+
+    size_t size() const { return linkOffsets.empty() ? 0 : linkOffsets.size() - 1; }
+
+    size_t memoryBytes() const {
+        return vectors.size() * sizeof(float) + (linkOffsets.size() + links.size()) * sizeof(uint32_t);
+    }
+
+    // Guarda el índice en su propio archivo, con el mismo formato y la misma firma
+    // del CSV que el snapshot del Trie
+    bool save(const string &path, const string &sourceCSV) const {
+        uint32_t stats[4] = {DIMENSIONS, MAX_LINKS, entryPoint, maxLevel};
+        SnapshotWriter writer;
+        writer.add(SECTION_HNSW_STATS, stats, sizeof(stats));
+        writer.add(SECTION_HNSW_VECTORS, vectors);
+        writer.add(SECTION_HNSW_LINK_OFFSETS, linkOffsets);
+        writer.add(SECTION_HNSW_LINKS, links);
+        return writer.write(path, SourceFingerprint::of(sourceCSV));
+    }
+
+    // Mapea un índice guardado con save. Devuelve false si no existe, está corrupto,
+    // el CSV cambió o no tiene numMovies películas.
+    bool load(const string &path, const string &sourceCSV, size_t numMovies) {
+        SnapshotReader reader;
+        if (!reader.open(path, SourceFingerprint::of(sourceCSV))) return false;
+        ArrayView<uint32_t> stats = reader.view<uint32_t>(SECTION_HNSW_STATS);
+        if (stats.size() != 4 || stats[0] != DIMENSIONS || stats[1] != MAX_LINKS || numMovies == 0) return false;
+        ArrayView<float> mappedVectors = reader.view<float>(SECTION_HNSW_VECTORS);
+        ArrayView<uint32_t> mappedOffsets = reader.view<uint32_t>(SECTION_HNSW_LINK_OFFSETS);
+        ArrayView<uint32_t> mappedLinks = reader.view<uint32_t>(SECTION_HNSW_LINKS);
+        if (mappedVectors.size() != numMovies * DIMENSIONS || mappedOffsets.size() != numMovies + 1 ||
+            mappedOffsets[0] != 0 || mappedOffsets[numMovies] != mappedLinks.size() || stats[2] >= numMovies) {
+            return false;
+        }
+        // Cada bloque debe tener el tamaño de un nivel entero y vecinos válidos
+        for (size_t node = 0; node < numMovies; ++node) {
+            uint32_t begin = mappedOffsets[node], end = mappedOffsets[node + 1];
+            if (end < begin || end - begin < MAX_LINKS_BASE + 1 || (end - begin - MAX_LINKS_BASE - 1) % (MAX_LINKS + 1)) {
+                return false;
+            }
+            uint32_t capacity = MAX_LINKS_BASE;
+            for (uint32_t block = begin; block < end; block += capacity + 1, capacity = MAX_LINKS) {
+                if (mappedLinks[block] > capacity) return false;
+                for (uint32_t i = 1; i <= mappedLinks[block]; ++i) {
+                    if (mappedLinks[block + i] >= numMovies) return false;
+                }
+            }
+        }
+        uint32_t entry = stats[2];
+        if ((mappedOffsets[entry + 1] - mappedOffsets[entry] - MAX_LINKS_BASE - 1) / (MAX_LINKS + 1) != stats[3]) {
+            return false;
+        }
+        vectors = mappedVectors;
+        linkOffsets = mappedOffsets;
+        links = mappedLinks;
+        entryPoint = stats[2];
+        maxLevel = stats[3];
+        vectorStorage.clear();
+        linkOffsetStorage.clear();
+        linkStorage.clear();
+        snapshot = reader.mapping();
+        return true;
+    }
+
+private:
+    ArrayView<float> vectors;        // DIMENSIONS floats por película
+    ArrayView<uint32_t> linkOffsets; // Inicio del bloque de enlaces de cada película
+    ArrayView<uint32_t> links;       // Por nivel: cantidad de vecinos y los vecinos
+    vector<float> vectorStorage;
+    vector<uint32_t> linkOffsetStorage, linkStorage;
+    uint32_t entryPoint = 0; // Película del nivel más alto, donde empiezan las búsquedas
+    uint32_t maxLevel = 0;
+    shared_ptr<const MappedFile> snapshot;
+
+    struct Candidate {
+        float similarity;
+        uint32_t node;
+        bool operator<(const Candidate &other) const { return similarity < other.similarity; }
+        bool operator>(const Candidate &other) const { return similarity > other.similarity; }
+    };
+
+    // Mientras se construye, cada película tiene su mutex para leer y cambiar sus
+    // enlaces, y entryLock protege el punto de entrada y el nivel máximo
+    struct BuildLocks {
+        unique_ptr<mutex[]> nodes;
+        mutex entryLock;
+    };
+
+    // Películas ya visitadas en una búsqueda. Cada hilo reutiliza la suya: en vez de
+    // limpiarla se usa una marca nueva por búsqueda.
+    class VisitedSet {
+    public:
+        static VisitedSet &local(size_t numNodes) {
+            thread_local VisitedSet visited;
+            if (visited.marks.size() < numNodes) {
+                visited.marks.assign(numNodes, 0);
+                visited.mark = 0;
+            }
+            if (++visited.mark == 0) {
+                fill(visited.marks.begin(), visited.marks.end(), 0);
+                visited.mark = 1;
+            }
+            return visited;
+        }
+
+        // false si ya estaba
+        bool insert(uint32_t node) {
+            if (marks[node] == mark) return false;
+            marks[node] = mark;
+            return true;
+        }
+
+    private:
+        vector<uint32_t> marks;
+        uint32_t mark = 0;
+    };
+
+    static float dotScalar(const float *a, const float *b) {
+        float sums[4] = {0, 0, 0, 0};
+        for (uint32_t d = 0; d < DIMENSIONS; d += 4) {
+            for (uint32_t i = 0; i < 4; ++i) sums[i] += a[d + i] * b[d + i];
+        }
+        return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    }
+
+#ifdef HAVE_SSE2
+    static float dotSSE2(const float *a, const float *b) {
+        __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+        for (uint32_t d = 0; d < DIMENSIONS; d += 8) {
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + d), _mm_loadu_ps(b + d)));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + d + 4), _mm_loadu_ps(b + d + 4)));
+        }
+        return horizontalSum(_mm_add_ps(sum0, sum1));
+    }
+
+    static float horizontalSum(__m128 sum) {
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum);
+    }
+#endif
+
+#ifdef HAVE_AVX2
+    TARGET_AVX2 static float dotAVX2(const float *a, const float *b) {
+        __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+        for (uint32_t d = 0; d < DIMENSIONS; d += 16) {
+            sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(a + d), _mm256_loadu_ps(b + d)));
+            sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(a + d + 8), _mm256_loadu_ps(b + d + 8)));
+        }
+        __m256 sum = _mm256_add_ps(sum0, sum1);
+        return horizontalSum(_mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1)));
+    }
+#endif
+
+    // Deja el vector con largo 1; false si es todo ceros
+    static bool normalize(float *point) {
+        double norm = 0;
+        for (uint32_t d = 0; d < DIMENSIONS; ++d) norm += (double)point[d] * point[d];
+        if (norm == 0) return false;
+        float scale = (float)(1.0 / sqrt(norm));
+        for (uint32_t d = 0; d < DIMENSIONS; ++d) point[d] *= scale;
+        return true;
+    }
+
+    // Bits de la proyección aleatoria de una palabra (splitmix64)
+    static uint64_t projectionBits(uint64_t seed) {
+        uint64_t z = seed * 0x9e3779b97f4a7c15ULL + 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // Proyecta los vectores TF-IDF recorriendo las listas una sola vez, sin volver a
+    // separar el texto de cada película
+    void embed(const Trie &trie) {
+        uint32_t lastTerm = UINT32_MAX;
+        uint64_t bits[DIMENSIONS / 64];
+        trie.forEachTermWeight([&](uint32_t term, uint32_t doc, float weight) {
+            if (term != lastTerm) {
+                for (uint32_t word = 0; word < DIMENSIONS / 64; ++word) {
+                    bits[word] = projectionBits((uint64_t)term * (DIMENSIONS / 64) + word);
+                }
+                lastTerm = term;
+            }
+            float *out = vectorStorage.data() + (size_t)doc * DIMENSIONS;
+            for (uint32_t d = 0; d < DIMENSIONS; ++d) out[d] += (bits[d / 64] >> (d % 64) & 1) ? weight : -weight;
+        });
+        for (size_t doc = 0; doc < vectorStorage.size() / DIMENSIONS; ++doc) {
+            normalize(vectorStorage.data() + doc * DIMENSIONS);
+        }
+    }
+
+    uint32_t levelOf(uint32_t node) const {
+        return (linkOffsets[node + 1] - linkOffsets[node] - (MAX_LINKS_BASE + 1)) / (MAX_LINKS + 1);
+    }
+
+    static size_t levelStart(uint32_t level) {
+        return level == 0 ? 0 : MAX_LINKS_BASE + 1 + (size_t)(level - 1) * (MAX_LINKS + 1);
+    }
+
+    // Copia a out los vecinos de node en level; al construir, con el mutex de node tomado
+    uint32_t copyLinks(uint32_t node, uint32_t level, uint32_t *out, BuildLocks *locks) const {
+        const uint32_t *block = links.data() + linkOffsets[node] + levelStart(level);
+        unique_lock<mutex> guard;
+        if (locks) guard = unique_lock<mutex>(locks->nodes[node]);
+        uint32_t count = block[0];
+        copy(block + 1, block + 1 + count, out);
+        return count;
+    }
+
+    // Avanza desde entry al vecino más parecido mientras alguno mejore
+    uint32_t greedyStep(const float *query, uint32_t entry, float &best, uint32_t level, BuildLocks *locks) const {
+        uint32_t neighbors[MAX_LINKS_BASE];
+        for (bool improved = true; improved;) {
+            improved = false;
+            uint32_t count = copyLinks(entry, level, neighbors, locks);
+            for (uint32_t i = 0; i < count; ++i) {
+                float similarity = dot(query, embedding(neighbors[i]));
+                if (similarity > best) {
+                    best = similarity;
+                    entry = neighbors[i];
+                    improved = true;
+                }
+            }
+        }
+        return entry;
+    }
+
+    // Los ef candidatos más parecidos a query en level, de mejor a peor
+    vector<Candidate> searchLevel(const float *query, uint32_t entry, size_t ef, uint32_t level,
+                                  BuildLocks *locks) const {
+        VisitedSet &visited = VisitedSet::local(size());
+        priority_queue<Candidate> frontier;                                    // Mejor arriba
+        priority_queue<Candidate, vector<Candidate>, greater<Candidate>> best; // Peor arriba
+        visited.insert(entry);
+        Candidate start = {dot(query, embedding(entry)), entry};
+        frontier.push(start);
+        best.push(start);
+        uint32_t neighbors[MAX_LINKS_BASE];
+        while (!frontier.empty()) {
+            Candidate current = frontier.top();
+            if (best.size() >= ef && current.similarity < best.top().similarity) break;
+            frontier.pop();
+            uint32_t count = copyLinks(current.node, level, neighbors, locks);
+            for (uint32_t i = 0; i < count; ++i) {
+                if (!visited.insert(neighbors[i])) continue;
+                Candidate next = {dot(query, embedding(neighbors[i])), neighbors[i]};
+                if (best.size() < ef || next.similarity > best.top().similarity) {
+                    frontier.push(next);
+                    best.push(next);
+                    if (best.size() > ef) best.pop();
+                }
+            }
+        }
+        vector<Candidate> result(best.size());
+        for (size_t i = result.size(); i-- > 0; best.pop()) result[i] = best.top();
+        return result;
+    }
+
+    // Heurística de HNSW: de los candidatos (de mejor a peor) se queda con uno solo si
+    // es más parecido al punto que a los ya elegidos, así los vecinos apuntan en
+    // direcciones distintas y el grafo no queda partido en grupos
+    vector<uint32_t> selectNeighbors(const vector<Candidate> &candidates, uint32_t count) const {
+        vector<uint32_t> selected;
+        for (const Candidate &candidate : candidates) {
+            if (selected.size() == count) break;
+            bool diverse = true;
+            for (uint32_t other : selected) {
+                if (dot(embedding(candidate.node), embedding(other)) > candidate.similarity) {
+                    diverse = false;
+                    break;
+                }
+            }
+            if (diverse) selected.push_back(candidate.node);
+        }
+        return selected;
+    }
+
+    uint32_t *mutableLinks(uint32_t node, uint32_t level) {
+        return linkStorage.data() + linkOffsetStorage[node] + levelStart(level);
+    }
+
+    void buildGraph(unsigned numThreads) {
+        size_t numNodes = vectors.size() / DIMENSIONS;
+        // El nivel de cada película se sortea antes, así cada bloque de enlaces
+        // tiene su lugar fijo y los hilos no tienen que agrandar nada
+        mt19937_64 rng(42);
+        uniform_real_distribution<double> uniform(0.0, 1.0);
+        double scale = 1.0 / log((double)MAX_LINKS);
+        linkOffsetStorage.assign(1, 0);
+        for (size_t node = 0; node < numNodes; ++node) {
+            uint32_t level = (uint32_t)min(-log(1.0 - uniform(rng)) * scale, (double)MAX_LEVEL);
+            linkOffsetStorage.push_back(linkOffsetStorage.back() + MAX_LINKS_BASE + 1 + level * (MAX_LINKS + 1));
+        }
+        linkStorage.assign(linkOffsetStorage.back(), 0);
+        linkOffsets = linkOffsetStorage;
+        links = linkStorage;
+        if (numNodes == 0) return;
+
+        entryPoint = 0;
+        maxLevel = levelOf(0);
+        BuildLocks locks;
+        locks.nodes = make_unique<mutex[]>(numNodes);
+        parallelFor(numNodes - 1, numThreads, [&](size_t i) { insertNode((uint32_t)(i + 1), locks); }, 64);
+    }
+
+    void insertNode(uint32_t node, BuildLocks &locks) {
+        uint32_t level = levelOf(node);
+        // Quien va a quedar en un nivel nuevo conserva el lock hasta ser el punto de entrada
+        unique_lock<mutex> entryGuard(locks.entryLock);
+        uint32_t entry = entryPoint, top = maxLevel;
+        if (level <= top) entryGuard.unlock();
+
+        const float *point = embedding(node);
+        float best = dot(point, embedding(entry));
+        for (uint32_t l = top; l > level; --l) {
+            entry = greedyStep(point, entry, best, l, &locks);
+        }
+        for (uint32_t l = min(level, top) + 1; l-- > 0;) {
+            vector<Candidate> candidates = searchLevel(point, entry, EF_CONSTRUCTION, l, &locks);
+            // Otro hilo pudo enlazar ya esta película
+            candidates.erase(remove_if(candidates.begin(), candidates.end(),
+                                       [&](const Candidate &c) { return c.node == node; }),
+                             candidates.end());
+            if (candidates.empty()) continue;
+            vector<uint32_t> neighbors = selectNeighbors(candidates, MAX_LINKS);
+            {
+                lock_guard<mutex> guard(locks.nodes[node]);
+                uint32_t *block = mutableLinks(node, l);
+                block[0] = (uint32_t)neighbors.size();
+                copy(neighbors.begin(), neighbors.end(), block + 1);
+            }
+            for (uint32_t neighbor : neighbors) connect(neighbor, node, l, locks);
+            entry = candidates.front().node;
+        }
+        if (entryGuard.owns_lock()) {
+            entryPoint = node;
+            maxLevel = level;
+        }
+    }
+
+    // Agrega node a los vecinos de from; si ya no caben se vuelven a elegir con la heurística
+    void connect(uint32_t from, uint32_t node, uint32_t level, BuildLocks &locks) {
+        lock_guard<mutex> guard(locks.nodes[from]);
+        uint32_t *block = mutableLinks(from, level);
+        uint32_t capacity = level == 0 ? MAX_LINKS_BASE : MAX_LINKS;
+        if (find(block + 1, block + 1 + block[0], node) != block + 1 + block[0]) return;
+        if (block[0] < capacity) {
+            block[1 + block[0]++] = node;
+            return;
+        }
+        const float *point = embedding(from);
+        vector<Candidate> candidates = {{dot(point, embedding(node)), node}};
+        for (uint32_t i = 1; i <= block[0]; ++i) {
+            candidates.push_back({dot(point, embedding(block[i])), block[i]});
+        }
+        sort(candidates.begin(), candidates.end(), greater<Candidate>());
+        vector<uint32_t> kept = selectNeighbors(candidates, capacity);
+        block[0] = (uint32_t)kept.size();
+        copy(kept.begin(), kept.end(), block + 1);
+    }
+};
+
+// Índice por segmentos, al estilo LSM, para agregar, actualizar y borrar películas
+// sin reconstruir todo. Las películas nuevas van a la memtable: un Trie sin congelar
+// al que se agregan de a una (cuesta lo que indexar esa película) y que se busca con
+// la estructura de punteros. Al llegar a MEMTABLE_MOVIES se congela y queda como un
+// segmento más, que ya no cambia. Los borrados se anotan como lápidas en un mapa de
+// bits por segmento, y un hilo de fondo une segmentos (ver nextMerge) para que sean
+// pocos y no acumulen lápidas. Cada película tiene un número global que no cambia al
+// actualizarla ni al unir segmentos; las del Trie inicial conservan su número.
+//
+// Las búsquedas se hacen sobre una vista (View): una foto de los segmentos, sus
+// lápidas y cuántas películas de la memtable había, que se reemplaza en cada cambio,
+// así que nunca ven un cambio a medias. La memtable es lo único que cambia debajo de
+// una vista: se lee con su candado compartido, que solo espera a que termine de
+// indexarse una película. Los puntajes usan el idf de todos los segmentos juntos
+// (contando las películas con lápida hasta que una unión las saca); el largo
+// promedio de BM25 es el de cada segmento, porque las cotas de Block-Max WAND se
+// calcularon con él al congelar.
+class SegmentedIndex {
+public:
+    static constexpr size_t MEMTABLE_MOVIES = 32;  // Películas de la memtable antes de sellarla
+    static constexpr size_t MERGE_FACTOR = 4;      // Ver nextMerge
+    static constexpr size_t LOCATION_CHUNK = 4096; // Números globales por bloque de ubicaciones
+    static constexpr uint64_t NO_LOCATION = UINT64_MAX;
+
+    // Segmento en memoria, compartido por las vistas. movies guarda una copia de cada
+    // película que no se mueve al agregar otras, para leerlas sin el candado.
+    struct Memtable {
+        Trie trie;
+        vector<MovieStore> movies = vector<MovieStore>(MEMTABLE_MOVIES);
+        mutable shared_mutex lock; // Compartido para buscar, exclusivo para indexar y congelar
+    };
+
+    // Un segmento y sus lápidas, tal como los ve una vista
+    struct Part {
+        shared_ptr<const Trie> trie;
+        shared_ptr<const vector<uint32_t>> ids;  // Número global de cada película visible
+        shared_ptr<const RoaringBitmap> deleted; // Lápidas; nullptr si no hay
+        shared_ptr<const RoaringBitmap> live;    // Películas visibles sin lápida; nullptr si son todas
+        shared_ptr<const Memtable> memtable;     // Solo mientras el Trie puede cambiar
+
+        size_t liveCount() const { return live ? live->cardinality() : ids->size(); }
+
+        // Solo el Trie de la memtable necesita candado para leerse
+        shared_lock<shared_mutex> readLock() const {
+            return memtable ? shared_lock<shared_mutex>(memtable->lock) : shared_lock<shared_mutex>();
+        }
+
+        Movie movie(uint32_t doc) const { return memtable ? memtable->movies[doc][0] : trie->movie(doc); }
+    };
+
+    struct View {
+        vector<Part> parts; // Del segmento más antiguo al más nuevo; el último puede ser la memtable
+        // Por número global: parte << 32 | película, NO_LOCATION si no está. Los bloques
+        // se comparten entre vistas y un cambio solo copia el bloque que toca.
+        vector<shared_ptr<const vector<uint64_t>>> locations;
+        uint32_t endId = 0; // Los números globales usados van de 0 a endId - 1
+        size_t numMovies = 0;
+
+        size_t size() const { return numMovies; }
+
+        uint64_t location(uint32_t id) const {
+            return id < endId ? (*locations[id / LOCATION_CHUNK])[id % LOCATION_CHUNK] : NO_LOCATION;
+        }
+
+        bool contains(uint32_t id) const { return location(id) != NO_LOCATION; }
+
+        // La película vale mientras se conserve la vista
+        Movie movie(uint32_t id) const {
+            uint64_t found = location(id);
+            return parts[found >> 32].movie((uint32_t)found);
+        }
+
+        // Como Trie::search, en todos los segmentos; los resultados son números globales
+        SearchResults search(const string &query, const MovieFilter &filter = {}) const {
+            CollectionStats stats = collectionStats(query);
+            vector<SearchResult> results;
+            for (const Part &part : parts) {
+                auto guard = part.readLock();
+                RoaringBitmap filtered;
+                SearchResults found = part.trie->searchSegment(query, allowedDocs(part, filter, filtered), stats);
+                for (const SearchResult &result : found.unsorted()) {
+                    results.push_back({(*part.ids)[result.doc], result.score});
+                }
+            }
+            return SearchResults(move(results));
+        }
+
+        // Las k mejores de cada segmento y, de esas, las k mejores
+        vector<SearchResult> searchTopK(const string &query, size_t k, const MovieFilter &filter = {}) const {
+            CollectionStats stats = collectionStats(query);
+            vector<SearchResult> results;
+            for (const Part &part : parts) {
+                auto guard = part.readLock();
+                RoaringBitmap filtered;
+                for (const SearchResult &result :
+                     part.trie->searchTopKSegment(query, k, allowedDocs(part, filter, filtered), stats)) {
+                    results.push_back({(*part.ids)[result.doc], result.score});
+                }
+            }
+            if (parts.size() == 1) return results;
+            return SearchResults(move(results)).top(k);
+        }
+
+    private:
+        CollectionStats collectionStats(const string &query) const {
+            CollectionStats stats;
+            for (const Part &part : parts) {
+                auto guard = part.readLock();
+                part.trie->addCollectionStats(query, stats, (uint32_t)part.ids->size());
+            }
+            return stats;
+        }
+
+        // Películas del segmento que la búsqueda puede devolver; nullptr si todas
+        static const RoaringBitmap *allowedDocs(const Part &part, const MovieFilter &filter, RoaringBitmap &filtered) {
+            if (filter.empty()) return part.live.get();
+            filtered = part.trie->filter(filter);
+            if (part.live) filtered = filtered & *part.live;
+            return &filtered;
+        }
+    };
+
+    // base: el índice congelado del catálogo inicial
+    explicit SegmentedIndex(shared_ptr<const Trie> base) {
+        settings.copySettings(*base);
+        auto ids = make_shared<vector<uint32_t>>(base->allMovies().size());
+        for (uint32_t doc = 0; doc < ids->size(); ++doc) (*ids)[doc] = doc;
+        nextId = (uint32_t)ids->size();
+        segments.push_back(makePart(move(base), move(ids), nullptr));
+        relocateAll();
+        publish();
+        merger = thread([this]() { mergeLoop(); });
+    }
+
+    SegmentedIndex(const SegmentedIndex &) = delete;
+    SegmentedIndex &operator=(const SegmentedIndex &) = delete;
+
+    // Espera a que termine la unión en curso, si hay
+    ~SegmentedIndex() {
+        {
+            lock_guard<mutex> guard(writeLock);
+            stopping = true;
+        }
+        mergeWanted.notify_all();
+        merger.join();
+    }
+
+    // Foto actual del índice para buscar; los cambios posteriores no la afectan
+    shared_ptr<const View> view() const {
+        lock_guard<mutex> guard(viewLock);
+        return current;
+    }
+
+    // Agrega una copia de la película y devuelve su número global
+    uint32_t add(const Movie &movie) {
+        MovieStore copy;
+        copyMovie(copy, movie);
+        lock_guard<mutex> guard(writeLock);
+        uint32_t id = nextId++;
+        addToMemtable(id, move(copy));
+        publish();
+        return id;
+    }
+
+    // Reemplaza la película id por una copia de movie, con el mismo número
+    bool update(uint32_t id, const Movie &movie) {
+        MovieStore copy;
+        copyMovie(copy, movie);
+        lock_guard<mutex> guard(writeLock);
+        if (!erase(id)) return false;
+        addToMemtable(id, move(copy));
+        publish();
+        return true;
+    }
+
+    bool remove(uint32_t id) {
+        lock_guard<mutex> guard(writeLock);
+        if (!erase(id)) return false;
+        publish();
+        return true;
+    }
+
+    // Espera a que el hilo de fondo no tenga nada que unir
+    void waitForMerges() {
+        unique_lock<mutex> lock(writeLock);
+        mergeIdle.wait(lock, [&]() { return !merging && isEmpty(nextMerge()); });
+    }
+
+    // Uniones hechas desde que se creó el índice
+    size_t merges() const {
+        lock_guard<mutex> guard(writeLock);
+        return mergesDone;
+    }
+
+private:
+    Trie settings; // Trie vacío con el análisis y los pesos del índice inicial
+
+    mutable mutex writeLock; // Protege todo lo de abajo salvo current
+    vector<Part> segments;   // Segmentos sellados, del más antiguo al más nuevo
+    shared_ptr<Memtable> memtable; // nullptr si no hay películas nuevas sin sellar
+    vector<uint32_t> memtableIds;
+    shared_ptr<const RoaringBitmap> memtableDeleted;
+    vector<shared_ptr<vector<uint64_t>>> locations; // Ver View::locations
+    uint32_t nextId = 0;
+    size_t numMovies = 0;
+    bool merging = false, stopping = false;
+    size_t mergesDone = 0;
+    condition_variable mergeWanted, mergeIdle;
+    thread merger;
+
+    mutable mutex viewLock; // Solo para leer y reemplazar current
+    shared_ptr<const View> current;
+
+    static bool isEmpty(pair<size_t, size_t> run) { return run.first == run.second; }
+
+    static void copyMovie(MovieStore &into, const Movie &movie) {
+        into.add(movie.imdb_id(), movie.title(), movie.plot_synopsis(), movie.tags(), movie.split(),
+                 movie.synopsis_source());
+    }
+
+    static Part makePart(shared_ptr<const Trie> trie, shared_ptr<const vector<uint32_t>> ids,
+                         shared_ptr<const RoaringBitmap> deleted) {
+        Part part{move(trie), move(ids), move(deleted), nullptr, nullptr};
+        if (part.deleted) {
+            part.live = make_shared<RoaringBitmap>(RoaringBitmap::range((uint32_t)part.ids->size()) - *part.deleted);
+        }
+        return part;
+    }
+
+    static shared_ptr<const RoaringBitmap> withTombstone(const shared_ptr<const RoaringBitmap> &deleted, uint32_t doc) {
+        auto result = make_shared<RoaringBitmap>(deleted ? *deleted : RoaringBitmap());
+        result->add(doc);
+        return result;
+    }
+
+    uint64_t locationOf(uint32_t id) const {
+        return id / LOCATION_CHUNK < locations.size() ? (*locations[id / LOCATION_CHUNK])[id % LOCATION_CHUNK]
+                                                      : NO_LOCATION;
+    }
+
+    // Copia el bloque antes de escribir si alguna vista lo comparte
+    void setLocation(uint32_t id, uint64_t location) {
+        while (locations.size() <= id / LOCATION_CHUNK) {
+            locations.push_back(make_shared<vector<uint64_t>>(LOCATION_CHUNK, NO_LOCATION));
+        }
+        shared_ptr<vector<uint64_t>> &chunk = locations[id / LOCATION_CHUNK];
+        if (chunk.use_count() > 1) chunk = make_shared<vector<uint64_t>>(*chunk);
+        (*chunk)[id % LOCATION_CHUNK] = location;
+    }
+
+    // Ubicaciones desde cero, cuando los segmentos cambian de lugar
+    void relocateAll() {
+        locations.clear();
+        numMovies = 0;
+        auto place = [&](size_t part, uint32_t doc, uint32_t id) {
+            setLocation(id, (uint64_t)part << 32 | doc);
+            ++numMovies;
+        };
+        for (size_t p = 0; p < segments.size(); ++p) {
+            const Part &part = segments[p];
+            if (part.live) part.live->forEach([&](uint32_t doc) { place(p, doc, (*part.ids)[doc]); });
+            else for (uint32_t doc = 0; doc < part.ids->size(); ++doc) place(p, doc, (*part.ids)[doc]);
+        }
+        for (uint32_t doc = 0; doc < memtableIds.size(); ++doc) {
+            if (!memtableDeleted || !memtableDeleted->contains(doc)) place(segments.size(), doc, memtableIds[doc]);
+        }
+    }
+
+    // Indexa la película en la memtable (la crea si hace falta) y la sella si se llenó
+    void addToMemtable(uint32_t id, MovieStore copy) {
+        if (!memtable) {
+            memtable = make_shared<Memtable>();
+            memtable->trie.copySettings(settings);
+        }
+        uint32_t doc = (uint32_t)memtableIds.size();
+        memtable->movies[doc] = move(copy); // Ninguna vista mira todavía esta posición
+        {
+            unique_lock<shared_mutex> guard(memtable->lock);
+            memtable->trie.insert(memtable->movies[doc][0]);
+        }
+        memtableIds.push_back(id);
+        setLocation(id, (uint64_t)segments.size() << 32 | doc);
+        ++numMovies;
+        if (memtableIds.size() == MEMTABLE_MOVIES) seal();
+    }
+
+    // La memtable llena se congela y pasa a ser el segmento más nuevo, en la misma
+    // posición, así que las ubicaciones de sus películas no cambian
+    void seal() {
+        {
+            unique_lock<shared_mutex> guard(memtable->lock);
+            memtable->trie.freeze(1);
+        }
+        segments.push_back(makePart(shared_ptr<const Trie>(memtable, &memtable->trie),
+                                    make_shared<vector<uint32_t>>(memtableIds), memtableDeleted));
+        memtable.reset();
+        memtableIds.clear();
+        memtableDeleted.reset();
+        mergeWanted.notify_one();
+    }
+
+    // Saca la película id con una lápida en su segmento o en la memtable
+    bool erase(uint32_t id) {
+        uint64_t location = locationOf(id);
+        if (location == NO_LOCATION) return false;
+        size_t part = location >> 32;
+        uint32_t doc = (uint32_t)location;
+        if (part == segments.size()) {
+            memtableDeleted = withTombstone(memtableDeleted, doc);
+        } else {
+            Part &segment = segments[part];
+            segment = makePart(segment.trie, segment.ids, withTombstone(segment.deleted, doc));
+            if (!isEmpty(nextMerge())) mergeWanted.notify_one();
+        }
+        setLocation(id, NO_LOCATION);
+        --numMovies;
+        return true;
+    }
+
+    // Publica una vista con los segmentos, la parte visible de la memtable y las
+    // ubicaciones actuales. Sin uniones cuesta lo que copiar unos punteros.
+    void publish() {
+        auto view = make_shared<View>();
+        view->parts = segments;
+        if (memtable) {
+            Part part;
+            part.trie = shared_ptr<const Trie>(memtable, &memtable->trie);
+            part.ids = make_shared<vector<uint32_t>>(memtableIds);
+            part.deleted = memtableDeleted;
+            RoaringBitmap visible = RoaringBitmap::range((uint32_t)memtableIds.size());
+            part.live = make_shared<RoaringBitmap>(memtableDeleted ? visible - *memtableDeleted : visible);
+            part.memtable = memtable;
+            view->parts.push_back(move(part));
+        }
+        while (locations.size() * LOCATION_CHUNK < nextId) {
+            locations.push_back(make_shared<vector<uint64_t>>(LOCATION_CHUNK, NO_LOCATION));
+        }
+        view->locations.assign(locations.begin(), locations.end());
+        view->endId = nextId;
+        view->numMovies = numMovies;
+        lock_guard<mutex> guard(viewLock);
+        current = move(view);
+    }
+
+    // Tramo [first, second) de segmentos sellados que conviene unir; vacío si ninguno.
+    // Un segmento con más lápidas que películas vivas se reescribe solo. Si no, se
+    // unen los del final mientras el anterior tenga a lo más MERGE_FACTOR veces las
+    // películas de los más nuevos que él: así quedan del orden de log(películas)
+    // segmentos y cada película se vuelve a indexar pocas veces.
+    pair<size_t, size_t> nextMerge() const {
+        for (size_t i = 0; i < segments.size(); ++i) {
+            if (segments[i].deleted && segments[i].deleted->cardinality() > segments[i].liveCount()) return {i, i + 1};
+        }
+        size_t end = segments.size(), first = end, newer = 0;
+        while (first > 0 && (first == end || segments[first - 1].liveCount() <= MERGE_FACTOR * newer)) {
+            newer += segments[--first].liveCount();
+        }
+        return end - first >= 2 ? make_pair(first, end) : make_pair(end, end);
+    }
+
+    // Hilo de fondo: el Trie unido se construye sin el candado, así que las
+    // búsquedas y los cambios siguen mientras tanto (los segmentos del tramo no se
+    // mueven: solo este hilo saca segmentos y los nuevos se agregan al final)
+    void mergeLoop() {
+        unique_lock<mutex> lock(writeLock);
+        while (!stopping) {
+            pair<size_t, size_t> run = nextMerge();
+            if (isEmpty(run)) {
+                merging = false;
+                mergeIdle.notify_all();
+                mergeWanted.wait(lock);
+                continue;
+            }
+            merging = true;
+            vector<Part> sources(segments.begin() + run.first, segments.begin() + run.second);
+            lock.unlock();
+
+            MovieStore movies;
+            auto ids = make_shared<vector<uint32_t>>();
+            for (const Part &source : sources) {
+                for (uint32_t doc = 0; doc < source.ids->size(); ++doc) {
+                    if (source.deleted && source.deleted->contains(doc)) continue;
+                    copyMovie(movies, source.movie(doc));
+                    ids->push_back((*source.ids)[doc]);
+                }
+            }
+            shared_ptr<Trie> trie;
+            if (!movies.empty()) {
+                trie = make_shared<Trie>();
+                trie->copySettings(settings);
+                trie->insert(move(movies), 1);
+                trie->freeze(1);
+            }
+
+            lock.lock();
+            // Lápidas que llegaron a los segmentos del tramo durante la unión
+            shared_ptr<RoaringBitmap> deleted;
+            unordered_map<uint32_t, uint32_t> position;
+            for (size_t i = 0; i < sources.size(); ++i) {
+                const Part &now = segments[run.first + i];
+                if (now.deleted == sources[i].deleted) continue;
+                if (position.empty()) {
+                    for (uint32_t doc = 0; doc < ids->size(); ++doc) position[(*ids)[doc]] = doc;
+                    deleted = make_shared<RoaringBitmap>();
+                }
+                RoaringBitmap added = sources[i].deleted ? *now.deleted - *sources[i].deleted : *now.deleted;
+                added.forEach([&](uint32_t doc) { deleted->add(position.at((*sources[i].ids)[doc])); });
+            }
+            segments.erase(segments.begin() + run.first, segments.begin() + run.second);
+            if (trie) segments.insert(segments.begin() + run.first, makePart(move(trie), move(ids), move(deleted)));
+            ++mergesDone;
+            relocateAll();
+            publish();
+        }
+        merging = false;
+        mergeIdle.notify_all();
+    }
+};
+
+// Las listas guardan números de película; el catálogo se comparte con el Trie
+class PlataformaStreaming {
+private:
+    shared_ptr<const MovieStore> catalog;
+    const Trie *index = nullptr;  // Índice del catálogo, para las recomendaciones
+    const HnswIndex *nearest = nullptr; // Vecinos aproximados, para "más como esta"
+    SegmentedIndex *live = nullptr;     // Catálogo que se puede cambiar; si está, manda sobre catalog
+    vector<uint32_t> movies;      // Películas agregadas a la plataforma
+    vector<uint32_t> watchLater;  // Películas marcadas como "Ver más tarde"
+    vector<uint32_t> likedMovies; // Películas marcadas con "Like"
+
+public:
+    explicit PlataformaStreaming(shared_ptr<const MovieStore> catalog) : catalog(move(catalog)) {}
+
+    // index debe ser el Trie congelado del mismo catálogo y vivir más que la plataforma
+    explicit PlataformaStreaming(const Trie &index) : catalog(index.sharedMovies()), index(&index) {}
+
+    // nearest debe estar construido sobre el mismo catálogo que index
+    PlataformaStreaming(const Trie &index, const HnswIndex &nearest)
+        : catalog(index.sharedMovies()), index(&index), nearest(&nearest) {}
+
+    // live debe vivir más que la plataforma; los números de película son los globales de live.
+    // Solo lo usa --bench-incremental: el programa interactivo trabaja con el Trie
+    // congelado. Con live no hay recomendaciones ni "más como esta", que necesitan el
+    // Trie congelado y el HNSW de un catálogo fijo, y una película borrada y vuelta a
+    // agregar tiene otro número, sin sus marcas.
+    explicit PlataformaStreaming(SegmentedIndex &live) : live(&live) {}
+
+    void agregarPelicula(uint32_t doc) {
+        movies.push_back(doc);
+    }
+
+    // Agrega una película nueva al catálogo por segmentos y devuelve su número
+    uint32_t agregarPelicula(const Movie &movie) {
+        if (!live) {
+            cerr << "Agregar películas requiere el catálogo por segmentos" << endl;
+            return UINT32_MAX;
+        }
+        uint32_t doc = live->add(movie);
+        movies.push_back(doc);
+        return doc;
+    }
+
+    bool actualizarPelicula(uint32_t doc, const Movie &movie) {
+        return live && live->update(doc, movie);
+    }
+
+    // Borra la película del catálogo y de las listas de la plataforma
+    bool eliminarPelicula(uint32_t doc) {
+        if (!live || !live->remove(doc)) return false;
+        for (vector<uint32_t> *lista : {&movies, &watchLater, &likedMovies}) {
+            lista->erase(std::remove(lista->begin(), lista->end(), doc), lista->end());
+        }
+        return true;
+    }
+
+    void mostrarPeliculasGuardadas() {
+        cout << "Peliculas añadidas a 'Ver más tarde':\n";
+        auto vista = vistaActual();
+        for (uint32_t doc : watchLater) {
+            if (!existe(vista, doc)) continue;
+            Movie movie = pelicula(vista, doc);
+            cout << "Titulo: " << movie.title() << "\n";
+            cout << "Sinopsis: " << movie.plot_synopsis() << "\n\n";
+        }
+    }
+
+    // Recomienda por contenido: las películas más parecidas al conjunto de las que
+    // tienen "Like" (ver Trie::similarMovies)
+    void mostrarPeliculasSimilares(size_t cantidad = 5) {
+        cout << "Películas similares a las que diste 'Like':\n";
+        if (likedMovies.empty()) return;
+        if (!index || !index->isFrozen()) {
+            cerr << "Las recomendaciones requieren el índice congelado del catálogo" << endl;
+            return;
+        }
+        for (const SearchResult &similar : index->similarMovies(likedMovies, cantidad)) {
+            Movie movie = (*catalog)[similar.doc];
+            cout << "Titulo: " << movie.title() << " (similitud " << similar.score << ")\n";
+            cout << "Sinopsis: " << movie.plot_synopsis() << "\n\n";
+        }
+    }
+
+    // "Más como esta": las películas más cercanas a doc en el índice HNSW
+    void mostrarPeliculasParecidas(uint32_t doc, size_t cantidad = 5) {
+        auto vista = vistaActual();
+        if (!existe(vista, doc)) return;
+        cout << "Películas parecidas a " << pelicula(vista, doc).title() << ":\n";
+        if (!nearest || !catalog || nearest->size() != catalog->size()) {
+            cerr << "\"Más como esta\" requiere el índice HNSW del catálogo" << endl;
+            return;
+        }
+        for (const SearchResult &similar : nearest->similarTo({doc}, cantidad)) {
+            Movie movie = (*catalog)[similar.doc];
+            cout << "Titulo: " << movie.title() << " (similitud " << similar.score << ")\n";
+            cout << "Sinopsis: " << movie.plot_synopsis() << "\n\n";
+        }
+    }
+
+    void mostrarResultadosBusqueda(SearchResults &results, int offset) {
+        int limite = 5;
+        int start = offset * limite;
+        vector<SearchResult> pagina = results.page(offset, limite);
+        int end = start + (int)pagina.size();
+
+        cout << "Mostrando peliculas " << start + 1 << " a " << end << ":\n";
+        auto vista = vistaActual();
+        for (int i = start; i < end; i++) {
+            if (!existe(vista, pagina[i - start].doc)) continue;
+            Movie movie = pelicula(vista, pagina[i - start].doc);
+            cout << i + 1 << ". Título: " << movie.title() << "\n";
+            cout << "Sinopsis: " << movie.plot_synopsis() << "\n";
+            cout << "Relevance Score: " << pagina[i - start].score << "\n";
+            cout << "-----------------------" << "\n\n";
+        }
+    }
+
+    void marcarLike(uint32_t doc) {
+        likedMovies.push_back(doc);
+        cout << "Pelicula marcada con 'Like'.\n";
+    }
+
+    void marcarVerMasTarde(uint32_t doc) {
+        watchLater.push_back(doc);
+        cout << "Pelicula añadida a 'Ver más tarde'.\n";
+    }
+
+    void mostrarResultadosBusquedaSinopsis(SearchResults &results, int offset) {
+        int limite = 5;
+        int start = offset * limite;
+        vector<SearchResult> pagina = results.page(offset, limite);
+        int end = start + (int)pagina.size();
+
+        cout << "Mostrando peliculas " << start + 1 << " a " << end << ":\n";
+        auto vista = vistaActual();
+        for (int i = start; i < end; i++) {
+            if (!existe(vista, pagina[i - start].doc)) continue;
+            cout << i + 1 << ". Titulo: " << pelicula(vista, pagina[i - start].doc).title() << "\n";
+        }
+    }
+
+private:
+    // Con catálogo por segmentos, las películas se leen de una vista que se conserva
+    // mientras se muestran, por si otro hilo lo cambia entretanto
+    shared_ptr<const SegmentedIndex::View> vistaActual() const { return live ? live->view() : nullptr; }
+
+    bool existe(const shared_ptr<const SegmentedIndex::View> &vista, uint32_t doc) const {
+        return vista ? vista->contains(doc) : doc < catalog->size();
+    }
+
+    Movie pelicula(const shared_ptr<const SegmentedIndex::View> &vista, uint32_t doc) const {
+        return vista ? vista->movie(doc) : (*catalog)[doc];
+    }
+};
+
+// Lector original: secuencial y separa por ',' sin respetar comillas, por lo que
+// rompe las sinopsis que contienen comas. Se conserva como referencia para el
+// benchmark de carga; el programa usa readMoviesFromCSVParallel.
+MovieStore readMoviesFromCSV(const string &filename) {
+    MovieStore movies;
+    ifstream file(filename);
+
+    if (!file.is_open()) {
+        cerr << "Error opening file" << endl;
+        return movies;
+    }
+
+    string line;
+    getline(file, line); // Saltar la cabecera
+
+    while (getline(file, line)) {
+        stringstream ss(line);
+        string imdb_id, title, plot_synopsis, tags, split, synopsis_source;
+
+        getline(ss, imdb_id, ',');
+        getline(ss, title, ',');
+        getline(ss, plot_synopsis, ',');
+        getline(ss, tags, ',');
+        getline(ss, split, ',');
+        getline(ss, synopsis_source, ',');
+
+        if (imdb_id.empty() || title.empty() || plot_synopsis.empty()) {
+            continue;
+        }
+
+        movies.add(imdb_id, title, plot_synopsis, tags, split, synopsis_source);
+    }
+
+    file.close();
+    return movies;
+}
+
+// Lee un campo CSV (RFC 4180) que empieza en p. Los campos entre comillas pueden
+// contener comas, saltos de línea y comillas escapadas como "".
+// Deja p sobre el separador (',' o fin de línea) que cierra el campo.
+static void parseCSVField(const char *&p, const char *end, string *out) {
+    if (p < end && *p == '"') {
+        const char *start = ++p;
+        bool escaped = false;
+        while (p < end) {
+            const char *quote = (const char *)memchr(p, '"', end - p);
+            if (!quote) {
+                p = end;
+                break;
+            }
+            if (quote + 1 < end && quote[1] == '"') {
+                escaped = true;
+                p = quote + 2;
+                continue;
+            }
+            p = quote;
+            break;
+        }
+        const char *fieldEnd = p;
+        if (p < end) ++p; // Comilla de cierre
+        const char *tail = p; // Texto suelto tras la comilla de cierre (CSV mal formado)
+        while (p < end && *p != ',' && *p != '\n' && *p != '\r') ++p;
+        if (!out) return;
+        if (!escaped) {
+            out->assign(start, fieldEnd - start);
+        } else {
+            out->clear();
+            out->reserve(fieldEnd - start);
+            for (const char *q = start; q < fieldEnd; ++q) {
+                out->push_back(*q);
+                if (*q == '"') ++q; // "" -> "
+            }
+        }
+        out->append(tail, p - tail);
+        return;
+    }
+    const char *start = p;
+    while (p < end && *p != ',' && *p != '\n' && *p != '\r') ++p;
+    if (out) out->assign(start, p - start);
+}
+
+// Parsea las filas completas del rango [begin, end) y las agrega a out.
+// Los campos se leen en los mismos strings fila tras fila y se copian al catálogo.
+static void parseCSVChunk(const char *begin, const char *end, MovieStore &out) {
+    string fields[6];
+    const char *p = begin;
+    while (p < end) {
+        size_t column = 0;
+        while (true) {
+            parseCSVField(p, end, column < 6 ? &fields[column] : nullptr);
+            ++column;
+            if (p < end && *p == ',') {
+                ++p;
+                continue;
+            }
+            break;
+        }
+        if (p < end && *p == '\r') ++p;
+        if (p < end && *p == '\n') ++p;
+
+        for (size_t f = column; f < 6; ++f) fields[f].clear(); // Fila con menos columnas
+        if (fields[0].empty() || fields[1].empty() || fields[2].empty()) {
+            continue;
+        }
+        out.add(fields[0], fields[1], fields[2], fields[3], fields[4], fields[5]);
+    }
+}
+
+// Devuelve el inicio de la primera fila que empieza después de from,
+// sabiendo si from cae dentro de un campo entre comillas
+static const char *nextRecordStart(const char *from, const char *end, bool inQuotes) {
+    for (const char *p = from; p < end; ++p) {
+        if (*p == '"') {
+            inQuotes = !inQuotes;
+        } else if (*p == '\n' && !inQuotes) {
+            return p + 1;
+        }
+    }
+    return end;
+}
+
+// Lectura paralela: mapea el archivo, lo divide en bloques alineados a filas y
+// parsea cada bloque en un hilo distinto, conservando el orden del archivo
+MovieStore readMoviesFromCSVParallel(const string &filename, unsigned numThreads = 0) {
+    MovieStore movies;
+    MappedFile file(filename);
+
+    if (!file.is_open()) {
+        cerr << "Error opening file" << endl;
+        return movies;
+    }
+    if (file.size() == 0) {
+        return movies;
+    }
+
+    const char *end = file.data() + file.size();
+    const char *begin = nextRecordStart(file.data(), end, false); // Saltar la cabecera
+    size_t total = end - begin;
+
+    const size_t minChunk = 1 << 20;
+    if (numThreads == 0) numThreads = max(1u, thread::hardware_concurrency());
+    numThreads = (unsigned)min<size_t>(numThreads, total / minChunk + 1);
+
+    // 1) Cada hilo cuenta las comillas de su tramo: la paridad acumulada indica
+    //    si un corte cae dentro de un campo entre comillas
+    vector<const char *> cuts(numThreads + 1);
+    vector<size_t> quotes(numThreads, 0);
+    vector<thread> workers;
+    for (unsigned i = 0; i <= numThreads; ++i) {
+        cuts[i] = begin + total * i / numThreads;
+    }
+    for (unsigned i = 0; i + 1 < numThreads; ++i) {
+        workers.emplace_back([&, i]() { quotes[i] = count(cuts[i], cuts[i + 1], '"'); });
+    }
+    for (auto &worker : workers) worker.join();
+    workers.clear();
+
+    // 2) Mover cada corte al inicio de la siguiente fila
+    vector<const char *> bounds(numThreads + 1);
+    bounds[0] = begin;
+    bounds[numThreads] = end;
+    size_t quotesBefore = 0;
+    for (unsigned i = 1; i < numThreads; ++i) {
+        quotesBefore += quotes[i - 1];
+        bounds[i] = max(bounds[i - 1], nextRecordStart(cuts[i], end, quotesBefore % 2 == 1));
+    }
+
+    // 3) Parsear los bloques en paralelo (el primero en el hilo actual) y concatenarlos en orden
+    vector<MovieStore> parts(numThreads);
+    for (unsigned i = 1; i < numThreads; ++i) {
+        workers.emplace_back([&, i]() { parseCSVChunk(bounds[i], bounds[i + 1], parts[i]); });
+    }
+    parseCSVChunk(bounds[0], bounds[1], parts[0]);
+    for (auto &worker : workers) worker.join();
+
+    movies = move(parts[0]);
+    for (unsigned i = 1; i < numThreads; ++i) {
+        movies.append(parts[i]);
+    }
+    return movies;
+}
+
+// Sinopsis casi iguales (la misma película desde distintas fuentes, por ejemplo).
+// Cada sinopsis es el conjunto de sus grupos de SHINGLE palabras seguidas, y su firma
+// MinHash guarda el mínimo de NUM_HASHES funciones de hash sobre ese conjunto: la
+// fracción de posiciones iguales entre dos firmas estima el índice de Jaccard de los
+// conjuntos. Con LSH la firma se parte en BANDS bandas y dos películas son candidatas
+// si alguna banda entera coincide, así solo se comparan las que caen en el mismo
+// balde y no todos los pares. Con 8 bandas de 8 filas un par con Jaccard 0.8 queda
+// como candidato con probabilidad 0.98 y uno con 0.5, con 0.03.
+class NearDuplicates {
+public:
+    static constexpr uint32_t SHINGLE = 3;
+    static constexpr uint32_t BANDS = 8;
+    static constexpr uint32_t ROWS = 8;
+    static constexpr uint32_t NUM_HASHES = BANDS * ROWS;
+    static constexpr double THRESHOLD = 0.8; // Jaccard estimado desde el que se unen
+
+    using Signature = array<uint32_t, NUM_HASHES>;
+
+    // Firma de un texto; vacía (todo UINT32_MAX) si no tiene palabras
+    static Signature signature(string_view text) {
+        Signature result;
+        result.fill(UINT32_MAX);
+        forEachShingle(text, [&](uint64_t shingle) {
+            for (uint32_t i = 0; i < NUM_HASHES; ++i) {
+                result[i] = min(result[i], (uint32_t)((multipliers()[i] * shingle + offsets()[i]) >> 32));
+            }
+        });
+        return result;
+    }
+
+    // Fracción de posiciones iguales: estima el Jaccard de los grupos de palabras
+    static double similarity(const Signature &a, const Signature &b) {
+        uint32_t equal = 0;
+        for (uint32_t i = 0; i < NUM_HASHES; ++i) equal += a[i] == b[i];
+        return (double)equal / NUM_HASHES;
+    }
+
+    // Firmas de todas las sinopsis, repartidas en numThreads hilos (0: uno por núcleo)
+    static vector<Signature> signatures(const MovieStore &movies, unsigned numThreads = 0) {
+        vector<Signature> result(movies.size());
+        if (numThreads == 0) numThreads = max(1u, thread::hardware_concurrency());
+        numThreads = (unsigned)max<size_t>(1, min<size_t>(numThreads, movies.size() / 256));
+        vector<thread> workers;
+        auto work = [&](size_t begin, size_t end) {
+            for (size_t doc = begin; doc < end; ++doc) result[doc] = signature(movies[(uint32_t)doc].plot_synopsis());
+        };
+        for (unsigned t = 1; t < numThreads; ++t) {
+            workers.emplace_back(work, movies.size() * t / numThreads, movies.size() * (t + 1) / numThreads);
+        }
+        work(0, movies.size() / numThreads);
+        for (auto &worker : workers) worker.join();
+        return result;
+    }
+
+    // Para cada película, la primera de su grupo de casi duplicadas (ella misma si no
+    // tiene). En cada balde de cada banda las películas se comparan con la primera del
+    // balde, así el costo es lineal en la cantidad de películas. Dos grupos solo se
+    // unen si todas sus películas se parecen a la primera del grupo unido: si no,
+    // A ~ B y B ~ C juntarían a A con C aunque sus sinopsis tengan poco en común.
+    static vector<uint32_t> groups(const vector<Signature> &signatures) {
+        vector<uint32_t> root(signatures.size());
+        vector<vector<uint32_t>> members(signatures.size()); // Solo de las raíces
+        for (uint32_t doc = 0; doc < root.size(); ++doc) {
+            root[doc] = doc;
+            members[doc] = {doc};
+        }
+        Signature empty;
+        empty.fill(UINT32_MAX);
+        vector<pair<uint64_t, uint32_t>> buckets;
+        buckets.reserve(signatures.size());
+        for (uint32_t band = 0; band < BANDS; ++band) {
+            buckets.clear();
+            for (uint32_t doc = 0; doc < signatures.size(); ++doc) {
+                if (signatures[doc] == empty) continue;
+                buckets.push_back({checksum64(signatures[doc].data() + band * ROWS, ROWS * sizeof(uint32_t)), doc});
+            }
+            sort(buckets.begin(), buckets.end());
+            for (size_t first = 0, i = 1; i < buckets.size(); ++i) {
+                if (buckets[i].first != buckets[first].first) {
+                    first = i;
+                    continue;
+                }
+                // La raíz de cada grupo es su primera película
+                uint32_t a = root[buckets[first].second], b = root[buckets[i].second];
+                if (a == b) continue;
+                uint32_t kept = min(a, b), joined = max(a, b);
+                bool close = all_of(members[joined].begin(), members[joined].end(), [&](uint32_t doc) {
+                    return similarity(signatures[kept], signatures[doc]) >= THRESHOLD;
+                });
+                if (!close) continue;
+                for (uint32_t doc : members[joined]) root[doc] = kept;
+                members[kept].insert(members[kept].end(), members[joined].begin(), members[joined].end());
+                members[joined].clear();
+            }
+        }
+        return root;
+    }
+
+    // Dentro de cada grupo deja juntas solo las que además son la misma película:
+    // mismo imdb_id o mismo título (sin contar mayúsculas ni puntuación), por ejemplo
+    // la sinopsis de IMDb y la de Wikipedia. Películas distintas con argumentos
+    // parecidos (remakes, secuelas) quedan cada una por su lado.
+    static vector<uint32_t> sameMovie(const MovieStore &movies, const vector<uint32_t> &groups) {
+        vector<uint32_t> result(groups.size());
+        unordered_map<string, uint32_t> firstWith; // Grupo + imdb_id o título -> primera película
+        for (uint32_t doc = 0; doc < groups.size(); ++doc) {
+            result[doc] = doc;
+            Movie movie = movies[doc];
+            string group = to_string(groups[doc]) + '\t';
+            string title;
+            for (string_view word : Tokenizer::local().split(movie.title())) {
+                if (!title.empty()) title += ' ';
+                title += word;
+            }
+            string keys[2] = {group + "id " + string(movie.imdb_id()), group + "title " + title};
+            for (const string &key : keys) {
+                auto it = firstWith.find(key);
+                if (it != firstWith.end()) {
+                    result[doc] = it->second;
+                    break;
+                }
+            }
+            for (const string &key : keys) firstWith.emplace(key, result[doc]);
+        }
+        return result;
+    }
+
+    // Catálogo con una película por grupo: queda la primera del archivo, con los tags
+    // de todas las del grupo
+    static MovieStore collapse(const MovieStore &movies, const vector<uint32_t> &groups) {
+        vector<string> tags(movies.size());
+        for (const Movie &movie : movies) {
+            uint32_t first = groups[movie.id()];
+            if (first == movie.id()) {
+                tags[first] = movie.tags();
+                continue;
+            }
+            vector<string> present = TagIndex::splitTags(tags[first]);
+            for (const string &tag : TagIndex::splitTags(movie.tags())) {
+                if (find(present.begin(), present.end(), tag) != present.end()) continue;
+                if (!tags[first].empty()) tags[first] += ", ";
+                tags[first] += tag;
+                present.push_back(tag);
+            }
+        }
+        MovieStore result;
+        for (const Movie &movie : movies) {
+            if (groups[movie.id()] != movie.id()) continue;
+            result.add(movie.imdb_id(), movie.title(), movie.plot_synopsis(), tags[movie.id()], movie.split(),
+                       movie.synopsis_source());
+        }
+        return result;
+    }
+
+    // Etapa de carga: firmas en paralelo, baldes de LSH y catálogo sin las copias de
+    // una misma película
+    static MovieStore removeDuplicates(MovieStore movies, unsigned numThreads = 0) {
+        vector<uint32_t> found = sameMovie(movies, groups(signatures(movies, numThreads)));
+        for (uint32_t doc = 0; doc < found.size(); ++doc) {
+            if (found[doc] != doc) return collapse(movies, found);
+        }
+        return movies;
+    }
+
+    // Llama a fn(hash) por cada grupo de SHINGLE palabras seguidas del texto ya
+    // separado por el tokenizador (o por el texto entero si tiene menos palabras)
+    template <typename F>
+    static void forEachShingle(string_view text, F &&fn) {
+        const vector<string_view> &words = Tokenizer::local().split(text);
+        if (words.empty()) return;
+        uint64_t hashes[SHINGLE];
+        size_t count = min<size_t>(SHINGLE, words.size());
+        for (size_t i = 0; i < words.size(); ++i) {
+            hashes[i % SHINGLE] = checksum64(words[i].data(), words[i].size());
+            if (i + 1 < count) continue;
+            // El grupo se arma en orden aunque los hashes estén en un búfer circular
+            uint64_t group[SHINGLE];
+            for (size_t j = 0; j < count; ++j) group[j] = hashes[(i + 1 - count + j) % SHINGLE];
+            fn(checksum64(group, count * sizeof(uint64_t)));
+        }
+    }
+
+private:
+    // Coeficientes de las funciones de hash a * x + b (a impar), fijos para que las
+    // firmas no cambien entre ejecuciones
+    static const array<uint64_t, NUM_HASHES> &multipliers() {
+        static const array<uint64_t, NUM_HASHES> values = randomCoefficients(1, true);
+        return values;
+    }
+
+    static const array<uint64_t, NUM_HASHES> &offsets() {
+        static const array<uint64_t, NUM_HASHES> values = randomCoefficients(2, false);
+        return values;
+    }
+
+    static array<uint64_t, NUM_HASHES> randomCoefficients(uint64_t seed, bool odd) {
+        mt19937_64 rng(seed);
+        array<uint64_t, NUM_HASHES> values;
+        for (uint64_t &value : values) value = odd ? rng() | 1 : rng();
+        return values;
+    }
+};
+
+template <typename F>
+double medirMs(F &&f) {
+    auto t0 = chrono::steady_clock::now();
+    f();
+    auto t1 = chrono::steady_clock::now();
+    return chrono::duration<double, milli>(t1 - t0).count();
+}
+
+// Benchmark de carga: lector secuencial original vs. lector paralelo mapeado
+void benchmarkLecturaCSV(const string &filename) {
+    MappedFile probe(filename);
+    if (!probe.is_open()) {
+        cerr << "Error opening file" << endl;
+        return;
+    }
+    double mb = probe.size() / (1024.0 * 1024.0);
+
+    size_t nSecuencial = 0, nParalelo = 0;
+    double msSecuencial = 1e18, msParalelo = 1e18;
+    for (int ronda = 0; ronda < 3; ++ronda) {
+        msSecuencial = min(msSecuencial, medirMs([&]() { nSecuencial = readMoviesFromCSV(filename).size(); }));
+        msParalelo = min(msParalelo, medirMs([&]() { nParalelo = readMoviesFromCSVParallel(filename).size(); }));
+    }
+
+    cout << "Archivo: " << filename << " (" << mb << " MB, " << thread::hardware_concurrency() << " hilos)\n";
+    cout << "readMoviesFromCSV:         " << msSecuencial << " ms, " << mb / (msSecuencial / 1000.0)
+         << " MB/s, " << nSecuencial << " peliculas\n";
+    cout << "readMoviesFromCSVParallel: " << msParalelo << " ms, " << mb / (msParalelo / 1000.0)
+         << " MB/s, " << nParalelo << " peliculas\n";
+}
+
+// Benchmark del diccionario: nodos con punteros vs. Trie congelado en arreglos contiguos
+void benchmarkTrie(const string &filename) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+
+    Trie movieTrie;
+    for (const auto &movie : movies) {
+        movieTrie.insert(movie);
+    }
+
+    // Consultas: palabras de las sinopsis (aciertos) y las mismas palabras alteradas (fallos)
+    vector<string> queries;
+    for (size_t i = 0; i < movies.size() && queries.size() < 200000; i += 7) {
+        for (const string &word : movieTrie.splitWords(movies[i].plot_synopsis())) {
+            queries.push_back(word);
+            queries.push_back(word + "zq");
+        }
+    }
+
+    auto medirBusquedas = [&]() {
+        size_t found = 0;
+        double ms = medirMs([&]() {
+            for (const string &word : queries) {
+                found += movieTrie.containsWord(word);
+            }
+        });
+        cout << "  " << ms * 1e6 / queries.size() << " ns/busqueda (" << found << " aciertos de "
+             << queries.size() << ")\n";
+    };
+
+    cout << "Trie con nodos enlazados: " << movieTrie.dictionaryBytes() / (1024.0 * 1024.0) << " MB\n";
+    medirBusquedas();
+
+    double msFreeze = medirMs([&]() { movieTrie.freeze(); });
+    cout << "Trie congelado: " << movieTrie.dictionaryBytes() / (1024.0 * 1024.0) << " MB (freeze: "
+         << msFreeze << " ms)\n";
+    medirBusquedas();
+}
+
+// Benchmark de las listas de apariciones: tamaño y costo de búsqueda antes y después de comprimirlas
+void benchmarkPostings(const string &filename) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+
+    Trie movieTrie;
+    size_t occurrences = 0;
+    for (const auto &movie : movies) {
+        movieTrie.insert(movie);
+        occurrences += movieTrie.splitWords(movie.title()).size() + movieTrie.splitWords(movie.plot_synopsis()).size();
+    }
+
+    vector<string> queries;
+    for (size_t i = 0; i < movies.size() && queries.size() < 2000; i += 13) {
+        vector<string> words = movieTrie.splitWords(movies[i].title());
+        queries.push_back(words.empty() ? string(movies[i].title()) : words[0]);
+    }
+
+    auto medirConsultas = [&]() {
+        size_t total = 0;
+        double ms = medirMs([&]() {
+            for (const string &query : queries) {
+                total += movieTrie.search(query).size();
+            }
+        });
+        cout << "  " << ms * 1000.0 / queries.size() << " us/consulta (" << total << " resultados)\n";
+    };
+
+    const double mb = 1024.0 * 1024.0;
+    cout << "shared_ptr<Movie> por aparicion (formato anterior): "
+         << occurrences * sizeof(shared_ptr<void>) / mb << " MB\n";
+    cout << "Posting {doc, freq} sin comprimir: " << movieTrie.postingsBytes() / mb << " MB\n";
+    medirConsultas();
+    movieTrie.freeze();
+    cout << "Delta + varint en bloques de " << POSTING_BLOCK_SIZE << ": " << movieTrie.postingsBytes() / mb << " MB\n";
+    medirConsultas();
+}
+
+// Consultas para los benchmarks: una por línea del archivo, o generadas a partir
+// de palabras de sinopsis al azar si no se indica archivo
+vector<string> cargarConsultas(const string &queryLog, const MovieStore &movies, size_t count = 1000) {
+    vector<string> queries;
+    if (!queryLog.empty()) {
+        ifstream file(queryLog);
+        string line;
+        while (getline(file, line)) {
+            if (!line.empty()) queries.push_back(line);
+        }
+        return queries;
+    }
+    mt19937 rng(42);
+    Tokenizer tokenizer;
+    for (size_t i = 0; i < count && !movies.empty(); ++i) {
+        const vector<string_view> &words = tokenizer.split(movies[rng() % movies.size()].plot_synopsis());
+        if (words.empty()) continue;
+        string query;
+        for (size_t w = 0, n = 1 + rng() % 3; w < n; ++w) {
+            if (w) query += " ";
+            query += words[rng() % words.size()];
+        }
+        queries.push_back(query);
+    }
+    return queries;
+}
+
+// Benchmark de ranking: puntuar y ordenar todas las coincidencias vs. Block-Max WAND
+void benchmarkBM25(const string &filename, const string &queryLog) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    Trie movieTrie;
+    for (const auto &movie : movies) {
+        movieTrie.insert(movie);
+    }
+    movieTrie.freeze();
+
+    vector<string> queries = cargarConsultas(queryLog, movies);
+    for (int k : {5, 50}) {
+        vector<vector<double>> expected;
+        double msCompleto = medirMs([&]() {
+            for (const string &query : queries) {
+                vector<double> scores;
+                for (const auto &result : movieTrie.search(query).top(k)) {
+                    scores.push_back(result.score);
+                }
+                expected.push_back(scores);
+            }
+        });
+        size_t distintos = 0, i = 0;
+        double msWand = medirMs([&]() {
+            for (const string &query : queries) {
+                vector<SearchResult> top = getTopRelevantMovies(movieTrie, query, k);
+                bool igual = top.size() == expected[i].size();
+                for (size_t j = 0; igual && j < top.size(); ++j) {
+                    igual = fabs(top[j].score - expected[i][j]) < 1e-6;
+                }
+                distintos += !igual;
+                ++i;
+            }
+        });
+        cout << "k=" << k << ", " << queries.size() << " consultas\n";
+        cout << "  search + top(k):               " << msCompleto * 1000.0 / queries.size() << " us/consulta\n";
+        cout << "  Block-Max WAND:                " << msWand * 1000.0 / queries.size() << " us/consulta ("
+             << distintos << " rankings distintos)\n";
+    }
+}
+
+// Benchmark de selección top-k: ordenar todas las coincidencias vs. selección parcial vs. WAND
+void benchmarkTopK(const string &filename, const string &queryLog) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    Trie movieTrie;
+    for (const auto &movie : movies) {
+        movieTrie.insert(movie);
+    }
+    movieTrie.freeze();
+
+    vector<string> queries = cargarConsultas(queryLog, movies);
+    vector<SearchResults> candidates;
+    for (const string &query : queries) {
+        candidates.push_back(movieTrie.search(query));
+    }
+
+    auto mismosDocs = [](const vector<SearchResult> &a, const vector<SearchResult> &b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (a[i].doc != b[i].doc) return false;
+        }
+        return true;
+    };
+
+    for (size_t k : {5, 50, 500}) {
+        vector<vector<SearchResult>> ordenCompleto, seleccion;
+        double msOrden = medirMs([&]() {
+            for (SearchResults results : candidates) {
+                vector<SearchResult> all = results.top(results.size());
+                all.resize(min(k, all.size()));
+                ordenCompleto.push_back(move(all));
+            }
+        });
+        double msSeleccion = medirMs([&]() {
+            for (SearchResults results : candidates) {
+                seleccion.push_back(results.top(k));
+            }
+        });
+        size_t distintos = 0, i = 0;
+        double msWand = medirMs([&]() {
+            for (const string &query : queries) {
+                distintos += !mismosDocs(movieTrie.searchTopK(query, k), ordenCompleto[i]);
+                distintos += !mismosDocs(seleccion[i], ordenCompleto[i]);
+                ++i;
+            }
+        });
+        cout << "k=" << k << " (" << queries.size() << " consultas, " << distintos << " rankings distintos)\n";
+        cout << "  orden completo:  " << msOrden * 1000.0 / queries.size() << " us/consulta\n";
+        cout << "  seleccion top-k: " << msSeleccion * 1000.0 / queries.size() << " us/consulta\n";
+        cout << "  Block-Max WAND:  " << msWand * 1000.0 / queries.size() << " us/consulta (incluye busqueda)\n";
+    }
+
+    // Paginación: recorrer las primeras 20 páginas de 5 resultados
+    double msPaginas = medirMs([&]() {
+        for (SearchResults results : candidates) {
+            for (size_t pagina = 0; pagina < 20; ++pagina) {
+                results.page(pagina, 5);
+            }
+        }
+    });
+    cout << "20 paginas de 5: " << msPaginas * 1000.0 / queries.size() << " us/consulta\n";
+}
+
+// Benchmark de arranque: reconstruir el índice desde el CSV vs. cargar el snapshot
+void benchmarkSnapshot(const string &filename) {
+    string snapshotFile = filename + ".idx";
+    Trie built;
+    double msBuild = medirMs([&]() {
+        built.insert(readMoviesFromCSVParallel(filename));
+        built.freeze();
+    });
+    if (built.allMovies().empty()) return;
+
+    bool saved = false;
+    double msSave = medirMs([&]() { saved = built.saveSnapshot(snapshotFile, filename); });
+    if (!saved) return;
+
+    Trie loaded;
+    bool ok = false;
+    double msLoad = medirMs([&]() { ok = loaded.loadSnapshot(snapshotFile, filename); });
+    if (!ok) {
+        cerr << "No se pudo cargar el snapshot" << endl;
+        return;
+    }
+
+    size_t distintos = 0;
+    vector<string> queries = cargarConsultas("", built.allMovies(), 200);
+    for (const string &query : queries) {
+        vector<SearchResult> a = built.searchTopK(query, 10), b = loaded.searchTopK(query, 10);
+        bool igual = a.size() == b.size();
+        for (size_t i = 0; igual && i < a.size(); ++i) {
+            igual = a[i].doc == b[i].doc && a[i].score == b[i].score &&
+                    built.movie(a[i].doc).imdb_id() == loaded.movie(b[i].doc).imdb_id();
+        }
+        distintos += !igual;
+    }
+
+    cout << "Construir desde CSV: " << msBuild << " ms\n";
+    cout << "Guardar snapshot:    " << msSave << " ms (" << filesystem::file_size(snapshotFile) / (1024.0 * 1024.0)
+         << " MB)\n";
+    cout << "Cargar snapshot:     " << msLoad << " ms (" << distintos << " de " << queries.size()
+         << " consultas con resultados distintos)\n";
+}
+
+// Benchmark de concurrencia: varios hilos consultan el mismo Trie congelado
+void benchmarkQPS(const string &filename, const string &queryLog) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    Trie movieTrie;
+    for (const auto &movie : movies) {
+        movieTrie.insert(movie);
+    }
+    movieTrie.freeze();
+    const Trie &sharedTrie = movieTrie;
+
+    vector<string> queries = cargarConsultas(queryLog, movies);
+    unsigned maxThreads = max(1u, thread::hardware_concurrency());
+    for (unsigned numThreads = 1;; numThreads = min(numThreads * 2, maxThreads)) {
+        for (const char *modo : {"search", "top-5"}) {
+            bool topK = modo[0] == 't';
+            size_t porHilo = max<size_t>(queries.size(), 2000);
+            atomic<size_t> totalResultados(0);
+            double ms = medirMs([&]() {
+                vector<thread> workers;
+                for (unsigned t = 0; t < numThreads; ++t) {
+                    workers.emplace_back([&, t]() {
+                        size_t checksum = 0;
+                        for (size_t i = 0; i < porHilo; ++i) {
+                            const string &query = queries[(i + t * 7919) % queries.size()];
+                            checksum += topK ? sharedTrie.searchTopK(query, 5).size() : sharedTrie.search(query).size();
+                        }
+                        totalResultados += checksum;
+                    });
+                }
+                for (auto &worker : workers) worker.join();
+            });
+            cout << numThreads << " hilos, " << modo << ": " << porHilo * numThreads / (ms / 1000.0)
+                 << " consultas/s (" << totalResultados << " resultados)\n";
+        }
+        if (numThreads == maxThreads) break;
+    }
+}
+
+// Benchmark de tags: recorrido lineal con string::find (como antes) vs. índice invertido
+void benchmarkTags(const string &filename) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    Trie movieTrie;
+    for (const auto &movie : movies) {
+        movieTrie.insert(movie);
+    }
+    movieTrie.freeze();
+    const TagIndex &tags = movieTrie.tags();
+    cout << tags.size() << " tags distintos en " << movies.size() << " peliculas\n";
+
+    size_t lineales = 0, indexados = 0;
+    double msLineal = medirMs([&]() {
+        for (size_t t = 0; t < tags.size(); ++t) {
+            string tag = tags.name(t);
+            for (const auto &movie : movies) {
+                lineales += movie.tags().find(tag) != string_view::npos;
+            }
+        }
+    });
+    double msIndice = medirMs([&]() {
+        for (size_t t = 0; t < tags.size(); ++t) {
+            indexados += movieTrie.searchByTag(tags.name(t)).size();
+        }
+    });
+    cout << "Un tag, recorrido lineal: " << msLineal * 1000.0 / tags.size() << " us/tag (" << lineales
+         << " coincidencias, " << lineales - indexados << " falsas por subcadena)\n";
+    cout << "Un tag, indice invertido: " << msIndice * 1000.0 / tags.size() << " us/tag (" << indexados
+         << " coincidencias)\n";
+
+    // Filtros AND / OR / NOT al azar con los tags existentes
+    mt19937 rng(42);
+    vector<TagFilter> filtros;
+    for (int i = 0; i < 200 && tags.size() > 0; ++i) {
+        TagFilter filtro;
+        filtro.all.push_back({tags.name(rng() % tags.size())});
+        filtro.all.push_back({tags.name(rng() % tags.size()), tags.name(rng() % tags.size())});
+        filtro.none.push_back(tags.name(rng() % tags.size()));
+        filtros.push_back(filtro);
+    }
+    size_t total = 0;
+    double msFiltro = medirMs([&]() {
+        for (const TagFilter &filtro : filtros) total += movieTrie.searchByTags(filtro).size();
+    });
+    cout << "Filtro A, B|C, -D: " << msFiltro * 1000.0 / filtros.size() << " us/filtro (" << total
+         << " peliculas)\n";
+
+    // Texto + tags: top-5 filtrado dentro de WAND vs. puntuar todo y filtrar después
+    vector<string> queries = cargarConsultas("", movies, 200);
+    size_t distintos = 0;
+    vector<vector<SearchResult>> filtrados;
+    double msWand = medirMs([&]() {
+        for (size_t i = 0; i < queries.size(); ++i) {
+            filtrados.push_back(movieTrie.searchTopK(queries[i], 5, filtros[i % filtros.size()]));
+        }
+    });
+    double msDespues = medirMs([&]() {
+        for (size_t i = 0; i < queries.size(); ++i) {
+            vector<uint32_t> permitidas = tags.filter(filtros[i % filtros.size()], movies.size());
+            vector<SearchResult> todos = movieTrie.search(queries[i]).top(movies.size()), top;
+            for (const SearchResult &result : todos) {
+                if (top.size() == 5) break;
+                if (binary_search(permitidas.begin(), permitidas.end(), result.doc)) top.push_back(result);
+            }
+            bool igual = top.size() == filtrados[i].size();
+            for (size_t j = 0; igual && j < top.size(); ++j) igual = top[j].doc == filtrados[i][j].doc;
+            distintos += !igual;
+        }
+    });
+    cout << "Texto + tags, top-5 con WAND:       " << msWand * 1000.0 / queries.size() << " us/consulta\n";
+    cout << "Texto + tags, filtrar al final:     " << msDespues * 1000.0 / queries.size() << " us/consulta ("
+         << distintos << " rankings distintos)\n";
+}
+
+// Benchmark de filtros: recorrer el catálogo revisando cada película vs. mapas de bits
+void benchmarkFiltros(const string &filename) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    Trie movieTrie;
+    for (const auto &movie : movies) {
+        movieTrie.insert(movie);
+    }
+    movieTrie.freeze();
+    const TagIndex &tags = movieTrie.tags();
+    if (tags.size() == 0) return;
+
+    // Un 10% de películas con "Like" y otro 10% en "Ver más tarde"
+    mt19937 rng(42);
+    vector<bool> liked(movies.size()), watchLater(movies.size());
+    for (uint32_t doc = 0; doc < movies.size(); ++doc) {
+        if (rng() % 10 == 0) {
+            liked[doc] = true;
+            movieTrie.setFlag(doc, "liked", true);
+        }
+        if (rng() % 10 == 0) {
+            watchLater[doc] = true;
+            movieTrie.setFlag(doc, "watch_later", true);
+        }
+    }
 
-// Nodo del Trie
-struct TrieNode {
-    unordered_map<char, shared_ptr<TrieNode>> children;
-    vector<shared_ptr<Movie>> movies_with_word;
-};
+    // Consultas del estilo "palabra, tag=X, split=train, not liked"
+    vector<string> textos = cargarConsultas("", movies, 200);
+    vector<MovieFilter> filtros;
+    for (size_t i = 0; i < textos.size(); ++i) {
+        string texto;
+        string consulta = "tag=" + tags.name(rng() % tags.size()) + ", split=" + string(movies[rng() % movies.size()].split()) +
+                          ", not " + (i % 2 ? "liked" : "watch_later");
+        filtros.push_back(MovieFilter::parse(consulta, texto));
+    }
 
-// Clase Trie para insertar y buscar palabras en títulos y sinopsis
-class Trie {
-public:
-    Trie() : root(make_shared<TrieNode>()) {}
+    // Lo que se hacía antes: revisar los campos de cada película
+    auto cumple = [&](const Movie &movie, const MovieFilter &filtro) {
+        for (const auto &condition : filtro.conditions) {
+            bool match = false;
+            if (condition.attribute == "liked") match = liked[movie.id()];
+            else if (condition.attribute == "watch_later") match = watchLater[movie.id()];
+            for (const string &value : condition.values) {
+                if (condition.attribute == "split") match |= TagIndex::normalize(movie.split()) == value;
+                else if (condition.attribute == "source") match |= TagIndex::normalize(movie.synopsis_source()) == value;
+                else if (condition.attribute == "tag") {
+                    vector<string> movieTags = TagIndex::splitTags(movie.tags());
+                    match |= find(movieTags.begin(), movieTags.end(), value) != movieTags.end();
+                }
+            }
+            if (match == condition.negated) return false;
+        }
+        return true;
+    };
+
+    size_t distintos = 0;
+    vector<size_t> conteos;
+    double msRecorrido = medirMs([&]() {
+        for (const MovieFilter &filtro : filtros) {
+            size_t count = 0;
+            for (const auto &movie : movies) count += cumple(movie, filtro);
+            conteos.push_back(count);
+        }
+    });
+    size_t total = 0, i = 0;
+    double msBitmap = medirMs([&]() {
+        for (const MovieFilter &filtro : filtros) {
+            size_t count = movieTrie.filter(filtro).cardinality();
+            distintos += count != conteos[i++];
+            total += count;
+        }
+    });
+    cout << "Solo filtro, recorrer catalogo: " << msRecorrido * 1000.0 / filtros.size() << " us/filtro\n";
+    cout << "Solo filtro, mapas de bits:     " << msBitmap * 1000.0 / filtros.size() << " us/filtro (" << total
+         << " peliculas, " << distintos << " conteos distintos)\n";
 
-    void insert(const shared_ptr<Movie> &movie) {
-        vector<string> words = splitWords(movie->title + " " + movie->plot_synopsis);
-        for (const string &word : words) {
-            insertWord(word, movie, 1);
+    // Texto + filtro: revisar cada resultado vs. WAND sobre el mapa de bits
+    vector<vector<SearchResult>> esperados;
+    double msTextoRecorrido = medirMs([&]() {
+        for (size_t q = 0; q < textos.size(); ++q) {
+            vector<SearchResult> todos = movieTrie.search(textos[q]).top(movies.size()), top;
+            for (const SearchResult &result : todos) {
+                if (top.size() == 5) break;
+                if (cumple(movies[result.doc], filtros[q])) top.push_back(result);
+            }
+            esperados.push_back(move(top));
+        }
+    });
+    distintos = 0;
+    double msTextoBitmap = medirMs([&]() {
+        for (size_t q = 0; q < textos.size(); ++q) {
+            vector<SearchResult> top = movieTrie.searchTopK(textos[q], 5, filtros[q]);
+            bool igual = top.size() == esperados[q].size();
+            for (size_t j = 0; igual && j < top.size(); ++j) igual = top[j].doc == esperados[q][j].doc;
+            distintos += !igual;
         }
+    });
+    cout << "Texto + filtro, revisar resultados: " << msTextoRecorrido * 1000.0 / textos.size() << " us/consulta\n";
+    cout << "Texto + filtro, mapas de bits:      " << msTextoBitmap * 1000.0 / textos.size() << " us/consulta ("
+         << distintos << " rankings distintos)\n";
+
+    // Intersección de conjuntos grandes: listas ordenadas vs. mapas de bits
+    RoaringBitmap impares, tercios;
+    vector<uint32_t> listaImpares, listaTercios;
+    for (uint32_t doc = 0; doc < 1000000; ++doc) {
+        if (doc % 2) impares.add(doc), listaImpares.push_back(doc);
+        if (doc % 3 == 0) tercios.add(doc), listaTercios.push_back(doc);
     }
+    size_t cardinalidad = 0;
+    double msListas = medirMs([&]() {
+        for (int rep = 0; rep < 20; ++rep) {
+            vector<uint32_t> out;
+            set_intersection(listaImpares.begin(), listaImpares.end(), listaTercios.begin(), listaTercios.end(),
+                             back_inserter(out));
+            cardinalidad += out.size();
+        }
+    });
+    double msBits = medirMs([&]() {
+        for (int rep = 0; rep < 20; ++rep) cardinalidad += (impares & tercios).cardinality();
+    });
+    cout << "AND de 500k y 333k elementos, listas ordenadas: " << msListas / 20 << " ms\n";
+    cout << "AND de 500k y 333k elementos, mapas de bits:    " << msBits / 20 << " ms (" << impares.memoryBytes() / 1024
+         << " KB vs " << listaImpares.size() * sizeof(uint32_t) / 1024 << " KB)\n";
+}
 
-    // Búsqueda por palabras y frases
-    vector<shared_ptr<Movie>> search(const string &query) {
-        for (auto &movie : movies) {
-            movie->relevance_score = 0; // Reseteamos siempre el relevance para cada película
+// Benchmark de frases: índice posicional vs. revisar el texto de cada película
+void benchmarkFrases(const string &filename) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    Trie movieTrie;
+    for (const auto &movie : movies) {
+        movieTrie.insert(movie);
+    }
+    movieTrie.freeze();
+    cout << "Posiciones: " << movieTrie.positionsBytes() / (1024.0 * 1024.0) << " MB\n";
+
+    // Frases de 2 a 4 palabras tomadas de las sinopsis
+    mt19937 rng(42);
+    vector<string> frases;
+    while (frases.size() < 200) {
+        vector<string> words = movieTrie.splitWords(movies[rng() % movies.size()].plot_synopsis());
+        if (words.size() < 8) continue;
+        size_t length = 2 + rng() % 3, start = rng() % (words.size() - length);
+        string frase;
+        for (size_t i = start; i < start + length; ++i) frase += words[i] + " ";
+        frases.push_back(frase);
+    }
+
+    size_t coincidenciasOr = 0, coincidenciasFrase = 0, coincidenciasCerca = 0, recorrido = 0;
+    double msOr = medirMs([&]() {
+        for (const string &frase : frases) coincidenciasOr += movieTrie.search(frase).size();
+    });
+    double msFrase = medirMs([&]() {
+        for (const string &frase : frases) coincidenciasFrase += movieTrie.searchPhrase(frase).size();
+    });
+    double msCerca = medirMs([&]() {
+        for (const string &frase : frases) coincidenciasCerca += movieTrie.searchNear(frase, 5).size();
+    });
+    double msRecorrido = medirMs([&]() {
+        for (size_t f = 0; f < 20; ++f) {
+            vector<string> words = movieTrie.splitWords(frases[f]);
+            for (const auto &movie : movies) {
+                vector<string> text = movieTrie.splitWords(movie.plot_synopsis());
+                for (size_t i = 0; i + words.size() <= text.size(); ++i) {
+                    if (equal(words.begin(), words.end(), text.begin() + i)) {
+                        ++recorrido;
+                        break;
+                    }
+                }
+            }
         }
+    });
+    cout << "OR de las palabras (antes):  " << msOr * 1000.0 / frases.size() << " us/consulta (" << coincidenciasOr
+         << " peliculas)\n";
+    cout << "Frase exacta:                " << msFrase * 1000.0 / frases.size() << " us/consulta ("
+         << coincidenciasFrase << " peliculas)\n";
+    cout << "A 5 palabras o menos:        " << msCerca * 1000.0 / frases.size() << " us/consulta ("
+         << coincidenciasCerca << " peliculas)\n";
+    cout << "Frase revisando cada texto:  " << msRecorrido * 1000.0 / 20 << " us/consulta\n";
+}
 
-        vector<string> words = splitWords(query);
-        vector<shared_ptr<Movie>> result;
+// Benchmark de consultas booleanas: AND selectivos, OR, NOT, prefijos y tags.
+// Compara con evaluar cada palabra completa y combinar los conjuntos.
+void benchmarkBooleano(const string &filename) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    Trie movieTrie;
+    for (const auto &movie : movies) {
+        movieTrie.insert(movie);
+    }
+    movieTrie.freeze();
+
+    // Palabra rara (2 a 20 películas) AND palabra frecuente (más de 1000)
+    mt19937 rng(42);
+    vector<string> raras, frecuentes;
+    for (int intento = 0; intento < 20000 && (raras.size() < 200 || frecuentes.size() < 20); ++intento) {
+        vector<string> words = movieTrie.splitWords(movies[rng() % movies.size()].plot_synopsis());
+        if (words.empty()) continue;
+        const string &word = words[rng() % words.size()];
+        size_t docs = movieTrie.search(word).size();
+        if (docs >= 2 && docs <= 20 && raras.size() < 200) raras.push_back(word);
+        if (docs > 1000 && frecuentes.size() < 20) frecuentes.push_back(word);
+    }
+    if (raras.empty() || frecuentes.empty()) return;
+
+    vector<string> consultas;
+    for (size_t i = 0; i < raras.size(); ++i) {
+        consultas.push_back(raras[i] + " AND " + frecuentes[i % frecuentes.size()] + " AND " +
+                            frecuentes[(i + 1) % frecuentes.size()]);
+    }
 
-        set<string> uniqueMovies; // Usamos el imdb_id para evitar duplicados
-        for (const string &word : words) {
-            vector<shared_ptr<Movie>> movies_with_word = searchWord(word);
-            for (auto &movie : movies_with_word) {
-                if (uniqueMovies.find(movie->imdb_id) == uniqueMovies.end()) {
-                    result.push_back(movie);
-                    uniqueMovies.insert(movie->imdb_id);
+    QueryStats stats;
+    size_t resultados = 0, distintos = 0;
+    vector<size_t> conteos;
+    double msPlan = medirMs([&]() {
+        for (const string &consulta : consultas) {
+            size_t count = movieTrie.searchQuery(consulta, &stats).size();
+            conteos.push_back(count);
+            resultados += count;
+        }
+    });
+    // Sin planificador: resolver cada palabra completa e intersectar los conjuntos
+    double msConjuntos = medirMs([&]() {
+        for (size_t i = 0; i < consultas.size(); ++i) {
+            vector<uint32_t> acumulado;
+            bool primero = true;
+            for (const string &word : {raras[i], frecuentes[i % frecuentes.size()],
+                                       frecuentes[(i + 1) % frecuentes.size()]}) {
+                SearchResults results = movieTrie.search(word);
+                vector<uint32_t> docs;
+                for (size_t r = 0; r < results.size(); ++r) docs.push_back(results.at(r).doc);
+                sort(docs.begin(), docs.end());
+                if (primero) {
+                    acumulado = docs;
+                    primero = false;
+                } else {
+                    vector<uint32_t> interseccion;
+                    set_intersection(acumulado.begin(), acumulado.end(), docs.begin(), docs.end(),
+                                     back_inserter(interseccion));
+                    acumulado.swap(interseccion);
                 }
-                movie->relevance_score++; // Incrementamos el relevance por cada coincidencia
             }
+            distintos += acumulado.size() != conteos[i];
+        }
+    });
+    cout << "rara AND frecuente AND frecuente (" << consultas.size() << " consultas, " << resultados << " resultados)\n";
+    cout << "  planificador + saltos:     " << msPlan * 1000.0 / consultas.size() << " us/consulta, "
+         << stats.blocksDecoded << " de " << stats.blocksTotal << " bloques decodificados\n";
+    cout << "  conjuntos completos:       " << msConjuntos * 1000.0 / consultas.size() << " us/consulta ("
+         << distintos << " conteos distintos)\n";
+
+    // Los prefijos se buscan entre las palabras tal como se escriben: palabra* y la
+    // palabra sin sus 2 últimas letras deben encontrar todas las películas de la
+    // palabra, aunque el índice guarde su raíz ("running" -> "run")
+    size_t prefijos = 0, incompletos = 0;
+    vector<string> palabras;
+    while (palabras.size() < 200) {
+        vector<string> words = movieTrie.splitWords(movies[rng() % movies.size()].plot_synopsis());
+        if (!words.empty()) palabras.push_back(words[rng() % words.size()]);
+    }
+    for (const string &word : palabras) {
+        SearchResults conPalabra = movieTrie.search(word);
+        for (const string &prefijo : {word, word.substr(0, max<size_t>(word.size(), 3) - 2)}) {
+            SearchResults conPrefijo = movieTrie.searchQuery(prefijo + "*");
+            vector<uint32_t> docs;
+            for (size_t r = 0; r < conPrefijo.size(); ++r) docs.push_back(conPrefijo.at(r).doc);
+            sort(docs.begin(), docs.end());
+            bool completo = true;
+            for (size_t r = 0; r < conPalabra.size(); ++r) {
+                completo = completo && binary_search(docs.begin(), docs.end(), conPalabra.at(r).doc);
+            }
+            ++prefijos;
+            incompletos += !completo;
         }
+    }
+    cout << "  palabra* y prefijo*:       " << incompletos << " de " << prefijos
+         << " prefijos no encuentran todas las películas de la palabra\n";
 
-        sort(result.begin(), result.end(), [](const shared_ptr<Movie> &a, const shared_ptr<Movie> &b) {
-            return a->relevance_score > b->relevance_score;
+    const TagIndex &tags = movieTrie.tags();
+    string tag = tags.size() ? tags.name(0) : "";
+    for (string consulta : {"(" + frecuentes[0] + " OR " + raras[0] + ") NOT " + frecuentes[1],
+                            raras[0].substr(0, 3) + "* AND " + frecuentes[0], "tag:\"" + tag + "\" AND " + raras[1],
+                            "\"" + frecuentes[0] + " " + frecuentes[1] + "\" OR " + raras[2]}) {
+        size_t count = 0;
+        double ms = medirMs([&]() {
+            for (int rep = 0; rep < 20; ++rep) count = movieTrie.searchQuery(consulta).size();
         });
+        cout << "  " << consulta << ": " << ms * 1000.0 / 20 << " us (" << count << " resultados)\n";
+    }
+}
 
-        return result;
+// Memoria del proceso en KB: la residente actual y el máximo que llegó a usar
+size_t memoriaActualKB() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.WorkingSetSize / 1024;
+#else
+    long pages = 0, resident = 0;
+    ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) / 1024;
+#endif
+}
+
+size_t memoriaPicoKB() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize / 1024;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // macOS lo da en bytes
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+// Benchmark de construcción: tiempo, pico de memoria y memoria que queda después
+// de congelar. Conviene correrlo solo, porque el pico es de todo el proceso.
+void benchmarkConstruccion(const string &filename) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    size_t base = memoriaActualKB();
+    cout << "Despues de leer el CSV: " << base / 1024 << " MB\n";
+    {
+        Trie movieTrie;
+        double msInsertar = medirMs([&]() { movieTrie.insert(move(movies)); });
+        size_t construido = memoriaActualKB();
+        double msCongelar = medirMs([&]() { movieTrie.freeze(); });
+        cout << "Insertar:  " << msInsertar << " ms (" << construido / 1024 << " MB)\n";
+        cout << "Congelar:  " << msCongelar << " ms\n";
+        cout << "Pico:      " << memoriaPicoKB() / 1024 << " MB\n";
+        cout << "Congelado: " << memoriaActualKB() / 1024 << " MB\n";
     }
+    // El catálogo pasa al Trie, así que se libera junto con el índice
+    cout << "Sin indice ni catalogo: " << memoriaActualKB() / 1024 << " MB\n";
+}
 
-    // Búsqueda por tags
-    vector<shared_ptr<Movie>> searchByTag(const string &tag) const {
-        vector<shared_ptr<Movie>> result;
-        for (const auto &movie : movies) {
-            if (movie->tags.find(tag) != string::npos) {
-                result.push_back(movie);
-                movie->relevance_score++; // Incrementar relevancia para tag coincidente
-            }
+// Benchmark de escalabilidad de la construcción: insertar y congelar con 1, 2, 4...
+// hilos hasta uno por núcleo. El snapshot de cada índice debe ser igual byte a byte
+// al construido con un hilo.
+void benchmarkConstruccionParalela(const string &filename, unsigned maxThreads = 0) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    if (maxThreads == 0) maxThreads = max(1u, thread::hardware_concurrency());
+    string referencia = filename + ".bench1.idx", path = filename + ".bench.idx";
+    double msUnHilo = 0;
+    for (unsigned numThreads = 1;; numThreads = min(numThreads * 2, maxThreads)) {
+        // Cada ronda indexa una copia del catálogo, porque el Trie se queda con él
+        MovieStore copia;
+        copia.append(movies);
+        Trie movieTrie;
+        double msInsertar = medirMs([&]() { movieTrie.insert(move(copia), numThreads); });
+        double msCongelar = medirMs([&]() { movieTrie.freeze(numThreads); });
+        double total = msInsertar + msCongelar;
+        if (numThreads == 1) msUnHilo = total;
+        movieTrie.saveSnapshot(numThreads == 1 ? referencia : path, filename);
+        bool igual = true;
+        if (numThreads > 1) {
+            MappedFile a(referencia), b(path);
+            igual = a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
         }
-        return result;
+        cout << numThreads << " hilo(s): insertar " << msInsertar << " ms, congelar " << msCongelar << " ms, total "
+             << total << " ms (x" << msUnHilo / total << ")" << (igual ? "" : " INDICE DISTINTO") << "\n";
+        if (numThreads == maxThreads) break;
     }
+    error_code error;
+    filesystem::remove(referencia, error);
+    filesystem::remove(path, error);
+}
 
-private:
-    shared_ptr<TrieNode> root;
-    vector<shared_ptr<Movie>> movies;
+// Benchmark del catálogo: un objeto por película con seis strings (formato anterior)
+// vs. columnas contiguas. Memoria que agrega cada formato y costo de recorrer títulos.
+void benchmarkCatalogo(const string &filename) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
 
-    void insertWord(const string &word, const shared_ptr<Movie> &movie, int score) {
-        shared_ptr<TrieNode> node = root;
-        for (char ch : word) {
-            ch = tolower(ch);
-            if (!node->children[ch]) {
-                node->children[ch] = make_shared<TrieNode>();
-            }
-            node = node->children[ch];
+    struct PeliculaSeparada {
+        string imdb_id, title, plot_synopsis, tags, split, synopsis_source;
+        bool liked = false, watch_later = false;
+    };
+    size_t antes = memoriaActualKB();
+    vector<shared_ptr<PeliculaSeparada>> separadas;
+    for (const Movie &movie : movies) {
+        shared_ptr<PeliculaSeparada> pelicula = make_shared<PeliculaSeparada>();
+        pelicula->imdb_id = movie.imdb_id();
+        pelicula->title = movie.title();
+        pelicula->plot_synopsis = movie.plot_synopsis();
+        pelicula->tags = movie.tags();
+        pelicula->split = movie.split();
+        pelicula->synopsis_source = movie.synopsis_source();
+        separadas.push_back(move(pelicula));
+    }
+    size_t kbSeparadas = memoriaActualKB() - antes;
+
+    antes = memoriaActualKB();
+    MovieStore columnas;
+    columnas.append(movies);
+    size_t kbColumnas = memoriaActualKB() - antes;
+
+    // Títulos que contienen "the", recorriendo todo el catálogo varias veces
+    const int rondas = 50;
+    size_t conteoSeparadas = 0, conteoColumnas = 0;
+    double msSeparadas = medirMs([&]() {
+        for (int ronda = 0; ronda < rondas; ++ronda) {
+            for (const auto &pelicula : separadas) conteoSeparadas += pelicula->title.find("the") != string::npos;
+        }
+    });
+    double msColumnas = medirMs([&]() {
+        for (int ronda = 0; ronda < rondas; ++ronda) {
+            for (const Movie &movie : columnas) conteoColumnas += movie.title().find("the") != string_view::npos;
         }
-        node->movies_with_word.push_back(movie);
+    });
+
+    cout << movies.size() << " peliculas, " << columnas.numValues(MovieStore::SPLIT) << " valores de split, "
+         << columnas.numValues(MovieStore::SYNOPSIS_SOURCE) << " de synopsis_source\n";
+    cout << "shared_ptr + seis strings: " << kbSeparadas / 1024.0 << " MB, recorrer titulos "
+         << msSeparadas * 1000.0 / rondas << " us (" << conteoSeparadas / rondas << " con \"the\")\n";
+    cout << "Columnas contiguas:        " << kbColumnas / 1024.0 << " MB (" << columnas.memoryBytes() / (1024.0 * 1024.0)
+         << " MB de datos), recorrer titulos " << msColumnas * 1000.0 / rondas << " us (" << conteoColumnas / rondas
+         << " con \"the\")\n";
+}
+
+// Benchmark de referencias a películas: resultados con un shared_ptr por película
+// (formato anterior) vs. números de película. Cada consulta arma sus resultados,
+// los ordena y copia 20 páginas de 5; cada copia de un shared_ptr es un incremento
+// y un decremento atómicos, que además compiten entre hilos en las películas comunes.
+void benchmarkReferencias(const string &filename, const string &queryLog) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    Trie movieTrie;
+    for (const auto &movie : movies) {
+        movieTrie.insert(movie);
     }
+    movieTrie.freeze();
 
-    vector<shared_ptr<Movie>> searchWord(const string &word) const {
-        shared_ptr<TrieNode> node = root;
-        for (char ch : word) {
-            ch = tolower(ch);
-            if (!node->children.count(ch)) {
-                return {};
-            }
-            node = node->children[ch];
+    struct ResultadoConPuntero {
+        shared_ptr<Movie> movie;
+        double score;
+        uint32_t doc;
+    };
+    vector<shared_ptr<Movie>> punteros;
+    for (uint32_t doc = 0; doc < movieTrie.allMovies().size(); ++doc) {
+        punteros.push_back(make_shared<Movie>(movieTrie.movie(doc)));
+    }
+
+    // Coincidencias de cada consulta en orden de doc, como salen del acumulador
+    vector<string> queries = cargarConsultas(queryLog, movies);
+    vector<vector<SearchResult>> coincidencias;
+    size_t copias = 0;
+    for (const string &query : queries) {
+        SearchResults results = movieTrie.search(query);
+        vector<SearchResult> matches = results.top(results.size());
+        sort(matches.begin(), matches.end(), [](const SearchResult &a, const SearchResult &b) { return a.doc < b.doc; });
+        copias += matches.size() + min<size_t>(matches.size(), 100);
+        coincidencias.push_back(move(matches));
+    }
+
+    auto consultaConIds = [](const vector<SearchResult> &matches) {
+        vector<SearchResult> results(matches.begin(), matches.end());
+        size_t ordenados = min<size_t>(results.size(), 100); // Como SearchResults: solo lo que se pagina
+        nth_element(results.begin(), results.begin() + ordenados, results.end(), betterResult);
+        sort(results.begin(), results.begin() + ordenados, betterResult);
+        size_t checksum = 0;
+        for (size_t pagina = 0; pagina < 20; ++pagina) {
+            size_t begin = min(pagina * 5, results.size()), end = min(begin + 5, results.size());
+            vector<SearchResult> copia(results.begin() + begin, results.begin() + end);
+            for (const SearchResult &result : copia) checksum += result.doc;
+        }
+        return checksum;
+    };
+    auto consultaConPunteros = [&](const vector<SearchResult> &matches) {
+        vector<ResultadoConPuntero> results;
+        results.reserve(matches.size());
+        for (const SearchResult &match : matches) results.push_back({punteros[match.doc], match.score, match.doc});
+        auto mejor = [](const ResultadoConPuntero &a, const ResultadoConPuntero &b) {
+            return a.score > b.score || (a.score == b.score && a.doc < b.doc);
+        };
+        size_t ordenados = min<size_t>(results.size(), 100);
+        nth_element(results.begin(), results.begin() + ordenados, results.end(), mejor);
+        sort(results.begin(), results.begin() + ordenados, mejor);
+        size_t checksum = 0;
+        for (size_t pagina = 0; pagina < 20; ++pagina) {
+            size_t begin = min(pagina * 5, results.size()), end = min(begin + 5, results.size());
+            vector<ResultadoConPuntero> copia(results.begin() + begin, results.begin() + end);
+            for (const ResultadoConPuntero &result : copia) checksum += result.doc;
+        }
+        return checksum;
+    };
+
+    cout << queries.size() << " consultas, " << (double)copias / queries.size()
+         << " copias de shared_ptr por consulta en el formato anterior\n";
+    cout << "sizeof resultado: " << sizeof(ResultadoConPuntero) << " bytes con shared_ptr, " << sizeof(SearchResult)
+         << " bytes con numero de pelicula\n";
+    unsigned maxThreads = max(1u, thread::hardware_concurrency());
+    for (unsigned numThreads = 1;; numThreads = min(numThreads * 2, maxThreads)) {
+        for (bool conPunteros : {true, false}) {
+            atomic<size_t> checksum(0);
+            double ms = medirMs([&]() {
+                vector<thread> workers;
+                for (unsigned t = 0; t < numThreads; ++t) {
+                    workers.emplace_back([&, t]() {
+                        size_t local = 0;
+                        for (size_t i = 0; i < coincidencias.size(); ++i) {
+                            const auto &matches = coincidencias[(i + t * 7919) % coincidencias.size()];
+                            local += conPunteros ? consultaConPunteros(matches) : consultaConIds(matches);
+                        }
+                        checksum += local;
+                    });
+                }
+                for (auto &worker : workers) worker.join();
+            });
+            cout << numThreads << " hilos, " << (conPunteros ? "shared_ptr<Movie>: " : "doc (uint32_t):    ")
+                 << coincidencias.size() * numThreads / (ms / 1000.0) << " consultas/s (checksum " << checksum
+                 << ")\n";
         }
-        return node->movies_with_word;
+        if (numThreads == maxThreads) break;
     }
+}
+
+// Benchmark del tokenizador: splitWords anterior (isalnum y tolower carácter por
+// carácter, un string por palabra) vs. Tokenizer con cada implementación disponible.
+// Los textos con UTF-8 pasan por el plegado de tildes y se miden aparte.
+void benchmarkTokenizador(const string &filename) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    size_t bytes = 0;
+    vector<string_view> textos[2]; // Solo ASCII, con UTF-8
+    size_t bytesTextos[2] = {0, 0};
+    for (const Movie &movie : movies) {
+        for (string_view text : {movie.title(), movie.plot_synopsis()}) {
+            bool utf8 = any_of(text.begin(), text.end(), [](char ch) { return (unsigned char)ch >= 0x80; });
+            textos[utf8].push_back(text);
+            bytesTextos[utf8] += text.size();
+            bytes += text.size();
+        }
+    }
+    const double mb = bytes / (1024.0 * 1024.0);
+    cout << "Textos con UTF-8: " << textos[1].size() << " de " << textos[0].size() + textos[1].size() << " ("
+         << bytesTextos[1] * 100.0 / bytes << "% de los bytes)\n";
 
-    vector<string> splitWords(const string &text) const {
+    auto splitAnterior = [](string_view text) {
         vector<string> words;
         string word;
         for (char ch : text) {
-            if (isalnum(ch)) {
-                word += tolower(ch);
+            if (isalnum((unsigned char)ch)) {
+                word += (char)tolower((unsigned char)ch);
             } else if (!word.empty()) {
                 words.push_back(word);
                 word.clear();
             }
         }
-        if (!word.empty()) {
-            words.push_back(word);
-        }
+        if (!word.empty()) words.push_back(word);
         return words;
+    };
+
+    size_t tokens = 0;
+    double ms = 1e18;
+    for (int ronda = 0; ronda < 3; ++ronda) {
+        tokens = 0;
+        ms = min(ms, medirMs([&]() {
+            for (const Movie &movie : movies) {
+                tokens += splitAnterior(movie.title()).size() + splitAnterior(movie.plot_synopsis()).size();
+            }
+        }));
     }
-};
+    cout << "splitWords anterior: " << tokens / (ms / 1000.0) / 1e6 << " M palabras/s, " << mb / (ms / 1000.0)
+         << " MB/s (" << tokens << " palabras)\n";
 
-// Algoritmo de relevancia para filtrar y ordenar resultados
-vector<shared_ptr<Movie>> getTopRelevantMovies(const vector<shared_ptr<Movie>> &movies, int topN = 5) {
-    vector<shared_ptr<Movie>> sortedMovies = movies;
-    sort(sortedMovies.begin(), sortedMovies.end(), [](const shared_ptr<Movie> &a, const shared_ptr<Movie> &b) {
-        return a->relevance_score > b->relevance_score;
-    });
+    // Referencia: el splitWords anterior en los textos ASCII y el kernel escalar en
+    // los que tienen UTF-8, donde el anterior cortaba las palabras en cada tilde
+    const char *nombres[] = {"escalar", "SSE2", "AVX2"};
+    Tokenizer tokenizer, referencia;
+    for (Tokenizer::Kernel kernel : {Tokenizer::SCALAR, Tokenizer::SSE2, Tokenizer::AVX2}) {
+        if (!Tokenizer::supported(kernel)) continue;
+        size_t distintas = 0;
+        for (string_view text : textos[0]) {
+            vector<string> esperadas = splitAnterior(text);
+            const vector<string_view> &palabras = tokenizer.split(text, kernel);
+            distintas += !equal(esperadas.begin(), esperadas.end(), palabras.begin(), palabras.end());
+        }
+        for (string_view text : textos[1]) {
+            const vector<string_view> &esperadas = referencia.split(text, Tokenizer::SCALAR);
+            const vector<string_view> &palabras = tokenizer.split(text, kernel);
+            distintas += esperadas != palabras;
+        }
+        cout << "Tokenizer " << nombres[kernel] << (kernel == Tokenizer::bestKernel() ? " (elegido)" : "") << ":";
+        const char *grupos[] = {"ASCII", "UTF-8"};
+        for (int utf8 = 0; utf8 < 2; ++utf8) {
+            ms = 1e18;
+            for (int ronda = 0; ronda < 3; ++ronda) {
+                tokens = 0;
+                ms = min(ms, medirMs([&]() {
+                    for (string_view text : textos[utf8]) tokens += tokenizer.split(text, kernel).size();
+                }));
+            }
+            cout << " " << grupos[utf8] << " " << tokens / (ms / 1000.0) / 1e6 << " M palabras/s, "
+                 << bytesTextos[utf8] / (1024.0 * 1024.0) / (ms / 1000.0) << " MB/s;";
+        }
+        cout << " " << distintas << " textos distintos\n";
+    }
+}
 
-    if (sortedMovies.size() > topN) {
-        sortedMovies.resize(topN);
+// Benchmark del análisis: índice sin quitar palabras vacías ni recortar raíces vs.
+// el análisis por omisión (título con raíces, sinopsis sin palabras vacías y con
+// raíces). Tamaño del índice y latencia de consultas en lenguaje natural.
+void benchmarkAnalisis(const string &filename, const string &queryLog) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    vector<string> queries = cargarConsultas(queryLog, movies);
+
+    const double mb = 1024.0 * 1024.0;
+    for (bool analizar : {false, true}) {
+        Trie movieTrie;
+        if (!analizar) movieTrie.setAnalysis(FieldAnalysis::none(), FieldAnalysis::none());
+        double msConstruir = medirMs([&]() {
+            for (const auto &movie : movies) {
+                movieTrie.insert(movie);
+            }
+            movieTrie.freeze();
+        });
+        size_t resultados = 0;
+        double msTodas = medirMs([&]() {
+            for (const string &query : queries) resultados += movieTrie.search(query).size();
+        });
+        double msTop = medirMs([&]() {
+            for (const string &query : queries) movieTrie.searchTopK(query, 10);
+        });
+        cout << (analizar ? "Con analisis" : "Sin analisis") << " (construccion " << msConstruir << " ms)\n";
+        cout << "  diccionario " << movieTrie.dictionaryBytes() / mb << " MB, listas " << movieTrie.postingsBytes() / mb
+             << " MB, posiciones " << movieTrie.positionsBytes() / mb << " MB\n";
+        cout << "  todas las coincidencias: " << msTodas * 1000.0 / queries.size() << " us/consulta ("
+             << resultados / queries.size() << " resultados)\n";
+        cout << "  top 10 (Block-Max WAND): " << msTop * 1000.0 / queries.size() << " us/consulta\n";
     }
-    return sortedMovies;
 }
 
-class PlataformaStreaming {
-private:
-    vector<shared_ptr<Movie>> movies;      // Todas las películas cargadas
-    vector<shared_ptr<Movie>> watchLater; // Películas marcadas como "Ver más tarde"
-    vector<shared_ptr<Movie>> likedMovies; // Películas marcadas con "Like"
+// Benchmark de autocompletado: costo por tecla de la caché por nodo, del recorrido
+// del subárbol sin caché y de una consulta completa con la palabra a medio escribir
+void benchmarkAutocompletado(const string &filename, const string &queryLog) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    Trie movieTrie;
+    for (const auto &movie : movies) {
+        movieTrie.insert(movie);
+    }
+    movieTrie.freeze();
 
-public:
-    void agregarPelicula(const shared_ptr<Movie> &movie) {
-        movies.push_back(movie);
+    // Cada palabra de las consultas se "escribe" tecla por tecla
+    vector<string> prefijos;
+    for (const string &query : cargarConsultas(queryLog, movies)) {
+        for (const string &word : movieTrie.splitWords(query)) {
+            for (size_t len = 1; len <= word.size(); ++len) {
+                prefijos.push_back(word.substr(0, len));
+            }
+        }
     }
+    if (prefijos.empty()) return;
 
-    void mostrarPeliculasGuardadas() {
-        cout << "Peliculas añadidas a 'Ver más tarde':\n";
-        for (const auto &movie : watchLater) {
-            cout << "Titulo: " << movie->title << "\n";
-            cout << "Sinopsis: " << movie->plot_synopsis << "\n\n";
+    size_t sugerencias = 0;
+    double msCache = medirMs([&]() {
+        for (const string &prefijo : prefijos) sugerencias += movieTrie.complete(prefijo, 5).size();
+    });
+    double msSubarbol = medirMs([&]() {
+        for (const string &prefijo : prefijos) movieTrie.complete(prefijo, Trie::COMPLETION_CACHE + 1);
+    });
+    double msPrefijo = medirMs([&]() {
+        for (const string &prefijo : prefijos) movieTrie.searchPrefix(prefijo, 5);
+    });
+    double msConsulta = medirMs([&]() {
+        for (const string &prefijo : prefijos) movieTrie.search(prefijo).top(5);
+    });
+
+    cout << prefijos.size() << " teclas (" << sugerencias << " sugerencias)\n";
+    cout << "  caché por nodo:      " << msCache * 1000.0 / prefijos.size() << " us/tecla\n";
+    cout << "  recorrer subárbol:   " << msSubarbol * 1000.0 / prefijos.size() << " us/tecla\n";
+    cout << "  top-5 por prefijo:   " << msPrefijo * 1000.0 / prefijos.size() << " us/tecla\n";
+    cout << "  consulta completa:   " << msConsulta * 1000.0 / prefijos.size() << " us/tecla\n";
+}
+
+// Benchmark de pesos por campo: todos los campos con el mismo peso (como cuando el
+// título y la sinopsis eran un solo texto) vs. los pesos por omisión. Mide el costo
+// de las consultas y, buscando el título de películas al azar, en qué lugar queda
+// esa película. Block-Max WAND debe dar el mismo top 10 que puntuar todo.
+void benchmarkCampos(const string &filename, const string &queryLog) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    vector<string> queries = cargarConsultas(queryLog, movies);
+
+    mt19937 rng(7);
+    vector<uint32_t> buscadas;
+    for (size_t i = 0; i < 500; ++i) buscadas.push_back((uint32_t)(rng() % movies.size()));
+
+    const double mb = 1024.0 * 1024.0;
+    for (bool pesos : {false, true}) {
+        Trie movieTrie;
+        movieTrie.setFieldBoosts(pesos ? FieldBoosts() : FieldBoosts::uniform());
+        for (const auto &movie : movies) {
+            movieTrie.insert(movie);
+        }
+        movieTrie.freeze();
+
+        size_t distintos = 0;
+        double msTodas = medirMs([&]() {
+            for (const string &query : queries) movieTrie.search(query).top(10);
+        });
+        double msTop = medirMs([&]() {
+            for (const string &query : queries) movieTrie.searchTopK(query, 10);
+        });
+        for (const string &query : queries) {
+            vector<SearchResult> esperado = movieTrie.search(query).top(10), obtenido = movieTrie.searchTopK(query, 10);
+            bool iguales = esperado.size() == obtenido.size();
+            for (size_t i = 0; iguales && i < esperado.size(); ++i) iguales = esperado[i].doc == obtenido[i].doc;
+            if (!iguales) ++distintos;
+        }
+
+        // Lugar de la película buscada por su título (varias películas pueden
+        // compartir título: cuenta cualquiera con el mismo)
+        size_t primero = 0, enTop10 = 0;
+        double reciproco = 0;
+        for (uint32_t doc : buscadas) {
+            string titulo(movies[doc].title());
+            vector<SearchResult> top = movieTrie.searchTopK(titulo, 10);
+            for (size_t i = 0; i < top.size(); ++i) {
+                if (movieTrie.movie(top[i].doc).title() != titulo) continue;
+                if (i == 0) ++primero;
+                ++enTop10;
+                reciproco += 1.0 / (i + 1);
+                break;
+            }
         }
+
+        const FieldBoosts &b = movieTrie.fieldBoosts();
+        cout << "Pesos titulo " << b.title << ", sinopsis " << b.synopsis << ", tags " << b.tags << " (listas "
+             << movieTrie.postingsBytes() / mb << " MB)\n";
+        cout << "  todas las coincidencias + top 10: " << msTodas * 1000.0 / queries.size() << " us/consulta\n";
+        cout << "  top 10 (Block-Max WAND):          " << msTop * 1000.0 / queries.size() << " us/consulta ("
+             << distintos << " rankings distintos)\n";
+        cout << "  buscar por titulo: " << primero * 100.0 / buscadas.size() << "% primera, " << enTop10 * 100.0 / buscadas.size()
+             << "% en el top 10, MRR " << reciproco / buscadas.size() << "\n";
     }
+}
 
-    void mostrarPeliculasSimilares() {
-        cout << "Películas similares a las que diste 'Like':\n";
-        for (const auto &likedMovie : likedMovies) {
-            cout << "Titulo: " << likedMovie->title << " (Pelicula similar)\n";
-            cout << "Sinopsis: " << likedMovie->plot_synopsis << "\n\n";
+// Benchmark de recomendaciones: conjuntos de 1 a 5 películas con "Like". Acumular
+// sobre las listas con poda vs. calcular el coseno con todas las películas; deben
+// dar las mismas películas.
+void benchmarkSimilares(const string &filename) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    Trie movieTrie;
+    movieTrie.insert(move(movies));
+    movieTrie.freeze();
+    size_t numMovies = movieTrie.allMovies().size();
+
+    mt19937 rng(42);
+    vector<vector<uint32_t>> likes(200);
+    for (auto &liked : likes) {
+        for (size_t i = 0, n = 1 + rng() % 5; i < n; ++i) liked.push_back((uint32_t)(rng() % numMovies));
+    }
+
+    const size_t k = 10;
+    vector<vector<SearchResult>> aproximado(likes.size()), exacto(likes.size());
+    double msIndice = medirMs([&]() {
+        for (size_t q = 0; q < likes.size(); ++q) aproximado[q] = movieTrie.similarMovies(likes[q], k);
+    });
+
+    vector<vector<pair<uint32_t, float>>> vectores(numMovies);
+    double msVectores = medirMs([&]() {
+        for (uint32_t doc = 0; doc < numMovies; ++doc) vectores[doc] = movieTrie.termVector(doc);
+    });
+    double msTodos = medirMs([&]() {
+        for (size_t q = 0; q < likes.size(); ++q) {
+            unordered_map<uint32_t, double> consulta;
+            for (uint32_t doc : likes[q]) {
+                for (const auto &entry : vectores[doc]) consulta[entry.first] += entry.second;
+            }
+            vector<SearchResult> puntajes;
+            for (uint32_t doc = 0; doc < numMovies; ++doc) {
+                if (find(likes[q].begin(), likes[q].end(), doc) != likes[q].end()) continue;
+                double score = 0;
+                for (const auto &entry : vectores[doc]) {
+                    auto it = consulta.find(entry.first);
+                    if (it != consulta.end()) score += it->second * entry.second;
+                }
+                if (score > 0) puntajes.push_back({doc, score});
+            }
+            exacto[q] = SearchResults(move(puntajes)).top(k);
+        }
+    });
+
+    size_t comunes = 0, total = 0;
+    for (size_t q = 0; q < likes.size(); ++q) {
+        for (const SearchResult &result : exacto[q]) {
+            ++total;
+            for (const SearchResult &other : aproximado[q]) comunes += other.doc == result.doc;
         }
     }
+    cout << likes.size() << " conjuntos de 1 a 5 peliculas, top " << k << "\n";
+    cout << "  listas con poda MaxScore:       " << msIndice / likes.size() << " ms/consulta\n";
+    cout << "  coseno con todas las peliculas: " << msTodos / likes.size() << " ms/consulta (vectores: "
+         << msVectores << " ms)\n";
+    cout << "  " << (total ? comunes * 100.0 / total : 100.0) << "% del top " << k << " exacto\n";
+}
 
-    void mostrarResultadosBusqueda(const vector<shared_ptr<Movie>> &results, int offset) {
-        int limite = 5;
-        int start = offset * limite;
-        int end = min(start + limite, (int)results.size());
+// Benchmark del índice HNSW: construcción con uno y con todos los hilos, y para
+// "más como esta" de películas al azar, recall@10 y latencia según ef contra comparar
+// con todas las películas (con cada kernel del producto punto)
+void benchmarkHnsw(const string &filename) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    Trie movieTrie;
+    movieTrie.insert(move(movies));
+    movieTrie.freeze();
+    size_t numMovies = movieTrie.allMovies().size();
 
-        cout << "Mostrando peliculas " << start + 1 << " a " << end << ":\n";
-        for (int i = start; i < end; i++) {
-            cout << i + 1 << ". Título: " << results[i]->title << "\n";
-            cout << "Sinopsis: " << results[i]->plot_synopsis << "\n";
-            cout << "Relevance Score: " << results[i]->relevance_score << "\n";
-            cout << "-----------------------" << "\n\n";
+    unsigned maxThreads = max(1u, thread::hardware_concurrency());
+    HnswIndex index;
+    for (unsigned numThreads : {1u, maxThreads}) {
+        double ms = medirMs([&]() { index.build(movieTrie, numThreads); });
+        cout << "Construir con " << numThreads << " hilo(s): " << ms << " ms\n";
+        if (numThreads == maxThreads) break;
+    }
+    cout << "Memoria del índice: " << index.memoryBytes() / (1024.0 * 1024.0) << " MB\n";
+
+    mt19937 rng(42);
+    vector<uint32_t> consultas(500);
+    for (uint32_t &doc : consultas) doc = (uint32_t)(rng() % numMovies);
+    const size_t k = 10;
+
+    // Exacto: producto punto con todas las películas
+    vector<vector<SearchResult>> exacto(consultas.size());
+    const char *nombres[] = {"escalar", "SSE2", "AVX2"};
+    for (Tokenizer::Kernel kernel : {Tokenizer::SCALAR, Tokenizer::SSE2, Tokenizer::AVX2}) {
+        if (!Tokenizer::supported(kernel)) continue;
+        double ms = medirMs([&]() {
+            for (size_t q = 0; q < consultas.size(); ++q) {
+                const float *query = index.embedding(consultas[q]);
+                vector<SearchResult> puntajes;
+                puntajes.reserve(numMovies);
+                for (uint32_t doc = 0; doc < numMovies; ++doc) {
+                    if (doc != consultas[q]) puntajes.push_back({doc, HnswIndex::dot(query, index.embedding(doc), kernel)});
+                }
+                exacto[q] = SearchResults(move(puntajes)).top(k);
+            }
+        });
+        cout << "Todas las peliculas (" << nombres[kernel] << "): " << ms / consultas.size() << " ms/consulta\n";
+    }
+
+    for (size_t ef : {10, 20, 40, 80, 160, 320}) {
+        vector<vector<SearchResult>> aproximado(consultas.size());
+        double ms = medirMs([&]() {
+            for (size_t q = 0; q < consultas.size(); ++q) aproximado[q] = index.similarTo({consultas[q]}, k, ef);
+        });
+        size_t comunes = 0, total = 0;
+        for (size_t q = 0; q < consultas.size(); ++q) {
+            for (const SearchResult &result : exacto[q]) {
+                ++total;
+                for (const SearchResult &other : aproximado[q]) comunes += other.doc == result.doc;
+            }
         }
+        cout << "HNSW ef=" << ef << ": " << ms / consultas.size() << " ms/consulta, recall@" << k << " "
+             << (total ? comunes * 100.0 / total : 100.0) << "%\n";
     }
 
-    void marcarLike(const shared_ptr<Movie> &movie) {
-        movie->liked = true;
-        likedMovies.push_back(movie);
-        cout << "Pelicula marcada con 'Like'.\n";
+    string path = filename + ".bench.hnsw";
+    double msGuardar = medirMs([&]() { index.save(path, filename); });
+    HnswIndex cargado;
+    bool ok = false;
+    double msCargar = medirMs([&]() { ok = cargado.load(path, filename, numMovies); });
+    size_t distintas = 0;
+    for (uint32_t doc : consultas) {
+        vector<SearchResult> a = index.similarTo({doc}, k), b = cargado.similarTo({doc}, k);
+        distintas += a.size() != b.size() || !equal(a.begin(), a.end(), b.begin(), [](const SearchResult &x, const SearchResult &y) {
+                         return x.doc == y.doc;
+                     });
     }
+    cout << "Guardar: " << msGuardar << " ms, cargar: " << msCargar << " ms (" << (ok ? "" : "falló, ") << distintas
+         << " de " << consultas.size() << " consultas distintas)\n";
+    error_code error;
+    filesystem::remove(path, error);
+}
 
-    void marcarVerMasTarde(const shared_ptr<Movie> &movie) {
-        movie->watch_later = true;
-        watchLater.push_back(movie);
-        cout << "Pelicula añadida a 'Ver más tarde'.\n";
+// Benchmark de casi duplicadas: firmas MinHash con uno y con todos los hilos, baldes
+// de LSH, y comparación de todos los pares con el Jaccard exacto sobre una muestra
+// (con la cantidad de pares que LSH encuentra). Al final, el índice con y sin las
+// duplicadas.
+void benchmarkDuplicados(const string &filename) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+
+    unsigned maxThreads = max(1u, thread::hardware_concurrency());
+    vector<NearDuplicates::Signature> firmas;
+    for (unsigned numThreads : {1u, maxThreads}) {
+        double ms = medirMs([&]() { firmas = NearDuplicates::signatures(movies, numThreads); });
+        cout << "Firmas MinHash con " << numThreads << " hilo(s): " << ms << " ms\n";
+        if (numThreads == maxThreads) break;
+    }
+    vector<uint32_t> grupos, mismas;
+    double msLSH = medirMs([&]() { grupos = NearDuplicates::groups(firmas); });
+    double msMismas = medirMs([&]() { mismas = NearDuplicates::sameMovie(movies, grupos); });
+    size_t duplicadas = 0, copias = 0;
+    for (uint32_t doc = 0; doc < grupos.size(); ++doc) {
+        duplicadas += grupos[doc] != doc;
+        copias += mismas[doc] != doc;
     }
+    cout << "Baldes LSH: " << msLSH << " ms, " << duplicadas << " de " << movies.size() << " peliculas son casi duplicadas\n";
+    cout << "Misma pelicula (imdb_id o titulo): " << msMismas << " ms, " << copias << " copias se unen y "
+         << duplicadas - copias << " peliculas distintas con sinopsis parecida se mantienen\n";
 
-    void mostrarResultadosBusquedaSinopsis(const vector<shared_ptr<Movie>> &results, int offset) {
-        int limite = 5;
-        int start = offset * limite;
-        int end = min(start + limite, (int)results.size());
+    // Cada película del grupo debe parecerse a la primera, no solo a otra del grupo
+    size_t lejos = 0;
+    for (uint32_t doc = 0; doc < grupos.size(); ++doc) {
+        lejos += NearDuplicates::similarity(firmas[doc], firmas[grupos[doc]]) < NearDuplicates::THRESHOLD;
+    }
+    cout << "Peliculas con Jaccard estimado < " << NearDuplicates::THRESHOLD << " con la primera de su grupo: " << lejos
+         << "\n";
 
-        cout << "Mostrando peliculas " << start + 1 << " a " << end << ":\n";
-        for (int i = start; i < end; i++) {
-            cout << i + 1 << ". Titulo: " << results[i]->title << "\n";
+    // Todos los pares de una muestra con el Jaccard exacto de los grupos de palabras
+    size_t muestra = min<size_t>(movies.size(), 1500);
+    vector<vector<uint64_t>> conjuntos(muestra);
+    for (size_t doc = 0; doc < muestra; ++doc) {
+        NearDuplicates::forEachShingle(movies[(uint32_t)doc].plot_synopsis(),
+                                       [&](uint64_t shingle) { conjuntos[doc].push_back(shingle); });
+        sort(conjuntos[doc].begin(), conjuntos[doc].end());
+        conjuntos[doc].erase(unique(conjuntos[doc].begin(), conjuntos[doc].end()), conjuntos[doc].end());
+    }
+    size_t pares = 0, encontrados = 0;
+    double msPares = medirMs([&]() {
+        for (size_t a = 0; a < muestra; ++a) {
+            for (size_t b = a + 1; b < muestra; ++b) {
+                const vector<uint64_t> &x = conjuntos[a], &y = conjuntos[b];
+                if (x.empty() || y.empty()) continue;
+                size_t comunes = 0;
+                for (size_t i = 0, j = 0; i < x.size() && j < y.size();) {
+                    if (x[i] < y[j]) ++i;
+                    else if (y[j] < x[i]) ++j;
+                    else ++comunes, ++i, ++j;
+                }
+                if (comunes >= NearDuplicates::THRESHOLD * (x.size() + y.size() - comunes)) {
+                    ++pares;
+                    encontrados += grupos[a] == grupos[b];
+                }
+            }
+        }
+    });
+    double escala = (double)movies.size() * movies.size() / ((double)muestra * muestra);
+    cout << "Todos los pares de " << muestra << " peliculas: " << msPares << " ms (~" << msPares * escala / 1000.0
+         << " s para el catalogo), " << pares << " pares con Jaccard >= " << NearDuplicates::THRESHOLD << ", LSH une "
+         << (pares ? encontrados * 100.0 / pares : 100.0) << "%\n";
+
+    size_t numMovies = movies.size();
+    Trie conDuplicadas, sinDuplicadas;
+    MovieStore unidas = NearDuplicates::collapse(movies, mismas);
+    size_t numUnidas = unidas.size();
+    conDuplicadas.insert(move(movies));
+    conDuplicadas.freeze();
+    sinDuplicadas.insert(move(unidas));
+    sinDuplicadas.freeze();
+    cout << "Indice con duplicadas: " << numMovies << " peliculas, " << conDuplicadas.postingsBytes() / 1024
+         << " KB de listas\n";
+    cout << "Indice sin duplicadas: " << numUnidas << " peliculas, " << sinDuplicadas.postingsBytes() / 1024
+         << " KB de listas\n";
+}
+
+// Benchmark del índice por segmentos: el 90% del catálogo es el índice inicial y el
+// resto se agrega de a una película mientras otro hilo busca; después se actualiza
+// el 1% y se borra el 5%. Latencia de los cambios y de las búsquedas antes y
+// después de las uniones de fondo, contra reconstruir el índice desde cero, y
+// cuántas consultas encuentran otras películas que el índice reconstruido.
+void benchmarkIncremental(const string &filename, const string &queryLog) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.size() < 2) return;
+    vector<string> consultas = cargarConsultas(queryLog, movies, 500);
+    auto copiar = [](MovieStore &into, const Movie &movie) {
+        into.add(movie.imdb_id(), movie.title(), movie.plot_synopsis(), movie.tags(), movie.split(),
+                 movie.synopsis_source());
+    };
+    auto percentil = [](vector<double> valores, double p) {
+        if (valores.empty()) return 0.0;
+        sort(valores.begin(), valores.end());
+        return valores[min(valores.size() - 1, (size_t)(p * valores.size()))];
+    };
+    auto promedio = [](const vector<double> &valores) {
+        double suma = 0;
+        for (double valor : valores) suma += valor;
+        return valores.empty() ? 0.0 : suma / valores.size();
+    };
+    auto medirBusquedas = [&](auto &&buscar) {
+        vector<double> us;
+        for (const string &consulta : consultas) us.push_back(medirMs([&]() { buscar(consulta); }) * 1000.0);
+        return us;
+    };
+
+    uint32_t numBase = (uint32_t)(movies.size() * 9 / 10);
+    MovieStore inicial;
+    for (uint32_t doc = 0; doc < numBase; ++doc) copiar(inicial, movies[doc]);
+    auto base = make_shared<Trie>();
+    double msBase = medirMs([&]() {
+        base->insert(move(inicial));
+        base->freeze();
+    });
+    cout << "Indice inicial: " << numBase << " peliculas en " << msBase << " ms\n";
+
+    SegmentedIndex indice(base);
+    PlataformaStreaming plataforma(indice);
+    atomic<bool> cambiando{true};
+    vector<double> usDurante;
+    thread lector([&]() {
+        for (size_t i = 0; cambiando; i = (i + 1) % consultas.size()) {
+            usDurante.push_back(medirMs([&]() { indice.view()->searchTopK(consultas[i], 10); }) * 1000.0);
         }
+    });
+
+    vector<double> msAgregar, msActualizar, msBorrar;
+    for (uint32_t doc = numBase; doc < movies.size(); ++doc) {
+        msAgregar.push_back(medirMs([&]() { plataforma.agregarPelicula(movies[doc]); }));
+    }
+    mt19937 rng(42);
+    MovieStore cambios;
+    for (size_t i = 0; i < movies.size() / 100; ++i) {
+        uint32_t doc = rng() % movies.size();
+        Movie movie = movies[doc];
+        cambios.add(movie.imdb_id(), string(movie.title()) + " (version extendida)", movie.plot_synopsis(),
+                    movie.tags(), movie.split(), movie.synopsis_source());
+        msActualizar.push_back(medirMs([&]() { plataforma.actualizarPelicula(doc, cambios[(uint32_t)i]); }));
     }
+    for (size_t i = 0; i < movies.size() / 20; ++i) {
+        uint32_t doc = rng() % movies.size();
+        msBorrar.push_back(medirMs([&]() { plataforma.eliminarPelicula(doc); }));
+    }
+    cambiando = false;
+    lector.join();
 
-};
+    cout << "Agregar: " << msAgregar.size() << " peliculas, " << promedio(msAgregar) << " ms promedio, p99 "
+         << percentil(msAgregar, 0.99) << " ms\n";
+    cout << "Actualizar: " << msActualizar.size() << " peliculas, " << promedio(msActualizar) << " ms promedio, p99 "
+         << percentil(msActualizar, 0.99) << " ms\n";
+    cout << "Borrar: " << msBorrar.size() << " peliculas, " << promedio(msBorrar) << " ms promedio, p99 "
+         << percentil(msBorrar, 0.99) << " ms\n";
+    cout << "Busquedas top-10 durante los cambios: " << usDurante.size() << ", " << promedio(usDurante)
+         << " us promedio, p99 " << percentil(usDurante, 0.99) << " us\n";
 
-vector<shared_ptr<Movie>> readMoviesFromCSV(const string &filename) {
-    vector<shared_ptr<Movie>> movies;
-    ifstream file(filename);
+    auto vista = indice.view();
+    vector<double> usSegmentos = medirBusquedas([&](const string &consulta) { vista->searchTopK(consulta, 10); });
+    cout << "Busquedas top-10 con " << vista->parts.size() << " segmentos (" << indice.merges() << " uniones): "
+         << promedio(usSegmentos) << " us promedio, p99 " << percentil(usSegmentos, 0.99) << " us\n";
 
-    if (!file.is_open()) {
-        cerr << "Error opening file" << endl;
-        return movies;
+    double msUniones = medirMs([&]() { indice.waitForMerges(); });
+    vista = indice.view();
+    usSegmentos = medirBusquedas([&](const string &consulta) { vista->searchTopK(consulta, 10); });
+    cout << "Tras esperar " << msUniones << " ms las uniones de fondo, " << vista->parts.size() << " segmentos ("
+         << indice.merges() << " uniones): " << promedio(usSegmentos) << " us promedio, p99 "
+         << percentil(usSegmentos, 0.99) << " us\n";
+
+    // Desde cero, con las mismas películas vivas
+    MovieStore vivas;
+    for (uint32_t id = 0; id < vista->endId; ++id) {
+        if (vista->contains(id)) copiar(vivas, vista->movie(id));
     }
+    size_t numVivas = vivas.size();
+    Trie reconstruido;
+    double msReconstruir = medirMs([&]() {
+        reconstruido.insert(move(vivas));
+        reconstruido.freeze();
+    });
+    vector<double> usReconstruido = medirBusquedas([&](const string &consulta) { reconstruido.searchTopK(consulta, 10); });
+    cout << "Reconstruir " << numVivas << " peliculas: " << msReconstruir << " ms; busquedas top-10 "
+         << promedio(usReconstruido) << " us promedio, p99 " << percentil(usReconstruido, 0.99) << " us\n";
 
-    string line;
-    getline(file, line); // Saltar la cabecera
+    // Coincidencias por código IMDb, porque los números de película no son los mismos
+    auto codigos = [](auto &&resultados, auto &&pelicula) {
+        vector<string> ids;
+        for (const SearchResult &result : resultados) ids.push_back(string(pelicula(result.doc).imdb_id()));
+        return ids;
+    };
+    auto enVista = [&](uint32_t id) { return vista->movie(id); };
+    auto enReconstruido = [&](uint32_t doc) { return reconstruido.movie(doc); };
+    size_t distintas = 0, comunes = 0, total = 0;
+    for (const string &consulta : consultas) {
+        vector<string> a = codigos(vista->search(consulta).unsorted(), enVista);
+        vector<string> b = codigos(reconstruido.search(consulta).unsorted(), enReconstruido);
+        sort(a.begin(), a.end());
+        sort(b.begin(), b.end());
+        distintas += a != b;
 
-    while (getline(file, line)) {
-        stringstream ss(line);
-        shared_ptr<Movie> movie = make_shared<Movie>();
+        vector<string> topA = codigos(vista->searchTopK(consulta, 10), enVista);
+        vector<string> topB = codigos(reconstruido.searchTopK(consulta, 10), enReconstruido);
+        for (const string &id : topA) comunes += find(topB.begin(), topB.end(), id) != topB.end();
+        total += topB.size();
+    }
+    cout << "Consultas con otras coincidencias que el indice reconstruido: " << distintas << " de " << consultas.size()
+         << "; top-10 en comun: " << (total ? comunes * 100.0 / total : 100.0) << "%\n";
+}
+
+// Distancia de edición entre dos palabras con programación dinámica, para comparar
+int distanciaEdicion(const string &a, const string &b) {
+    vector<int> fila(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); ++j) fila[j] = (int)j;
+    for (size_t i = 1; i <= a.size(); ++i) {
+        int diagonal = fila[0];
+        fila[0] = (int)i;
+        for (size_t j = 1; j <= b.size(); ++j) {
+            int arriba = fila[j];
+            fila[j] = min({fila[j] + 1, fila[j - 1] + 1, diagonal + (a[i - 1] != b[j - 1])});
+            diagonal = arriba;
+        }
+    }
+    return fila[b.size()];
+}
 
-        getline(ss, movie->imdb_id, ',');
-        getline(ss, movie->title, ',');
-        getline(ss, movie->plot_synopsis, ',');
-        getline(ss, movie->tags, ',');
-        getline(ss, movie->split, ',');
-        getline(ss, movie->synopsis_source, ',');
+// Benchmark de búsqueda tolerante a errores: palabras de las sinopsis con 1 o 2
+// errores de tipeo. Autómata de Levenshtein sobre el Trie vs. calcular la distancia
+// a cada palabra del diccionario; ambos deben encontrar las mismas palabras.
+void benchmarkDifuso(const string &filename) {
+    MovieStore movies = readMoviesFromCSVParallel(filename);
+    if (movies.empty()) return;
+    Trie movieTrie;
+    movieTrie.setAnalysis(FieldAnalysis::none(), FieldAnalysis::none());
+    movieTrie.insert(move(movies));
+    movieTrie.freeze();
+    const MovieStore &catalogo = movieTrie.allMovies();
 
-        if (movie->imdb_id.empty() || movie->title.empty() || movie->plot_synopsis.empty()) {
-            continue;
+    // Palabras de 4 letras o más con una o dos ediciones al azar
+    mt19937 rng(42);
+    vector<pair<string, uint32_t>> erradas;
+    while (erradas.size() < 200) {
+        vector<string> words = movieTrie.splitWords(catalogo[rng() % catalogo.size()].plot_synopsis());
+        if (words.empty()) continue;
+        string word = words[rng() % words.size()];
+        if (word.size() < 4) continue;
+        uint32_t ediciones = 1 + rng() % 2;
+        for (uint32_t e = 0; e < ediciones; ++e) {
+            size_t i = rng() % word.size();
+            char letra = (char)('a' + rng() % 26);
+            switch (rng() % 3) {
+            case 0: word[i] = letra; break;
+            case 1: word.insert(word.begin() + i, letra); break;
+            default: word.erase(i, 1); break;
+            }
         }
+        erradas.push_back({word, ediciones});
+    }
 
-        movies.push_back(movie);
+    for (uint32_t distancia : {1u, 2u}) {
+        size_t nodos = 0, encontradas = 0, distintas = 0;
+        vector<vector<string>> automata(erradas.size()), recorrido(erradas.size());
+        double msAutomata = medirMs([&]() {
+            for (size_t q = 0; q < erradas.size(); ++q) {
+                for (const auto &correccion : movieTrie.corrections(erradas[q].first, distancia, &nodos)) {
+                    automata[q].push_back(correccion.word);
+                }
+            }
+        });
+        double msRecorrido = medirMs([&]() {
+            for (size_t q = 0; q < erradas.size(); ++q) {
+                for (uint32_t term = 0; term < movieTrie.numTerms(); ++term) {
+                    string word = movieTrie.term(term);
+                    if (distanciaEdicion(erradas[q].first, word) <= (int)distancia) recorrido[q].push_back(word);
+                }
+            }
+        });
+        for (size_t q = 0; q < erradas.size(); ++q) {
+            encontradas += automata[q].size();
+            // El autómata deja solo las Trie::FUZZY_EXPANSIONS más cercanas
+            sort(automata[q].begin(), automata[q].end());
+            sort(recorrido[q].begin(), recorrido[q].end());
+            bool iguales = recorrido[q].size() > Trie::FUZZY_EXPANSIONS
+                               ? includes(recorrido[q].begin(), recorrido[q].end(), automata[q].begin(), automata[q].end())
+                               : automata[q] == recorrido[q];
+            if (!iguales) ++distintas;
+        }
+        cout << "Distancia " << distancia << " (" << movieTrie.numTerms() << " palabras en el diccionario)\n";
+        cout << "  automata sobre el Trie: " << msAutomata * 1000.0 / erradas.size() << " us/palabra, "
+             << nodos / erradas.size() << " nodos visitados, " << encontradas / (double)erradas.size()
+             << " palabras parecidas\n";
+        cout << "  distancia a cada palabra: " << msRecorrido * 1000.0 / erradas.size() << " us/palabra\n";
+        cout << "  " << distintas << " conjuntos distintos\n";
     }
 
-    file.close();
-    return movies;
+    size_t resultados = 0;
+    double msBusqueda = medirMs([&]() {
+        for (const auto &errada : erradas) resultados += movieTrie.searchFuzzy(errada.first).size();
+    });
+    cout << "Consulta con la distancia segun el largo: " << msBusqueda * 1000.0 / erradas.size() << " us/consulta ("
+         << resultados / erradas.size() << " resultados)\n";
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     string filename = "../mpst_full_data.csv";
-    vector<shared_ptr<Movie>> movies = readMoviesFromCSV(filename);
 
+    // Modos de benchmark: PROYECTO_PROGRA3 --bench-<modo> [archivo.csv] [consultas.txt]
+    if (argc > 1) {
+        string modo = argv[1];
+        if (argc > 2) filename = argv[2];
+        if (modo == "--bench-csv") {
+            benchmarkLecturaCSV(filename);
+        } else if (modo == "--bench-trie") {
+            benchmarkTrie(filename);
+        } else if (modo == "--bench-postings") {
+            benchmarkPostings(filename);
+        } else if (modo == "--bench-bm25") {
+            benchmarkBM25(filename, argc > 3 ? argv[3] : "");
+        } else if (modo == "--bench-topk") {
+            benchmarkTopK(filename, argc > 3 ? argv[3] : "");
+        } else if (modo == "--bench-snapshot") {
+            benchmarkSnapshot(filename);
+        } else if (modo == "--bench-qps") {
+            benchmarkQPS(filename, argc > 3 ? argv[3] : "");
+        } else if (modo == "--bench-tags") {
+            benchmarkTags(filename);
+        } else if (modo == "--bench-filters") {
+            benchmarkFiltros(filename);
+        } else if (modo == "--bench-phrase") {
+            benchmarkFrases(filename);
+        } else if (modo == "--bench-boolean") {
+            benchmarkBooleano(filename);
+        } else if (modo == "--bench-build") {
+            benchmarkConstruccion(filename);
+        } else if (modo == "--bench-build-threads") {
+            benchmarkConstruccionParalela(filename, argc > 3 ? (unsigned)stoul(argv[3]) : 0);
+        } else if (modo == "--bench-store") {
+            benchmarkCatalogo(filename);
+        } else if (modo == "--bench-handles") {
+            benchmarkReferencias(filename, argc > 3 ? argv[3] : "");
+        } else if (modo == "--bench-tokenizer") {
+            benchmarkTokenizador(filename);
+        } else if (modo == "--bench-analysis") {
+            benchmarkAnalisis(filename, argc > 3 ? argv[3] : "");
+        } else if (modo == "--bench-autocomplete") {
+            benchmarkAutocompletado(filename, argc > 3 ? argv[3] : "");
+        } else if (modo == "--bench-fuzzy") {
+            benchmarkDifuso(filename);
+        } else if (modo == "--bench-fields") {
+            benchmarkCampos(filename, argc > 3 ? argv[3] : "");
+        } else if (modo == "--bench-similar") {
+            benchmarkSimilares(filename);
+        } else if (modo == "--bench-hnsw") {
+            benchmarkHnsw(filename);
+        } else if (modo == "--bench-dedup") {
+            benchmarkDuplicados(filename);
+        } else if (modo == "--bench-incremental") {
+            benchmarkIncremental(filename, argc > 3 ? argv[3] : "");
+        } else {
+            cerr << "Modo desconocido: " << modo << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Se parte del snapshot si existe y corresponde al CSV actual; si no, se
+    // reconstruye el índice desde el CSV y se guarda un snapshot nuevo
+    string snapshotFile = filename + ".idx";
     Trie movieTrie;
-    for (const auto &movie : movies) {
-        movieTrie.insert(movie);
+    bool reconstruido = false;
+    if (!movieTrie.loadSnapshot(snapshotFile, filename)) {
+        // Las sinopsis casi iguales se unen antes de indexar (ver NearDuplicates)
+        movieTrie.insert(NearDuplicates::removeDuplicates(readMoviesFromCSVParallel(filename)));
+        movieTrie.freeze();
+        reconstruido = true;
+        if (!movieTrie.allMovies().empty()) {
+            movieTrie.saveSnapshot(snapshotFile, filename);
+        }
+    }
+
+    // El índice HNSW se guarda junto al snapshot y se reconstruye con el Trie, porque
+    // sus vectores salen de las palabras del índice
+    string hnswFile = filename + ".hnsw";
+    HnswIndex vecinos;
+    if (reconstruido || !vecinos.load(hnswFile, filename, movieTrie.allMovies().size())) {
+        vecinos.build(movieTrie);
+        if (vecinos.size() > 0) {
+            vecinos.save(hnswFile, filename);
+        }
     }
 
-    PlataformaStreaming plataforma;
+    PlataformaStreaming plataforma(movieTrie, vecinos);
 
     string search_query;
-    cout << "Enter a word, phrase, or tag to search: ";
+    cout << "Enter a word, phrase, or tag to search (e.g. heist AND (bank OR casino) NOT comedy, \"dark knight\", tag:crime, detect*): ";
     getline(cin, search_query);
 
-    vector<shared_ptr<Movie>> results = movieTrie.search(search_query);
+    string tag_filter;
+    cout << "Filter by tags (e.g. cult, horror|gothic, -comedy) or leave empty: ";
+    getline(cin, tag_filter);
+
+    // El texto puede traer condiciones propias; se suman a las del filtro de tags
+    string text_query;
+    MovieFilter filter = MovieFilter::parse(search_query, text_query);
+    for (const auto &condition : MovieFilter::fromTags(TagFilter::parse(tag_filter)).conditions) {
+        filter.conditions.push_back(condition);
+    }
+
+    // Con operadores, comillas, campos o prefijos es una consulta booleana; si no,
+    // se buscan las palabras por separado y se ordena por BM25
+    SearchResults results = QueryParser::isBoolean(text_query) ? movieTrie.searchQuery(text_query, filter)
+                                                                : movieTrie.search(text_query, filter);
+    if (movieTrie.splitWords(text_query).empty() && !filter.empty()) {
+        // Solo filtros: se listan las películas que los cumplen
+        vector<SearchResult> filtered;
+        movieTrie.filter(filter).forEach([&](uint32_t doc) {
+            filtered.push_back({doc, 0.0});
+        });
+        results = SearchResults(move(filtered));
+    }
     int offset = 0;
 
+    // Sin resultados: se buscan palabras parecidas por si hay errores de tipeo y, si
+    // tampoco hay, se sugieren palabras del índice que empiezan como la última escrita
+    vector<string> palabras = movieTrie.splitWords(text_query);
+    if (results.empty() && !palabras.empty() && !QueryParser::isBoolean(text_query) && movieTrie.isFrozen()) {
+        results = movieTrie.searchFuzzy(text_query, Trie::AUTO_DISTANCE, filter);
+        if (!results.empty()) {
+            cout << "Quisiste decir:";
+            for (const string &palabra : palabras) {
+                vector<Trie::Correction> correcciones = movieTrie.corrections(palabra);
+                cout << " " << (correcciones.empty() ? palabra : correcciones.front().word);
+            }
+            cout << "\n";
+        }
+    }
+    if (results.empty() && !palabras.empty()) {
+        vector<Trie::Completion> sugerencias = movieTrie.complete(palabras.back());
+        if (!sugerencias.empty()) {
+            cout << "Sugerencias:";
+            for (const auto &sugerencia : sugerencias) cout << " " << sugerencia.word;
+            cout << "\n";
+        }
+    }
+
     while (true) {
         plataforma.mostrarResultadosBusquedaSinopsis(results, offset);
 
@@ -277,24 +7760,30 @@ int main() {
             cin >> index;
 
             if (index > 0 && index <= results.size()) {
-                auto movie = results[index - 1];
-                cout << "\nTítulo: " << movie->title << "\n";
-                cout << "Sinopsis: " << movie->plot_synopsis << "\n";
-                cout << "Relevance Score: " << movie->relevance_score << "\n";
+                const SearchResult &result = results.at(index - 1);
+                Movie movie = movieTrie.movie(result.doc);
+                cout << "\nTítulo: " << movie.title() << "\n";
+                cout << "Sinopsis: " << movie.plot_synopsis() << "\n";
+                cout << "Relevance Score: " << result.score << "\n";
                 cout << "-----------------------\n";
 
                 cout << "Opciones para esta película:\n";
                 cout << "1. Marcar Like\n";
                 cout << "2. Marcar Ver más tarde\n";
-                cout << "3. Volver\n";
+                cout << "3. Ver películas parecidas\n";
+                cout << "4. Volver\n";
 
                 int sub_opcion;
                 cin >> sub_opcion;
 
                 if (sub_opcion == 1) {
-                    plataforma.marcarLike(movie);
+                    plataforma.marcarLike(result.doc);
+                    movieTrie.setFlag(result.doc, "liked", true);
                 } else if (sub_opcion == 2) {
-                    plataforma.marcarVerMasTarde(movie);
+                    plataforma.marcarVerMasTarde(result.doc);
+                    movieTrie.setFlag(result.doc, "watch_later", true);
+                } else if (sub_opcion == 3) {
+                    plataforma.mostrarPeliculasParecidas(result.doc);
                 }
             } else {
                 cout << "Número de película inválido.\n";